@@ -0,0 +1,263 @@
+#include "base64_simd.h"
+
+#include "base64_stream.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define BASE64_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace util {
+
+#if defined(BASE64_SIMD_X86)
+namespace {
+
+#define BASE64_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+
+// The vector kernels below follow the well-known pshufb formulation: encode
+// splits each 3-byte group into four 6-bit indices with two multiplies and
+// maps them to ASCII with a per-range offset table; decode validates with a
+// pair of nibble-indexed tables and packs four 6-bit values back into three
+// bytes with two multiply-adds. Anything the vector path cannot handle,
+// including padding and invalid characters, is left to the scalar tail.
+
+BASE64_TARGET_SSE41 __m128i EncodeReshuffle128(__m128i in) {
+  in = _mm_shuffle_epi8(
+      in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+BASE64_TARGET_SSE41 __m128i EncodeTranslate128(__m128i indices) {
+  const __m128i shift_lut = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  result = _mm_shuffle_epi8(shift_lut, result);
+  return _mm_add_epi8(result, indices);
+}
+
+// Consumes 12 input bytes per iteration; reads 16.
+BASE64_TARGET_SSE41 int EncodeSse41(const uint8_t* in, int count,
+                                    uint8_t* out) {
+  int i = 0;
+  for (; count - i >= 16; i += 12, out += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    block = EncodeTranslate128(EncodeReshuffle128(block));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+  }
+  return i;
+}
+
+// Consumes 24 input bytes per iteration; reads 28.
+BASE64_TARGET_AVX2 int EncodeAvx2(const uint8_t* in, int count,
+                                  uint8_t* out) {
+  const __m256i shuffle = _mm256_set_epi8(
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,  //
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i shift_lut = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+  int i = 0;
+  for (; count - i >= 28; i += 24, out += 32) {
+    __m256i block = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)), 1);
+    block = _mm256_shuffle_epi8(block, shuffle);
+
+    const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result =
+        _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_shuffle_epi8(shift_lut, result);
+    result = _mm256_add_epi8(result, indices);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), result);
+  }
+  return i;
+}
+
+// Consumes 16 characters per iteration and writes 16 bytes, of which 12 are
+// output. Stops at the first block containing anything other than the 64
+// alphabet characters. Callers must keep at least 8 characters back so the
+// final (possibly padded) quantum and the overhanging store stay in bounds.
+BASE64_TARGET_SSE41 int DecodeSse41(const uint8_t* in, int count,
+                                    uint8_t* out) {
+  const __m128i lut_lo =
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi =
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0,
+                                         0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+  int i = 0;
+  for (; count - i >= 24; i += 16, out += 12) {
+    __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i hi_nibbles =
+        _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm_testz_si128(lo, hi)) {
+      break;
+    }
+
+    const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+    const __m128i roll =
+        _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    str = _mm_add_epi8(str, roll);
+
+    const __m128i merged =
+        _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+    __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    packed = _mm_shuffle_epi8(
+        packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                              -1, -1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+  }
+  return i;
+}
+
+// AVX2 variant of `DecodeSse41`: 32 characters in, 32 bytes written, 24 of
+// them output.
+BASE64_TARGET_AVX2 int DecodeAvx2(const uint8_t* in, int count,
+                                  uint8_t* out) {
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+      0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,  //
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+  const __m256i pack_shuffle = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,  //
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  int i = 0;
+  for (; count - i >= 48; i += 32, out += 24) {
+    __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const __m256i hi_nibbles =
+        _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+    const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) {
+      break;
+    }
+
+    const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+    const __m256i roll =
+        _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+
+    const __m256i merged =
+        _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    packed = _mm256_shuffle_epi8(packed, pack_shuffle);
+    packed = _mm256_permutevar8x32_epi32(
+        packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), packed);
+  }
+  return i;
+}
+
+#undef BASE64_TARGET_SSE41
+#undef BASE64_TARGET_AVX2
+
+}  // namespace
+
+Base64SimdLevel Base64DetectSimdLevel() {
+  static const Base64SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return Base64SimdLevel::kAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return Base64SimdLevel::kSse41;
+    }
+    return Base64SimdLevel::kScalar;
+  }();
+  return level;
+}
+
+int Base64EncodeSimd(const uint8_t* in, int count, uint8_t* out) {
+  int consumed = 0;
+  switch (Base64DetectSimdLevel()) {
+    case Base64SimdLevel::kAvx2:
+      consumed = EncodeAvx2(in, count, out);
+      break;
+
+    case Base64SimdLevel::kSse41:
+      consumed = EncodeSse41(in, count, out);
+      break;
+
+    case Base64SimdLevel::kScalar:
+      break;
+  }
+  int written = consumed / 3 * 4;
+  return written + Base64Encode(in + consumed, count - consumed, out + written);
+}
+
+int Base64DecodeSimd(const uint8_t* in, int count, uint8_t* out) {
+  if (count % 4 != 0) {
+    return -1;
+  }
+
+  int consumed = 0;
+  switch (Base64DetectSimdLevel()) {
+    case Base64SimdLevel::kAvx2:
+      consumed = DecodeAvx2(in, count, out);
+      break;
+
+    case Base64SimdLevel::kSse41:
+      consumed = DecodeSse41(in, count, out);
+      break;
+
+    case Base64SimdLevel::kScalar:
+      break;
+  }
+  int written = consumed / 4 * 3;
+  int tail = Base64Decode(in + consumed, count - consumed, out + written);
+  return (tail < 0) ? -1 : written + tail;
+}
+
+#else  // !BASE64_SIMD_X86
+
+Base64SimdLevel Base64DetectSimdLevel() { return Base64SimdLevel::kScalar; }
+
+int Base64EncodeSimd(const uint8_t* in, int count, uint8_t* out) {
+  return Base64Encode(in, count, out);
+}
+
+int Base64DecodeSimd(const uint8_t* in, int count, uint8_t* out) {
+  return Base64Decode(in, count, out);
+}
+
+#endif  // BASE64_SIMD_X86
+
+}  // namespace util
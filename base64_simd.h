@@ -0,0 +1,27 @@
+#ifndef BASE64_SIMD_H_
+#define BASE64_SIMD_H_
+
+#include <stdint.h>
+
+namespace util {
+
+// Vectorized base64 for host-side tooling. On x86-64 Linux the widest of
+// SSE4.1 and AVX2 supported by the running CPU is picked on first use; on all
+// other targets, including the firmware, these forward to the scalar
+// `Base64Encode`/`Base64Decode`. Input acceptance and output are identical to
+// the scalar functions.
+
+enum class Base64SimdLevel { kScalar = 0, kSse41, kAvx2 };
+
+// Returns the instruction set used by `Base64EncodeSimd`/`Base64DecodeSimd`.
+Base64SimdLevel Base64DetectSimdLevel();
+
+// Same contract as `Base64Encode`.
+int Base64EncodeSimd(const uint8_t* in, int count, uint8_t* out);
+
+// Same contract as `Base64Decode`.
+int Base64DecodeSimd(const uint8_t* in, int count, uint8_t* out);
+
+}  // namespace util
+
+#endif  // BASE64_SIMD_H_
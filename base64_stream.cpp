@@ -12,50 +12,237 @@ const uint8_t kReverseLookup[] = {
     11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0,  0,  0,  0,
     0,  0,  26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42,
     43, 44, 45, 46, 47, 48, 49, 50, 51, 0,  0,  0,  0,  0};
-const uint8_t kTerminator[] = "==";
+constexpr uint8_t kPadding = '=';
+
+// Encodes the three bytes at `in` as four characters at `out`.
+void EncodeBlock(const uint8_t* in, uint8_t* out) {
+  uint32_t block = (static_cast<uint32_t>(in[0]) << 16) |
+                   (static_cast<uint32_t>(in[1]) << 8) | in[2];
+  out[0] = kForwardLookup[block >> 18];
+  out[1] = kForwardLookup[(block >> 12) & 0x3f];
+  out[2] = kForwardLookup[(block >> 6) & 0x3f];
+  out[3] = kForwardLookup[block & 0x3f];
+}
+
+// Looks up the 6-bit value of `character`. Returns false if `character` is not
+// part of the base64 alphabet.
+bool ReverseLookup(uint8_t character, uint8_t* value) {
+  if (character >= sizeof(kReverseLookup)) {
+    return false;
+  }
+  *value = kReverseLookup[character];
+  // 'A' is the only character that legitimately maps to zero.
+  return *value != 0 || character == 'A';
+}
 
 }  // namespace
 
-bool Base64EncodeStream::Write(const uint8_t& token) {
-  pipe_.Push(token, 8);
-  while (pipe_.size() >= 6) {
-    uint16_t index = 0;
-    if (!pipe_.Pop(6, &index)) {
-      return false;
+int Base64Encode(const uint8_t* in, int count, uint8_t* out) {
+  uint8_t* start = out;
+  int i = 0;
+  for (; count - i >= 3; i += 3, out += 4) {
+    EncodeBlock(in + i, out);
+  }
+
+  int remaining = count - i;
+  if (remaining > 0) {
+    uint8_t block[3] = {};
+    for (int j = 0; j < remaining; ++j) {
+      block[j] = in[i + j];
     }
-    if (!stream()->Write(kForwardLookup[index])) {
-      return false;
+    EncodeBlock(block, out);
+    for (int j = remaining + 1; j < 4; ++j) {
+      out[j] = kPadding;
     }
+    out += 4;
   }
-  return true;
+  return out - start;
+}
+
+int Base64Decode(const uint8_t* in, int count, uint8_t* out) {
+  if (count % 4 != 0) {
+    return -1;
+  }
+
+  uint8_t* start = out;
+  for (int i = 0; i < count; i += 4) {
+    // Padding may only fill the last one or two characters of the final
+    // quantum.
+    int chars = 4;
+    if (i + 4 == count) {
+      if (in[i + 3] == kPadding) {
+        chars = (in[i + 2] == kPadding) ? 2 : 3;
+      }
+    }
+
+    uint32_t quantum = 0;
+    for (int j = 0; j < chars; ++j) {
+      uint8_t value = 0;
+      if (!ReverseLookup(in[i + j], &value)) {
+        return -1;
+      }
+      quantum |= static_cast<uint32_t>(value) << (18 - 6 * j);
+    }
+
+    for (int j = 0; j < chars - 1; ++j) {
+      *out++ = static_cast<uint8_t>(quantum >> (16 - 8 * j));
+    }
+  }
+  return out - start;
+}
+
+int Base64EncodeStream::WriteBuffer(const uint8_t* buffer, int count) {
+  int i = 0;
+
+  // Complete a block left over from a previous write.
+  if (pending_size_ > 0) {
+    while (pending_size_ < 3 && i < count) {
+      pending_[pending_size_++] = buffer[i++];
+    }
+    if (pending_size_ < 3) {
+      return count;
+    }
+    // The block stays pending on failure, so the bytes taken into it count
+    // as accepted and a retry from `i` encodes them exactly once.
+    uint8_t* out = Reserve(4);
+    if (out == nullptr) {
+      return i;
+    }
+    EncodeBlock(pending_, out);
+    pending_size_ = 0;
+  }
+
+  for (; count - i >= 3; i += 3) {
+    uint8_t* out = Reserve(4);
+    if (out == nullptr) {
+      return i;
+    }
+    EncodeBlock(buffer + i, out);
+  }
+
+  while (i < count) {
+    pending_[pending_size_++] = buffer[i++];
+  }
+  return count;
+}
+
+uint8_t* Base64EncodeStream::Reserve(int count) {
+  if (staged_ + count > kStagingSize && !Drain()) {
+    return nullptr;
+  }
+  uint8_t* out = staging_ + staged_;
+  staged_ += count;
+  return out;
+}
+
+bool Base64EncodeStream::Drain() {
+  if (staged_ == 0) {
+    return true;
+  }
+  int count = staged_;
+  staged_ = 0;
+  return stream()->WriteBuffer(staging_, count) == count;
 }
 
 bool Base64EncodeStream::Flush() {
-  uint16_t index = 0;
-  switch (pipe_.size()) {
-    case 0:
-      return true;
-
-    case 2: {
-      if (pipe_.Push(0, 4) && pipe_.Pop(6, &index) &&
-          stream()->Write(kForwardLookup[index]) &&
-          stream()->WriteBuffer(kTerminator, 2)) {
-        return true;
+  if (pending_size_ == 0) {
+    return Drain();
+  }
+
+  // Encode the partial block with zero fill, then replace the characters
+  // that carry no input bits with padding.
+  for (int i = pending_size_; i < 3; ++i) {
+    pending_[i] = 0;
+  }
+  uint8_t* out = Reserve(4);
+  if (out == nullptr) {
+    return false;
+  }
+  EncodeBlock(pending_, out);
+  for (int i = pending_size_ + 1; i < 4; ++i) {
+    out[i] = kPadding;
+  }
+  pending_size_ = 0;
+  return Drain();
+}
+
+int Base64DecodeStream::WriteBuffer(const uint8_t* buffer, int count) {
+  if (error_) {
+    return 0;
+  }
+
+  // Characters before `drained` have had their output written downstream.
+  int drained = 0;
+  for (int i = 0; i < count; ++i) {
+    uint8_t character = buffer[i];
+    uint8_t value = 0;
+
+    if (character == kPadding) {
+      // Padding may only fill the last one or two characters of a quantum.
+      if (quantum_chars_ < 2) {
+        error_ = true;
+        return i;
       }
-    } break;
+      ++padding_;
+    } else if (padding_ != 0 || !ReverseLookup(character, &value)) {
+      error_ = true;
+      return i;
+    }
 
-    case 4: {
-      if (pipe_.Push(0, 2) && pipe_.Pop(6, &index) &&
-          stream()->Write(kForwardLookup[index]) &&
-          stream()->WriteBuffer(kTerminator, 1)) {
-        return true;
+    quantum_ = (quantum_ << 6) | value;
+    if (padding_ == 0) {
+      ++quantum_chars_;
+    }
+
+    if (quantum_chars_ + padding_ == 4) {
+      EmitQuantum(3 - padding_);
+      quantum_ = 0;
+      quantum_chars_ = 0;
+      // Keep `padding_` set so that any data after the padding is rejected.
+    }
+
+    // A failed drain loses the output of every character since the last
+    // drain, so those are reported as not accepted.
+    if (staged_ > kStagingSize - 3) {
+      if (!Drain()) {
+        return drained;
       }
-    } break;
+      drained = i + 1;
+    }
+  }
+
+  return Drain() ? count : drained;
+}
+
+void Base64DecodeStream::EmitQuantum(int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    staging_[staged_++] = static_cast<uint8_t>(quantum_ >> (16 - 8 * i));
+  }
+}
 
-    default:
-      return false;
+bool Base64DecodeStream::Drain() {
+  if (staged_ == 0) {
+    return true;
   }
-  return false;
+  int count = staged_;
+  staged_ = 0;
+  if (stream()->WriteBuffer(staging_, count) != count) {
+    error_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool Base64DecodeStream::Flush() {
+  return !error_ && quantum_chars_ == 0 && Drain();
+}
+
+void Base64DecodeStream::Reset() {
+  quantum_ = 0;
+  quantum_chars_ = 0;
+  padding_ = 0;
+  error_ = false;
+  staged_ = 0;
 }
 
 }  // namespace util
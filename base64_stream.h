@@ -3,18 +3,84 @@
 
 #include <stdint.h>
 
-#include "bit_pipe.h"
 #include "stream.h"
 
 namespace util {
 
+// Returns the number of characters produced by base64-encoding `bytes` bytes,
+// including padding.
+constexpr int Base64EncodedSize(int bytes) { return 4 * ((bytes + 2) / 3); }
+
+// Encodes `count` bytes from `in` as padded base64 into `out`, which must hold
+// `Base64EncodedSize(count)` characters. Returns the number of characters
+// written.
+int Base64Encode(const uint8_t* in, int count, uint8_t* out);
+
+// Decodes `count` base64 characters from `in` into `out`, which must hold
+// `count / 4 * 3` bytes. Accepts exactly what `Base64DecodeStream` accepts
+// followed by a successful `Flush`. Returns the number of bytes written, or -1
+// if the input is invalid.
+int Base64Decode(const uint8_t* in, int count, uint8_t* out);
+
+// Encodes written bytes as base64, three input bytes to four characters at a
+// time. Encoded characters are staged internally and forwarded downstream in
+// runs; call `Flush` at the end of a message to encode any partial block with
+// padding and push out any staged characters.
 class Base64EncodeStream : public Stream<uint8_t> {
  public:
-  bool Write(const uint8_t& token) final;
+  int WriteBuffer(const uint8_t* buffer, int count) final;
+  bool Flush();
+
+ private:
+  static constexpr int kStagingSize = 64;
+
+  // Reserves `count` characters at the end of the staging buffer, draining it
+  // downstream first if there is not enough room. Returns nullptr if the
+  // downstream write fails.
+  uint8_t* Reserve(int count);
+
+  // Writes all staged characters downstream in a single call.
+  bool Drain();
+
+  // Input bytes of an incomplete block.
+  uint8_t pending_[3];
+  int pending_size_ = 0;
+  uint8_t staging_[kStagingSize];
+  int staged_ = 0;
+};
+
+// Decodes base64 characters as they are written and forwards the decoded bytes
+// downstream at the end of each write. Any character outside the base64
+// alphabet, or data following `=` padding, puts the stream into an error state
+// that persists until `Reset`.
+class Base64DecodeStream : public Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final;
+
+  // Checks that the input ended on a quantum boundary. Returns false if
+  // characters of an incomplete quantum remain or the stream is in error.
   bool Flush();
 
+  // Clears all decoder state, including errors.
+  void Reset();
+
+  bool error() const { return error_; }
+
  private:
-  BitPipe<uint16_t> pipe_{ShiftDirection::kLeft};
+  static constexpr int kStagingSize = 48;
+
+  // Forwards all staged bytes downstream in a single call.
+  bool Drain();
+
+  // Emits the top `bytes` bytes of the current quantum.
+  void EmitQuantum(int bytes);
+
+  uint32_t quantum_ = 0;
+  int quantum_chars_ = 0;
+  int padding_ = 0;
+  bool error_ = false;
+  uint8_t staging_[kStagingSize];
+  int staged_ = 0;
 };
 
 }  // namespace util
@@ -94,6 +94,18 @@ int CountTrailingOnesField(T value, int bits, int offset) {
   return count;
 }
 
+template <typename T>
+int CountOnes(T value) {
+  static_assert(std::is_unsigned<T>::value, "");
+  int count = 0;
+  while (value) {
+    value &= value - 1;
+    ++count;
+  }
+
+  return count;
+}
+
 }  // namespace util
 
 #endif  // BITS_H_
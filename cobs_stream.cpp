@@ -0,0 +1,43 @@
+#include "cobs_stream.h"
+
+namespace util {
+
+int CobsEncodeStream::WriteBuffer(const uint8_t* buffer, int count) {
+  // Byte `i` is part of the block being emitted, so a failed emit still
+  // accepts it.
+  for (int i = 0; i < count; ++i) {
+    if (buffer[i] == 0) {
+      after_full_block_ = false;
+      if (!EmitBlock()) {
+        return i + 1;
+      }
+      continue;
+    }
+
+    block_[1 + block_size_++] = buffer[i];
+    if (block_size_ == kMaxBlockSize) {
+      after_full_block_ = true;
+      if (!EmitBlock()) {
+        return i + 1;
+      }
+    }
+  }
+  return count;
+}
+
+bool CobsEncodeStream::EmitBlock() {
+  int length = block_size_ + 1;
+  block_[0] = static_cast<uint8_t>(length);
+  block_size_ = 0;
+  return stream()->WriteBuffer(block_, length) == length;
+}
+
+bool CobsEncodeStream::Flush() {
+  // A full block followed by the end of the frame needs no trailing empty
+  // block.
+  bool ok = (block_size_ == 0 && after_full_block_) || EmitBlock();
+  after_full_block_ = false;
+  return ok && stream()->Write(0);
+}
+
+}  // namespace util
@@ -0,0 +1,41 @@
+#ifndef COBS_STREAM_H_
+#define COBS_STREAM_H_
+
+#include <stdint.h>
+
+#include "stream.h"
+
+namespace util {
+
+// Returns the worst-case number of bytes produced by COBS-encoding `bytes`
+// bytes, including the trailing zero delimiter.
+constexpr int CobsEncodedSize(int bytes) { return bytes + bytes / 254 + 2; }
+
+// Encodes written bytes with Consistent Overhead Byte Stuffing. The encoded
+// output contains no zero bytes, so a zero delimiter written by `Flush` marks
+// the end of each frame and lets a reader resynchronize after corruption.
+// Blocks of up to 254 bytes are buffered and forwarded downstream whole.
+class CobsEncodeStream : public Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final;
+
+  // Emits the final block and the zero delimiter, ending the current frame.
+  bool Flush();
+
+ private:
+  static constexpr int kMaxBlockSize = 254;
+
+  // Writes the current block downstream, preceded by its code byte.
+  bool EmitBlock();
+
+  // block_[0] is reserved for the code byte.
+  uint8_t block_[kMaxBlockSize + 1];
+  int block_size_ = 0;
+  // Set when the last emitted block was a full 254-byte block, which carries
+  // no implicit zero.
+  bool after_full_block_ = false;
+};
+
+}  // namespace util
+
+#endif  // COBS_STREAM_H_
@@ -6,6 +6,9 @@
 #error Regenerate this file with the current version of nanopb generator.
 #endif
 
+PB_BIND(InputEvent, InputEvent, AUTO)
+
+
 PB_BIND(Control, Control, AUTO)
 
 
@@ -26,7 +26,22 @@ typedef enum _Control_Multiplier {
     Control_Multiplier_MULT_X100 = 2
 } Control_Multiplier;
 
+typedef enum _InputEvent_Source {
+    InputEvent_Source_SOURCE_KEYPAD = 0,
+    InputEvent_Source_SOURCE_AXIS = 1,
+    InputEvent_Source_SOURCE_MULTIPLIER = 2,
+    InputEvent_Source_SOURCE_ESTOP = 3,
+    InputEvent_Source_SOURCE_FEEDHOLD = 4
+} InputEvent_Source;
+
 /* Struct definitions */
+typedef struct _InputEvent {
+    uint32_t time_us;
+    InputEvent_Source source;
+    uint32_t index;
+    bool pressed;
+} InputEvent;
+
 typedef struct _Control {
     bool has_value;
     int32_t value;
@@ -42,6 +57,16 @@ typedef struct _Control {
     bool feedhold;
     bool has_estop;
     bool estop;
+    bool has_value_delta;
+    int32_t value_delta;
+    bool has_position;
+    int64_t position;
+    pb_size_t events_count;
+    InputEvent events[8];
+    bool has_velocity;
+    int32_t velocity;
+    bool has_acceleration;
+    int32_t acceleration;
 } Control;
 
 
@@ -54,16 +79,26 @@ typedef struct _Control {
 #define _Control_Multiplier_MAX Control_Multiplier_MULT_X100
 #define _Control_Multiplier_ARRAYSIZE ((Control_Multiplier)(Control_Multiplier_MULT_X100+1))
 
+#define _InputEvent_Source_MIN InputEvent_Source_SOURCE_KEYPAD
+#define _InputEvent_Source_MAX InputEvent_Source_SOURCE_FEEDHOLD
+#define _InputEvent_Source_ARRAYSIZE ((InputEvent_Source)(InputEvent_Source_SOURCE_FEEDHOLD+1))
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /* Initializer values for message structs */
-#define Control_init_default                     {false, 0, false, _Control_Axis_MIN, false, _Control_Multiplier_MIN, false, 0, false, 0, false, 0, false, 0}
-#define Control_init_zero                        {false, 0, false, _Control_Axis_MIN, false, _Control_Multiplier_MIN, false, 0, false, 0, false, 0, false, 0}
+#define InputEvent_init_default                  {0, _InputEvent_Source_MIN, 0, 0}
+#define Control_init_default                     {false, 0, false, _Control_Axis_MIN, false, _Control_Multiplier_MIN, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, 0, {InputEvent_init_default, InputEvent_init_default, InputEvent_init_default, InputEvent_init_default, InputEvent_init_default, InputEvent_init_default, InputEvent_init_default, InputEvent_init_default}, false, 0, false, 0}
+#define InputEvent_init_zero                     {0, _InputEvent_Source_MIN, 0, 0}
+#define Control_init_zero                        {false, 0, false, _Control_Axis_MIN, false, _Control_Multiplier_MIN, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, 0, {InputEvent_init_zero, InputEvent_init_zero, InputEvent_init_zero, InputEvent_init_zero, InputEvent_init_zero, InputEvent_init_zero, InputEvent_init_zero, InputEvent_init_zero}, false, 0, false, 0}
 
 /* Field tags (for use in manual encoding/decoding) */
+#define InputEvent_time_us_tag                   1
+#define InputEvent_source_tag                    2
+#define InputEvent_index_tag                     3
+#define InputEvent_pressed_tag                   4
 #define Control_value_tag                        1
 #define Control_axis_tag                         2
 #define Control_multiplier_tag                   3
@@ -71,8 +106,21 @@ extern "C" {
 #define Control_key_released_tag                 5
 #define Control_feedhold_tag                     6
 #define Control_estop_tag                        7
+#define Control_value_delta_tag                  8
+#define Control_position_tag                     9
+#define Control_events_tag                       10
+#define Control_velocity_tag                     11
+#define Control_acceleration_tag                 12
 
 /* Struct field encoding specification for nanopb */
+#define InputEvent_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   time_us,           1) \
+X(a, STATIC,   REQUIRED, UENUM,    source,            2) \
+X(a, STATIC,   REQUIRED, UINT32,   index,             3) \
+X(a, STATIC,   REQUIRED, BOOL,     pressed,           4)
+#define InputEvent_CALLBACK NULL
+#define InputEvent_DEFAULT NULL
+
 #define Control_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, INT32,    value,             1) \
 X(a, STATIC,   OPTIONAL, UENUM,    axis,              2) \
@@ -80,17 +128,26 @@ X(a, STATIC,   OPTIONAL, UENUM,    multiplier,        3) \
 X(a, STATIC,   OPTIONAL, INT32,    key_pressed,       4) \
 X(a, STATIC,   OPTIONAL, INT32,    key_released,      5) \
 X(a, STATIC,   OPTIONAL, BOOL,     feedhold,          6) \
-X(a, STATIC,   OPTIONAL, BOOL,     estop,             7)
+X(a, STATIC,   OPTIONAL, BOOL,     estop,             7) \
+X(a, STATIC,   OPTIONAL, SINT32,   value_delta,       8) \
+X(a, STATIC,   OPTIONAL, SINT64,   position,          9) \
+X(a, STATIC,   REPEATED, MESSAGE,  events,           10) \
+X(a, STATIC,   OPTIONAL, SINT32,   velocity,         11) \
+X(a, STATIC,   OPTIONAL, SINT32,   acceleration,     12)
 #define Control_CALLBACK NULL
 #define Control_DEFAULT NULL
+#define Control_events_MSGTYPE InputEvent
 
+extern const pb_msgdesc_t InputEvent_msg;
 extern const pb_msgdesc_t Control_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define InputEvent_fields &InputEvent_msg
 #define Control_fields &Control_msg
 
 /* Maximum encoded size of messages (where known) */
-#define Control_size                             41
+#define InputEvent_size                          16
+#define Control_size                             214
 
 #ifdef __cplusplus
 } /* extern "C" */
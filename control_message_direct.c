@@ -0,0 +1,152 @@
+/* Straight-line encoder for the Control message, expanded from
+ * Control_FIELDLIST. See control_message_direct.h. */
+
+#include "control_message_direct.h"
+
+#include <string.h>
+
+static pb_byte_t *write_varint32(pb_byte_t *p, uint32_t value)
+{
+    while (value > 0x7F)
+    {
+        *p++ = (pb_byte_t)(0x80 | (value & 0x7F));
+        value >>= 7;
+    }
+    *p++ = (pb_byte_t)value;
+    return p;
+}
+
+static pb_byte_t *write_varint64(pb_byte_t *p, uint64_t value)
+{
+    while (value > 0x7F)
+    {
+        *p++ = (pb_byte_t)(0x80 | (value & 0x7F));
+        value >>= 7;
+    }
+    *p++ = (pb_byte_t)value;
+    return p;
+}
+
+/* Only static fields are supported; any other atype leaves an undefined
+ * identifier in the expansion and fails to compile. */
+#define DIRECT_ATYPE_STATIC
+
+/* Value encoders, by ltype. These mirror pb_enc_bool() and pb_enc_varint():
+ * signed types are sign-extended to 64 bits, sint types are zigzag-encoded. */
+#define DIRECT_WRITE_BOOL(p, v)   write_varint32(p, (v) ? 1U : 0U)
+#define DIRECT_WRITE_UENUM(p, v)  write_varint32(p, (uint32_t)(v))
+#define DIRECT_WRITE_UINT32(p, v) write_varint32(p, (uint32_t)(v))
+#define DIRECT_WRITE_UINT64(p, v) write_varint64(p, (uint64_t)(v))
+#define DIRECT_WRITE_ENUM(p, v)   write_varint64(p, (uint64_t)(int64_t)(v))
+#define DIRECT_WRITE_INT32(p, v)  write_varint64(p, (uint64_t)(int64_t)(v))
+#define DIRECT_WRITE_INT64(p, v)  write_varint64(p, (uint64_t)(int64_t)(v))
+#define DIRECT_WRITE_SINT32(p, v) \
+    write_varint32(p, ((uint32_t)(v) << 1) ^ (uint32_t)((int32_t)(v) >> 31))
+#define DIRECT_WRITE_SINT64(p, v) \
+    write_varint64(p, ((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+
+/* Wire types, by ltype. Submessages are length-delimited; everything else
+ * supported is a varint. */
+#define DIRECT_WT_BOOL    PB_WT_VARINT
+#define DIRECT_WT_UENUM   PB_WT_VARINT
+#define DIRECT_WT_UINT32  PB_WT_VARINT
+#define DIRECT_WT_UINT64  PB_WT_VARINT
+#define DIRECT_WT_ENUM    PB_WT_VARINT
+#define DIRECT_WT_INT32   PB_WT_VARINT
+#define DIRECT_WT_INT64   PB_WT_VARINT
+#define DIRECT_WT_SINT32  PB_WT_VARINT
+#define DIRECT_WT_SINT64  PB_WT_VARINT
+#define DIRECT_WT_MESSAGE PB_WT_STRING
+
+/* Submessages are written through the <msgtype>_encode_direct() function of
+ * their type, found through the generated <struct>_<field>_MSGTYPE define.
+ * The extra level of expansion resolves that define before pasting. */
+#define DIRECT_MSG_ENCODER(msgtype) DIRECT_MSG_ENCODER_I(msgtype)
+#define DIRECT_MSG_ENCODER_I(msgtype) msgtype ## _encode_direct
+#define DIRECT_MSG_SIZE(msgtype) DIRECT_MSG_SIZE_I(msgtype)
+#define DIRECT_MSG_SIZE_I(msgtype) msgtype ## _size
+
+/* Writes one value, key included. Only MESSAGE needs the struct and field
+ * names, to find the submessage type. */
+#define DIRECT_WRITE_VALUE(structname, ltype, name, tag, v) \
+    p = write_varint32(p, ((uint32_t)(tag) << 3) | DIRECT_WT_ ## ltype); \
+    DIRECT_WRITE_VALUE_ ## ltype(structname, ltype, name, v)
+
+#define DIRECT_WRITE_VALUE_MESSAGE(structname, ltype, name, v) \
+    { \
+        pb_byte_t sub[DIRECT_MSG_SIZE(structname ## _ ## name ## _MSGTYPE)]; \
+        size_t sub_size; \
+        if (!DIRECT_MSG_ENCODER(structname ## _ ## name ## _MSGTYPE)( \
+                &(v), sub, &sub_size)) \
+            return false; \
+        p = write_varint32(p, (uint32_t)sub_size); \
+        memcpy(p, sub, sub_size); \
+        p += sub_size; \
+    }
+#define DIRECT_WRITE_VALUE_VARINT(structname, ltype, name, v) \
+    p = DIRECT_WRITE_ ## ltype(p, v);
+#define DIRECT_WRITE_VALUE_BOOL   DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_UENUM  DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_UINT32 DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_UINT64 DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_ENUM   DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_INT32  DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_INT64  DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_SINT32 DIRECT_WRITE_VALUE_VARINT
+#define DIRECT_WRITE_VALUE_SINT64 DIRECT_WRITE_VALUE_VARINT
+
+/* Field presence and repetition, by htype. Proto3 singular scalars are
+ * omitted when zero, matching pb_check_proto3_default_value(). Repeated
+ * fields are written unpacked, one key per element, as pb_encode() does for
+ * submessages. pb_encode() packs repeated scalars instead, so any ltype other
+ * than MESSAGE leaves an undefined identifier and fails to compile. A count
+ * beyond the array size fails like encode_array(). */
+#define DIRECT_REPEATED_MESSAGE
+#define DIRECT_ENCODE_OPTIONAL(structname, ltype, name, tag) \
+    if (src->has_ ## name) \
+    { \
+        DIRECT_WRITE_VALUE(structname, ltype, name, tag, src->name) \
+    }
+#define DIRECT_ENCODE_REQUIRED(structname, ltype, name, tag) \
+    { \
+        DIRECT_WRITE_VALUE(structname, ltype, name, tag, src->name) \
+    }
+#define DIRECT_ENCODE_SINGULAR(structname, ltype, name, tag) \
+    if (src->name != 0) \
+    { \
+        DIRECT_WRITE_VALUE(structname, ltype, name, tag, src->name) \
+    }
+#define DIRECT_ENCODE_REPEATED(structname, ltype, name, tag) \
+    DIRECT_REPEATED_ ## ltype \
+    { \
+        pb_size_t i; \
+        if (src->name ## _count > pb_arraysize(structname, name)) \
+            return false; \
+        for (i = 0; i < src->name ## _count; i++) \
+        { \
+            DIRECT_WRITE_VALUE(structname, ltype, name, tag, src->name[i]) \
+        } \
+    }
+
+/* Expands one field of Control_FIELDLIST or a submessage field list. `src`
+ * is the struct being encoded and `p` the output position. */
+#define DIRECT_ENCODE_FIELD(structname, atype, htype, ltype, name, tag) \
+    DIRECT_ATYPE_ ## atype \
+    DIRECT_ENCODE_ ## htype(structname, ltype, name, tag)
+
+static bool InputEvent_encode_direct(const InputEvent *src, pb_byte_t *buf,
+                                     size_t *size)
+{
+    pb_byte_t *p = buf;
+    InputEvent_FIELDLIST(DIRECT_ENCODE_FIELD, InputEvent)
+    *size = (size_t)(p - buf);
+    return true;
+}
+
+bool Control_encode_direct(const Control *src, pb_byte_t *buf, size_t *size)
+{
+    pb_byte_t *p = buf;
+    Control_FIELDLIST(DIRECT_ENCODE_FIELD, Control)
+    *size = (size_t)(p - buf);
+    return true;
+}
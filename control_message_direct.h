@@ -0,0 +1,31 @@
+/* Straight-line encoder for the Control message.
+ *
+ * Control_encode_direct() produces exactly the same bytes as
+ * pb_encode(stream, Control_fields, src), and fails in the same cases, but is
+ * expanded at compile time from Control_FIELDLIST instead of walking the field
+ * descriptor at runtime. Only static fields are supported, of varint types
+ * (bool, enums, [us]int32/64) or of submessage types that have their own
+ * straight-line encoder in control_message_direct.c. Repeated fields must be
+ * submessages, since pb_encode() packs repeated scalars. Adding a field of any
+ * other type to Control fails to compile there.
+ */
+
+#ifndef CONTROL_MESSAGE_DIRECT_H_INCLUDED
+#define CONTROL_MESSAGE_DIRECT_H_INCLUDED
+
+#include "control_message.pb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Encodes src into buf, which must hold at least Control_size bytes, and
+ * stores the number of bytes written in *size. Returns false if a repeated
+ * field count exceeds its array size, as pb_encode() does. */
+bool Control_encode_direct(const Control *src, pb_byte_t *buf, size_t *size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#include "control_state.h"
+
+#include <string.h>
+
+namespace jog_controller {
+namespace {
+
+template <typename T>
+void DiffField(bool reference_has, const T& reference, bool current_has,
+               const T& current, bool full, bool* delta_has, T* delta) {
+  if (!current_has) {
+    return;
+  }
+  if (full || !reference_has || current != reference) {
+    *delta_has = true;
+    *delta = current;
+  }
+}
+
+}  // namespace
+
+bool ControlIsEmpty(const Control& control) {
+#define CONTROL_HAS_OPTIONAL(name) control.has_##name
+#define CONTROL_HAS_REPEATED(name) (control.name##_count > 0)
+#define CONTROL_HAS_FIELD(a, atype, htype, ltype, name, tag) \
+  || CONTROL_HAS_##htype(name)
+  return !(false Control_FIELDLIST(CONTROL_HAS_FIELD, unused));
+#undef CONTROL_HAS_FIELD
+#undef CONTROL_HAS_REPEATED
+#undef CONTROL_HAS_OPTIONAL
+}
+
+void DiffControl(const Control& reference, const Control& current, bool full,
+                 Control* delta) {
+#define CONTROL_DIFF_FIELD(name)                                     \
+  DiffField(reference.has_##name, reference.name, current.has_##name, \
+            current.name, full, &delta->has_##name, &delta->name)
+  CONTROL_DIFF_FIELD(value);
+  CONTROL_DIFF_FIELD(axis);
+  CONTROL_DIFF_FIELD(multiplier);
+  CONTROL_DIFF_FIELD(feedhold);
+  CONTROL_DIFF_FIELD(estop);
+  CONTROL_DIFF_FIELD(velocity);
+  CONTROL_DIFF_FIELD(acceleration);
+#undef CONTROL_DIFF_FIELD
+}
+
+void MergeControl(const Control& update, Control* state) {
+#define CONTROL_MERGE_FIELD(name) \
+  if (update.has_##name) {        \
+    state->has_##name = true;     \
+    state->name = update.name;    \
+  }
+  CONTROL_MERGE_FIELD(value);
+  CONTROL_MERGE_FIELD(axis);
+  CONTROL_MERGE_FIELD(multiplier);
+  CONTROL_MERGE_FIELD(feedhold);
+  CONTROL_MERGE_FIELD(estop);
+  CONTROL_MERGE_FIELD(velocity);
+  CONTROL_MERGE_FIELD(acceleration);
+  CONTROL_MERGE_FIELD(position);
+#undef CONTROL_MERGE_FIELD
+
+  if (update.has_value_delta) {
+    state->has_position = true;
+    state->position += update.value_delta;
+  }
+
+  state->has_key_pressed = update.has_key_pressed;
+  state->key_pressed = update.key_pressed;
+  state->has_key_released = update.has_key_released;
+  state->key_released = update.key_released;
+  state->has_value_delta = update.has_value_delta;
+  state->value_delta = update.value_delta;
+  state->events_count = update.events_count;
+  memcpy(state->events, update.events,
+         update.events_count * sizeof(update.events[0]));
+}
+
+}  // namespace jog_controller
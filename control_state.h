@@ -0,0 +1,32 @@
+#ifndef CONTROL_STATE_H_
+#define CONTROL_STATE_H_
+
+#include "control_message.pb.h"
+
+namespace jog_controller {
+
+// Helpers for field-level delta frames. The stateful fields of `Control`
+// (value, axis, multiplier, feedhold, estop, velocity, acceleration) describe
+// the current state of the controller and are only sent when they change or in
+// a periodic snapshot. The event fields (key_pressed, key_released,
+// value_delta, events) describe what happened since the previous frame and are
+// never carried over. `position` is an absolute keyframe for `value_delta`.
+
+// Returns true if no field of `control` is present.
+bool ControlIsEmpty(const Control& control);
+
+// Sets in `delta` every stateful field of `current` that is present and
+// differs from `reference`, or every present stateful field of `current` if
+// `full` is true. Other fields of `delta` are left untouched.
+void DiffControl(const Control& reference, const Control& current, bool full,
+                 Control* delta);
+
+// Applies the frame `update` to the merged state `state`: present stateful
+// fields overwrite, `position` resets the accumulated position and
+// `value_delta` is added to it, and event fields replace those of the
+// previous update.
+void MergeControl(const Control& update, Control* state);
+
+}  // namespace jog_controller
+
+#endif  // CONTROL_STATE_H_
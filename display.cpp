@@ -0,0 +1,236 @@
+#include "display.h"
+
+#include <Arduino.h>
+#include <Fonts/FreeSans9pt7b.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace jog_controller {
+namespace {
+
+const char* kAxisNames[] = {"<NAV>", "X", "Y", "Z", "4", "5", "6"};
+const int kMultiplierValues[] = {1, 10, 100};
+
+// Every character the display draws.
+const char kGlyphCharset[] = " !-0123456789:<>AEFJNOPSTVXYZdeghlo";
+
+constexpr int16_t kTextX = 8;
+// Baseline of the text within each band.
+constexpr int16_t kTextBaseline = 16;
+
+template <typename T>
+T clamp(T value, T low, T high) {
+  return std::min(high, std::max(low, value));
+}
+
+Rect Union(const Rect& a, const Rect& b) {
+  int16_t x0 = std::min(a.x, b.x);
+  int16_t y0 = std::min(a.y, b.y);
+  int16_t x1 = std::max(a.x + a.w, b.x + b.w);
+  int16_t y1 = std::max(a.y + a.h, b.y + b.h);
+  return Rect{x0, y0, static_cast<int16_t>(x1 - x0),
+              static_cast<int16_t>(y1 - y0)};
+}
+
+bool Overlaps(const Rect& a, const Rect& b) {
+  return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h &&
+         b.y <= a.y + a.h;
+}
+
+int32_t Area(const Rect& rect) { return int32_t{rect.w} * rect.h; }
+
+Rect Clip(const Rect& rect) {
+  int16_t x0 = std::max<int16_t>(rect.x, 0);
+  int16_t y0 = std::max<int16_t>(rect.y, 0);
+  int16_t x1 = std::min<int16_t>(rect.x + rect.w, Display::kWidth);
+  int16_t y1 = std::min<int16_t>(rect.y + rect.h, Display::kHeight);
+  return Rect{x0, y0, static_cast<int16_t>(x1 - x0),
+              static_cast<int16_t>(y1 - y0)};
+}
+
+}  // namespace
+
+void DirtyRegion::Add(const Rect& rect) {
+  if (rect.empty()) {
+    return;
+  }
+
+  // Merge with anything touching; the result may now touch others, so fold
+  // those in as well.
+  Rect merged = rect;
+  for (int i = 0; i < count_;) {
+    if (Overlaps(merged, rects_[i])) {
+      merged = Union(merged, rects_[i]);
+      rects_[i] = rects_[--count_];
+      i = 0;
+    } else {
+      ++i;
+    }
+  }
+
+  if (count_ < kMaxRects) {
+    rects_[count_++] = merged;
+    return;
+  }
+
+  // Full: grow whichever rectangle gains the least area.
+  int best = 0;
+  int32_t best_growth = INT32_MAX;
+  for (int i = 0; i < count_; ++i) {
+    int32_t growth = Area(Union(rects_[i], merged)) - Area(rects_[i]);
+    if (growth < best_growth) {
+      best = i;
+      best_growth = growth;
+    }
+  }
+  rects_[best] = Union(rects_[best], merged);
+}
+
+Display::Display(Adafruit_ST7735* tft)
+    : tft_(tft),
+      canvas_(kWidth, kHeight),
+      atlas_(&FreeSans9pt7b, kGlyphCharset, kBandHeight, kTextBaseline) {}
+
+void Display::Begin(BaseType_t core, UBaseType_t priority) {
+  mailbox_ = xQueueCreate(1, sizeof(Control));
+  atlas_.Begin();
+  xTaskCreatePinnedToCore(&Display::StaticTask, "display", kTaskStackSize,
+                          this, priority, nullptr, core);
+}
+
+void Display::Update(const Control& state) {
+  if (mailbox_ == nullptr) {
+    return;
+  }
+  if (uxQueueMessagesWaiting(mailbox_) != 0) {
+    coalesced_.fetch_add(1, std::memory_order_relaxed);
+  }
+  xQueueOverwrite(mailbox_, &state);
+}
+
+Display::Stats Display::TakeStats() {
+  Stats stats;
+  stats.frames = frames_.exchange(0, std::memory_order_relaxed);
+  stats.total_frame_us = total_frame_us_.exchange(0, std::memory_order_relaxed);
+  stats.max_frame_us = max_frame_us_.exchange(0, std::memory_order_relaxed);
+  stats.bytes_pushed = bytes_pushed_.exchange(0, std::memory_order_relaxed);
+  stats.coalesced = coalesced_.exchange(0, std::memory_order_relaxed);
+  return stats;
+}
+
+void Display::StaticTask(void* display) {
+  static_cast<Display*>(display)->Task();
+}
+
+void Display::Task() {
+  Control state;
+  while (true) {
+    if (xQueueReceive(mailbox_, &state, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+
+    uint32_t start = micros();
+    Render(state);
+    if (dirty_.count() == 0) {
+      continue;
+    }
+    Push();
+
+    uint32_t frame_us = micros() - start;
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    total_frame_us_.fetch_add(frame_us, std::memory_order_relaxed);
+    uint32_t max_us = max_frame_us_.load(std::memory_order_relaxed);
+    while (frame_us > max_us &&
+           !max_frame_us_.compare_exchange_weak(max_us, frame_us,
+                                                std::memory_order_relaxed)) {
+    }
+  }
+}
+
+void Display::Render(const Control& state) {
+  char text[kTextMaxLength];
+
+  text[0] = '\0';
+  if (state.has_axis) {
+    snprintf(text, sizeof(text), "Jog %s: %ld",
+             kAxisNames[clamp(static_cast<int>(state.axis), 0, 6)],
+             static_cast<long>(state.value));
+  }
+  DrawBand(kJogBand, text, ST77XX_WHITE);
+
+  text[0] = '\0';
+  if (state.has_multiplier) {
+    snprintf(text, sizeof(text), "X%d",
+             kMultiplierValues[clamp(static_cast<int>(state.multiplier), 0,
+                                     2)]);
+  }
+  DrawBand(kMultiplierBand, text, ST77XX_WHITE);
+
+  DrawBand(kEstopBand, state.estop ? "!ESTOP!" : "", ST77XX_RED);
+  DrawBand(kFeedholdBand, state.feedhold ? "Feedhold" : "", ST77XX_BLUE);
+}
+
+void Display::DrawBand(Band band, const char* text, uint16_t color) {
+  BandState& band_state = bands_[band];
+  if (band_state.color == color && strcmp(band_state.text, text) == 0) {
+    return;
+  }
+
+  // A cell is unchanged if it holds the same character at the same position
+  // in the same colour; positions only move when an earlier advance changed.
+  bool recolor = band_state.color != color;
+  const char* old_text = band_state.text;
+  bool old_ended = false;
+  int16_t top = band * kBandHeight;
+  int16_t x = kTextX;
+  int16_t old_x = kTextX;
+  for (int i = 0; text[i] != '\0'; ++i) {
+    char old_c = old_ended ? '\0' : old_text[i];
+    old_ended = (old_c == '\0');
+
+    int16_t advance = atlas_.Advance(text[i]);
+    if (recolor || old_c != text[i] || old_x != x) {
+      atlas_.Blit(text[i], &canvas_, x, top, color, ST77XX_BLACK);
+      dirty_.Add(Clip(Rect{x, top, advance, kBandHeight}));
+    }
+    x += advance;
+    old_x += atlas_.Advance(old_c);
+  }
+
+  if (band_state.end_x > x) {
+    Rect rest = Clip(Rect{x, top, static_cast<int16_t>(band_state.end_x - x),
+                          kBandHeight});
+    canvas_.fillRect(rest.x, rest.y, rest.w, rest.h, ST77XX_BLACK);
+    dirty_.Add(rest);
+  }
+
+  strncpy(band_state.text, text, kTextMaxLength - 1);
+  band_state.text[kTextMaxLength - 1] = '\0';
+  band_state.color = color;
+  band_state.end_x = x;
+}
+
+void Display::Push() {
+  const uint16_t* pixels = canvas_.getBuffer();
+  uint32_t bytes = 0;
+
+  tft_->startWrite();
+  for (int i = 0; i < dirty_.count(); ++i) {
+    const Rect& rect = dirty_.rect(i);
+    tft_->setAddrWindow(rect.x, rect.y, rect.w, rect.h);
+    // Canvas rows are contiguous, so each row of the window is one bulk write.
+    for (int16_t row = rect.y; row < rect.y + rect.h; ++row) {
+      tft_->writePixels(const_cast<uint16_t*>(pixels) + row * kWidth + rect.x,
+                        rect.w);
+    }
+    bytes += Area(rect) * sizeof(uint16_t);
+  }
+  tft_->endWrite();
+
+  dirty_.Clear();
+  bytes_pushed_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+}  // namespace jog_controller
@@ -0,0 +1,126 @@
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+#include <Adafruit_GFX.h>
+#include <Adafruit_ST7735.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "control_message.pb.h"
+#include "glyph_atlas.h"
+
+namespace jog_controller {
+
+struct Rect {
+  int16_t x = 0;
+  int16_t y = 0;
+  int16_t w = 0;
+  int16_t h = 0;
+
+  bool empty() const { return w <= 0 || h <= 0; }
+};
+
+// Set of screen regions that need to be pushed to the panel. Overlapping
+// rectangles are merged; once `kMaxRects` are held, further ones are merged
+// into the closest existing one, trading a few extra pixels for a bounded list.
+class DirtyRegion {
+ public:
+  static constexpr int kMaxRects = 4;
+
+  void Add(const Rect& rect);
+  void Clear() { count_ = 0; }
+
+  int count() const { return count_; }
+  const Rect& rect(int index) const { return rects_[index]; }
+
+ private:
+  Rect rects_[kMaxRects];
+  int count_ = 0;
+};
+
+// Shows the controller state on the ST7735. Frames are rendered into an
+// off-screen 160x128 RGB565 canvas by a background task, and only the dirty
+// regions are pushed to the panel, each with one address window and bulk
+// pixel writes. Text is blitted from a glyph atlas one character cell at a
+// time, and only cells whose character or position changed are redrawn.
+// `Update` only hands the state over, so drawing never blocks the caller; if
+// the task falls behind, intermediate states are skipped and the latest one is
+// drawn.
+class Display {
+ public:
+  static constexpr int kWidth = 160;
+  static constexpr int kHeight = 128;
+
+  // Counters since the last call to `TakeStats`.
+  struct Stats {
+    uint32_t frames = 0;
+    uint32_t total_frame_us = 0;
+    uint32_t max_frame_us = 0;
+    uint32_t bytes_pushed = 0;
+    // States replaced by a newer one before they were drawn.
+    uint32_t coalesced = 0;
+  };
+
+  explicit Display(Adafruit_ST7735* tft);
+
+  // Rasterizes the glyph atlas and starts the render task. The panel must
+  // already be initialized, rotated to landscape and cleared to black.
+  void Begin(BaseType_t core, UBaseType_t priority);
+
+  // Publishes the merged controller state to show, replacing any state not
+  // yet drawn. Never blocks.
+  void Update(const Control& state);
+
+  // Returns the counters accumulated since the previous call and resets them.
+  // May be called from any task.
+  Stats TakeStats();
+
+ private:
+  static constexpr int kTaskStackSize = 4096;
+
+  // The screen is split into fixed horizontal bands, one per status line.
+  enum Band { kJogBand = 0, kMultiplierBand, kEstopBand, kFeedholdBand };
+  static constexpr int kNumBands = 4;
+  static constexpr int kBandHeight = 24;
+  static constexpr int kTextMaxLength = 24;
+
+  struct BandState {
+    char text[kTextMaxLength] = "";
+    uint16_t color = 0;
+    // Right edge of the text as last drawn.
+    int16_t end_x = 0;
+  };
+
+  static void StaticTask(void* display);
+  void Task();
+
+  // Renders `state` into the canvas, adding changed areas to `dirty_`.
+  void Render(const Control& state);
+  // Redraws the cells of `band` that differ between its last text and `text`
+  // in `color`, and clears whatever the old text covered past the new one. A
+  // colour change redraws every cell. An empty `text` clears the band.
+  void DrawBand(Band band, const char* text, uint16_t color);
+  // Pushes every dirty region from the canvas to the panel.
+  void Push();
+
+  Adafruit_ST7735* tft_;
+  GFXcanvas16 canvas_;
+  GlyphAtlas atlas_;
+  QueueHandle_t mailbox_ = nullptr;
+  BandState bands_[kNumBands];
+  DirtyRegion dirty_;
+
+  std::atomic<uint32_t> frames_{0};
+  std::atomic<uint32_t> total_frame_us_{0};
+  std::atomic<uint32_t> max_frame_us_{0};
+  std::atomic<uint32_t> bytes_pushed_{0};
+  std::atomic<uint32_t> coalesced_{0};
+};
+
+}  // namespace jog_controller
+
+#endif  // DISPLAY_H_
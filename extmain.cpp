@@ -3,37 +3,39 @@
 #include <Adafruit_ST7735.h>
 #include <EEPROM.h>
 #include <ESP32Encoder.h>
-#include <Fonts/FreeSans9pt7b.h>
 #include <HardwareSerial.h>
 #include <SPI.h>
 #include <WString.h>
 #include <WiFi.h>
+#include <esp_timer.h>
 #include <stdint.h>
 
 #include <algorithm>
+#include <atomic>
 
 #include "base64_stream.h"
+#include "cobs_stream.h"
 #include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "control_state.h"
 #include "credentials.h"
+#include "display.h"
+#include "frame_stream.h"
+#include "i2c_bus.h"
 #include "keypad.h"
-#include "pb_stream.h"
+#include "motion_estimator.h"
+#include "spsc_queue.h"
 #include "stream.h"
 #include "switches.h"
 
 namespace jog_controller {
 
-template <typename T>
-T clamp(T value, T low, T high) {
-  return std::min(high, std::max(low, value));
-}
-
 class ArduinoStreamAdapter : public util::Stream<uint8_t> {
  public:
   ArduinoStreamAdapter(::Stream* stream) : stream_(stream) {}
 
-  bool Write(const uint8_t& token) final {
-    stream_->write(token);
-    return true;
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    return stream_->write(buffer, count);
   }
 
  private:
@@ -44,16 +46,235 @@ ESP32Encoder encoder;
 WiFiClient client;
 ArduinoStreamAdapter client_stream(&client);
 util::Base64EncodeStream b64_encode_stream;
+util::CobsEncodeStream cobs_encode_stream;
+
+// Control frames are sent to the client in one write each, either as
+// "^<base64 Control>$\r\n" or as a COBS-encoded Control terminated by a zero
+// byte.
+enum class FrameMode { kBase64 = 0, kCobs };
+
+constexpr int kBase64FrameSize =
+    1 + util::Base64EncodedSize(Control_size) + 3;
+util::FrameStream<kBase64FrameSize> base64_frame_stream{"^", "$\r\n"};
+
+constexpr int kCobsFrameSize = util::CobsEncodedSize(Control_size);
+util::FrameStream<kCobsFrameSize> cobs_frame_stream{"", ""};
+
+// Wire encoding of the handwheel position. kAbsolute sends the 32-bit count
+// in `value`; kDelta sends the change since the previous frame in
+// `value_delta`, with the full 64-bit count in `position` on the first frame
+// of a connection and every `kKeyframeInterval` frames after that.
+enum class ValueMode { kAbsolute = 0, kDelta };
+
+constexpr int kKeyframeInterval = 32;
+
+// Field selection for each frame. kSnapshot sends every field set during the
+// current loop iteration whenever anything changed; kChanged sends only the
+// stateful fields that differ from the last frame sent, plus events, and a
+// full snapshot of the stateful fields every `kSnapshotIntervalMs`.
+enum class FieldMode { kSnapshot = 0, kChanged };
+
+constexpr unsigned long kSnapshotIntervalMs = 1000;
+
+// Reporting of discrete inputs. kBitmask ORs the keys pressed and released
+// during the loop iteration into `key_pressed`/`key_released`; kEvents instead
+// sends every key, button and rotary switch change as a timestamped entry in
+// `events`, in the order they were seen. Up to `kEventQueueCapacity` events
+// are buffered and drained at most `kMaxEventsPerFrame` per frame, so a burst
+// is spread over consecutive frames rather than dropped.
+enum class KeyMode { kBitmask = 0, kEvents };
+
+constexpr int kEventQueueCapacity = 64;
+constexpr int kMaxEventsPerFrame =
+    sizeof(Control::events) / sizeof(Control::events[0]);
+
+// Motion reporting. kEstimated adds the handwheel velocity and acceleration,
+// estimated from the timer-driven encoder samples, as stateful fields.
+enum class MotionMode { kOff = 0, kEstimated };
+
+// Selector bytes the host may send right after connecting, terminated by a
+// newline or the end of the negotiation window.
+constexpr uint8_t kCobsModeSelector = 'C';
+constexpr uint8_t kDeltaModeSelector = 'D';
+constexpr uint8_t kChangedFieldsModeSelector = 'F';
+constexpr uint8_t kEventsModeSelector = 'E';
+constexpr uint8_t kMotionModeSelector = 'V';
+constexpr unsigned long kNegotiationTimeoutMs = 250;
+
+struct WireOptions {
+  FrameMode frame_mode = FrameMode::kBase64;
+  ValueMode value_mode = ValueMode::kAbsolute;
+  FieldMode field_mode = FieldMode::kSnapshot;
+  KeyMode key_mode = KeyMode::kBitmask;
+  MotionMode motion_mode = MotionMode::kOff;
+};
+
+// Input acquisition and frame field selection run in the Arduino loop task,
+// which is pinned to core 1; the TCP connection runs in a separate task on
+// `kNetworkCore`, next to the WiFi stack, and the display renders in a
+// lower-priority task on the same core. A slow socket write or redraw then
+// never delays input sampling, and a redraw never delays a send.
+constexpr BaseType_t kNetworkCore = 0;
+constexpr uint32_t kNetworkTaskStackSize = 8192;
+constexpr UBaseType_t kNetworkTaskPriority = 2;
+constexpr UBaseType_t kDisplayTaskPriority = 1;
+
+// A frame handed from the input task to the network task. `wire` holds the
+// fields to encode and send, `display` the fields set during the input
+// iteration that produced it.
+struct ControlFrame {
+  uint32_t session;
+  uint32_t input_us;
+  Control wire;
+  Control display;
+};
+
+// Frames in flight between the cores. When it is full the input task drops
+// the frame and forces a full one next time; see QueueFrame.
+util::SpscQueue<ControlFrame, 16> frame_queue;
+
+// Connection handshake between the tasks. The network task writes
+// `negotiated_options` and then publishes a new nonzero `session`; it stores 0
+// while disconnected. Frames from an older session are discarded.
+WireOptions negotiated_options;
+std::atomic<uint32_t> session{0};
+
+// Options for the current session, owned by the network task.
+WireOptions network_options;
+// Copy of the options used by the input task, and the session it belongs to.
+WireOptions input_options;
+uint32_t input_session = 0;
+
+// The encoder count is sampled by a periodic esp_timer at
+// `kEncoderSampleRateHz`, independently of how long a loop iteration takes,
+// and the samples are drained by the input task into `motion_estimator`.
+constexpr uint32_t kEncoderSampleRateHz = 1000;
+
+struct EncoderSample {
+  uint32_t time_us;
+  int64_t count;
+};
 
+// A gap between consecutive drained samples longer than this means samples
+// were dropped, because the queue filled while the loop stalled or before it
+// started. Half a period of slack absorbs timer jitter.
+constexpr uint32_t kMaxSampleGapUs = 1500000 / kEncoderSampleRateHz;
+
+esp_timer_handle_t encoder_timer = nullptr;
+util::SpscQueue<EncoderSample, 64> encoder_samples;
+util::MotionEstimator motion_estimator{kEncoderSampleRateHz};
+// Time of the last sample fed to `motion_estimator`; valid once
+// `has_last_sample` is set.
+uint32_t last_sample_us = 0;
+bool has_last_sample = false;
+
+// Latest encoder count drained for the current loop iteration.
+int64_t encoder_count = 0;
+// Encoder count carried by the last frame sent, for delta encoding.
+int64_t last_sent_count = 0;
+// Frames sent since the last keyframe; starts saturated so that the first
+// frame of a connection is a keyframe.
+int frames_since_keyframe = kKeyframeInterval;
+
+// Fields set during the current loop iteration.
 Control control = Control_init_default;
-pb_ostream_t pb_stream;
+// Merged state of the controller, and the state as of the last frame sent.
+Control current_state = Control_init_default;
+Control sent_state = Control_init_default;
+// Time of the last full snapshot in kChanged mode; the first frame of a
+// connection is always a snapshot.
+unsigned long last_snapshot_ms = 0;
+bool snapshot_pending = true;
+
+// The loop sleeps until an input interrupt wakes it, and otherwise wakes up
+// every `kEncoderPollMs` to drain the encoder samples.
+// A frame is sent at least every `kKeepaliveIntervalMs` even when idle.
+constexpr uint32_t kEncoderPollMs = 1;
+constexpr unsigned long kKeepaliveIntervalMs = 500;
+
+// Task running ExtLoop, notified from the keypad and switch interrupts.
+TaskHandle_t loop_task = nullptr;
+// Task running NetworkLoop, notified whenever a frame is queued.
+TaskHandle_t network_task = nullptr;
+// Time in microseconds of the earliest input not yet sent, or 0 if none. Set
+// from interrupt context, so it is only claimed by an atomic exchange.
+std::atomic<uint32_t> pending_input_us{0};
+
+// Records `time_us` as the pending input time unless an earlier input is
+// already pending.
+void SetPendingInput(uint32_t time_us) {
+  uint32_t none = 0;
+  pending_input_us.compare_exchange_strong(none, time_us,
+                                           std::memory_order_relaxed);
+}
 
-Adafruit_ST7735 tft = Adafruit_ST7735(25, 27, 26);
+// Input-to-wire latency, from the interrupt (or encoder change) to the frame
+// carrying it being handed to the socket. Reported on Serial periodically.
+constexpr unsigned long kLatencyReportIntervalMs = 10000;
+
+struct LatencyStats {
+  uint32_t count = 0;
+  uint64_t total_us = 0;
+  uint32_t max_us = 0;
+
+  void Record(uint32_t latency_us) {
+    ++count;
+    total_us += latency_us;
+    max_us = std::max(max_us, latency_us);
+  }
+};
+
+LatencyStats latency_stats;
+unsigned long last_latency_report_ms = 0;
+
+// Key bitmasks, events and input time of frames dropped on queue overflow,
+// carried into the next frame, and whether that frame must be sent regardless
+// of changes. `carried_input_us` also holds the input time of an expander
+// interrupt whose I2C read has not been dispatched yet.
+int32_t carried_key_pressed = 0;
+int32_t carried_key_released = 0;
+uint32_t carried_input_us = 0;
+InputEvent carried_events[kMaxEventsPerFrame];
+int carried_events_count = 0;
+bool resend_pending = false;
+unsigned long last_frame_ms = 0;
+
+// Discrete input events in the order they were seen, filled by the input
+// handlers and drained into frames in kEvents mode. Both ends run in the input
+// task.
+util::SpscQueue<InputEvent, kEventQueueCapacity> event_queue;
 
-Keypad keypad{&Wire, 0x24, 19};
-Switches switches{&Wire, 0x20, 18, 5};
+Adafruit_ST7735 tft = Adafruit_ST7735(25, 27, 26);
+Display display{&tft};
+// Merged state shown on the display, owned by the network task.
+Control display_state = Control_init_default;
+
+// The expanders share one bus, driven by its own task so that the input loop
+// never waits on I2C.
+constexpr uint32_t kI2cFrequency = 400000;
+constexpr BaseType_t kI2cCore = 1;
+constexpr UBaseType_t kI2cTaskPriority = 2;
+I2cBus i2c_bus{&Wire, 21, 22};
+
+Keypad keypad{&i2c_bus, 0x24, 19};
+Switches switches{&i2c_bus, 0x20, 18, 5};
+
+// Records an input event that happened at `time_us`. A full queue drops the
+// event and counts an overflow.
+void QueueEvent(uint32_t time_us, InputEvent_Source source, int index,
+                bool pressed) {
+  InputEvent event = InputEvent_init_default;
+  event.time_us = time_us;
+  event.source = source;
+  event.index = index;
+  event.pressed = pressed;
+  event_queue.Push(event);
+}
 
 void KeyHandler(int key, KeyState state) {
+  QueueEvent(micros(), InputEvent_Source_SOURCE_KEYPAD, key,
+             state == KeyState::kPressed);
+
   if (state == KeyState::kPressed) {
     control.has_key_pressed = true;
     control.key_pressed |= (1 << key);
@@ -65,14 +286,20 @@ void KeyHandler(int key, KeyState state) {
   }
 }
 
+// The switch handlers stamp events with the time of the expander interrupt
+// that captured the transition.
 void RotarySwitchHandler(RotarySwitch index, int position) {
+  uint32_t time_us = switches.event_time_us();
   switch (index) {
     case RotarySwitch::kAxis:
+      QueueEvent(time_us, InputEvent_Source_SOURCE_AXIS, position, false);
       control.has_axis = true;
       control.axis = static_cast<Control_Axis>(position);
       break;
 
     case RotarySwitch::kMultiplier:
+      QueueEvent(time_us, InputEvent_Source_SOURCE_MULTIPLIER, position,
+                 false);
       control.has_multiplier = true;
       control.multiplier = static_cast<Control_Multiplier>(position);
       break;
@@ -80,23 +307,65 @@ void RotarySwitchHandler(RotarySwitch index, int position) {
 }
 
 void ButtonHandler(int button, KeyState state) {
+  uint32_t time_us = switches.event_time_us();
   switch (button) {
     case Switches::kEstopIndex:
+      QueueEvent(time_us, InputEvent_Source_SOURCE_ESTOP, 0,
+                 state == KeyState::kPressed);
       control.has_estop = true;
       control.estop = (state == KeyState::kPressed);
       break;
 
     case Switches::kFeedholdIndex:
+      QueueEvent(time_us, InputEvent_Source_SOURCE_FEEDHOLD, 0,
+                 state == KeyState::kPressed);
       control.has_feedhold = true;
       control.feedhold = (state == KeyState::kPressed);
       break;
   }
 }
 
+void InputInterruptHandler() {
+  SetPendingInput(micros());
+  if (loop_task == nullptr) {
+    return;
+  }
+
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loop_task, &higher_priority_task_woken);
+  if (higher_priority_task_woken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+// Wakes the input loop to dispatch a completed keypad scan or switch read.
+void I2cCompletionHandler() {
+  if (loop_task != nullptr) {
+    xTaskNotifyGive(loop_task);
+  }
+}
+
+void NetworkTask(void* /*unused*/);
+
+// Runs in the esp_timer task at `kEncoderSampleRateHz`.
+void SampleEncoder(void* /*unused*/) {
+  EncoderSample sample;
+  sample.time_us = micros();
+  sample.count = encoder.getCount();
+  encoder_samples.Push(sample);
+}
+
 void ExtMain() {
   ESP32Encoder::useInternalWeakPullResistors = NONE;
   Serial.begin(115200);
   encoder.attachFullQuad(35, 34);
+
+  esp_timer_create_args_t encoder_timer_args = {};
+  encoder_timer_args.callback = &SampleEncoder;
+  encoder_timer_args.name = "encoder";
+  esp_timer_create(&encoder_timer_args, &encoder_timer);
+  esp_timer_start_periodic(encoder_timer, 1000000 / kEncoderSampleRateHz);
+
   SPI.setFrequency(20000000);
   SPI.begin(14, 12, 13, 15);
   tft.initR(INITR_GREENTAB);
@@ -107,12 +376,16 @@ void ExtMain() {
   tft.setRotation(3);
   tft.fillRect(0, 0, 160, 128, ST77XX_BLACK);
 
-  Wire.begin();
+  i2c_bus.Begin(kI2cFrequency);
+  i2c_bus.RegisterCompletionHandler(&I2cCompletionHandler);
   keypad.RegisterKeyHandler(&KeyHandler);
+  keypad.RegisterInterruptHandler(&InputInterruptHandler);
   keypad.Begin();
   switches.RegisterRotarySwitchHandler(&RotarySwitchHandler);
   switches.RegisterKeyHandler(&ButtonHandler);
+  switches.RegisterInterruptHandler(&InputInterruptHandler);
   switches.Begin();
+  i2c_bus.Start(kI2cCore, kI2cTaskPriority);
 
   // We start by connecting to a WiFi network
 
@@ -133,79 +406,239 @@ void ExtMain() {
   Serial.println("IP address: ");
   Serial.println(WiFi.localIP());
 
-  b64_encode_stream.RegisterDownstream(&client_stream);
-  pb_stream = util::WrapStream(&b64_encode_stream);
+  base64_frame_stream.RegisterDownstream(&client_stream);
+  b64_encode_stream.RegisterDownstream(&base64_frame_stream);
+  cobs_frame_stream.RegisterDownstream(&client_stream);
+  cobs_encode_stream.RegisterDownstream(&cobs_frame_stream);
+
+  display.Begin(kNetworkCore, kDisplayTaskPriority);
+  xTaskCreatePinnedToCore(&NetworkTask, "network", kNetworkTaskStackSize,
+                          nullptr, kNetworkTaskPriority, &network_task,
+                          kNetworkCore);
+}
+
+// Replaces the absolute `value` in `wire_control` with a zigzag delta against
+// the last frame sent, or with a 64-bit keyframe when one is due or the delta
+// does not fit in 32 bits. TCP delivers frames in order, so a frame once sent
+// is treated as acknowledged.
+void SetValueDelta(Control* wire_control) {
+  wire_control->has_value = false;
+
+  int64_t delta = encoder_count - last_sent_count;
+  bool delta_fits = delta >= INT32_MIN && delta <= INT32_MAX;
+  if (frames_since_keyframe >= kKeyframeInterval || !delta_fits) {
+    wire_control->has_position = true;
+    wire_control->position = encoder_count;
+    frames_since_keyframe = 0;
+  } else {
+    if (delta != 0) {
+      wire_control->has_value_delta = true;
+      wire_control->value_delta = static_cast<int32_t>(delta);
+    }
+    ++frames_since_keyframe;
+  }
+  last_sent_count = encoder_count;
 }
 
-const char* kAxisNames[] = {"<NAV>", "X", "Y", "Z", "4", "5", "6"};
-const int kMultiplierValues[] = {1, 10, 100};
+bool EventsPending() {
+  return input_options.key_mode == KeyMode::kEvents &&
+         (carried_events_count > 0 || event_queue.Size() > 0);
+}
 
-void UpdateDisplay(const Control& new_control) {
-  static Control current_control = Control_init_default;
-  if (memcmp(&new_control, &current_control, sizeof(Control)) == 0) {
+// In kEvents mode, replaces the key bitmasks in `wire_control` with the oldest
+// pending events: first those carried over from a dropped frame, then those
+// from the event queue. Events that do not fit stay queued for the next frame.
+void TakeEvents(Control* wire_control) {
+  if (input_options.key_mode != KeyMode::kEvents) {
     return;
   }
+  wire_control->has_key_pressed = false;
+  wire_control->key_pressed = 0;
+  wire_control->has_key_released = false;
+  wire_control->key_released = 0;
+
+  memcpy(wire_control->events, carried_events,
+         carried_events_count * sizeof(carried_events[0]));
+  wire_control->events_count = carried_events_count;
+  carried_events_count = 0;
+  while (wire_control->events_count < kMaxEventsPerFrame &&
+         event_queue.Pop(&wire_control->events[wire_control->events_count])) {
+    ++wire_control->events_count;
+  }
+}
 
-  current_control = new_control;
-
-  tft.setFont(&FreeSans9pt7b);
-  tft.setTextColor(ST77XX_WHITE);
+// Selects the fields to send for this loop iteration into `wire_control`
+// according to the session's field and key modes. Returns false if there is
+// nothing to send, unless `keepalive` is set, in which case the current state
+// is always sent. After a dropped frame, kSnapshot sends the merged state so
+// that stateful changes carried only by the dropped frame reach the host.
+bool SelectFields(Control* wire_control, bool keepalive) {
+  static Control last_control = Control_init_default;
 
-  if (current_control.has_axis) {
-    tft.fillRect(0, 0, 160, 24, ST77XX_BLACK);
-    tft.setCursor(8, 16);
-    tft.print("Jog ");
-    tft.print(kAxisNames[clamp(static_cast<int>(current_control.axis), 0, 6)]);
-    tft.print(": ");
-    tft.print(current_control.value);
-  }
-
-  if (current_control.has_multiplier) {
-    tft.fillRect(0, 24, 160, 48, ST77XX_BLACK);
-    tft.setCursor(8, 40);
-    tft.print("X");
-    tft.print(kMultiplierValues[clamp(
-        static_cast<int>(current_control.multiplier), 0, 2)]);
-  }
-
-  if (current_control.has_estop) {
-    if (current_control.estop) {
-      tft.setCursor(8, 64);
-      tft.setTextColor(ST77XX_RED);
-      tft.print("!ESTOP!");
-    } else {
-      tft.fillRect(0, 48, 160, 72, ST77XX_BLACK);
+  switch (input_options.field_mode) {
+    case FieldMode::kSnapshot:
+      if (!keepalive && !EventsPending() &&
+          memcmp(&control, &last_control, sizeof(Control)) == 0) {
+        return false;
+      }
+      last_control = control;
+      *wire_control = resend_pending ? current_state : control;
+      TakeEvents(wire_control);
+      return true;
+
+    case FieldMode::kChanged: {
+      unsigned long now = millis();
+      bool snapshot = keepalive || snapshot_pending ||
+                      (now - last_snapshot_ms) >= kSnapshotIntervalMs;
+
+      *wire_control = Control_init_default;
+      DiffControl(sent_state, current_state, snapshot, wire_control);
+      wire_control->has_key_pressed = control.has_key_pressed;
+      wire_control->key_pressed = control.key_pressed;
+      wire_control->has_key_released = control.has_key_released;
+      wire_control->key_released = control.key_released;
+      TakeEvents(wire_control);
+      if (ControlIsEmpty(*wire_control)) {
+        return false;
+      }
+
+      if (snapshot) {
+        last_snapshot_ms = now;
+        snapshot_pending = false;
+      }
+      sent_state = current_state;
+      return true;
     }
   }
+  return false;
+}
 
-  if (current_control.has_feedhold) {
-    if (current_control.feedhold) {
-      tft.setCursor(8, 88);
-      tft.setTextColor(ST77XX_BLUE);
-      tft.print("Feedhold");
-    } else {
-      tft.fillRect(0, 72, 160, 96, ST77XX_BLACK);
-    }
+// Sends `wire_control` to the client as a single frame.
+void WriteControl(const Control& wire_control) {
+  // Encode into a local buffer first so that the message moves through the
+  // framing stage in a single call. The direct encoder produces the same bytes
+  // as pb_encode without walking the field descriptors.
+  uint8_t message[Control_size];
+  size_t message_size;
+  if (!Control_encode_direct(&wire_control, message, &message_size)) {
+    return;
   }
-}
 
-void WriteControl() {
-  static Control last_control = Control_init_default;
+  switch (network_options.frame_mode) {
+    case FrameMode::kBase64:
+      base64_frame_stream.Begin();
+      b64_encode_stream.WriteBuffer(message, message_size);
+      b64_encode_stream.Flush();
+      base64_frame_stream.End();
+      break;
+
+    case FrameMode::kCobs:
+      cobs_frame_stream.Begin();
+      cobs_encode_stream.WriteBuffer(message, message_size);
+      cobs_encode_stream.Flush();
+      cobs_frame_stream.End();
+      break;
+  }
+}
 
-  if (memcmp(&control, &last_control, sizeof(Control)) == 0) {
+void ReportLatency(unsigned long now) {
+  if ((now - last_latency_report_ms) < kLatencyReportIntervalMs) {
     return;
   }
+  last_latency_report_ms = now;
+
+  if (latency_stats.count > 0) {
+    Serial.printf("input latency: %u frames, avg %u us, max %u us\n",
+                  static_cast<unsigned>(latency_stats.count),
+                  static_cast<unsigned>(latency_stats.total_us /
+                                        latency_stats.count),
+                  static_cast<unsigned>(latency_stats.max_us));
+  }
+  latency_stats = LatencyStats();
+
+  Display::Stats display_stats = display.TakeStats();
+  if (display_stats.frames > 0) {
+    Serial.printf(
+        "display: %u frames, avg %u us, max %u us, %u bytes, %u coalesced\n",
+        static_cast<unsigned>(display_stats.frames),
+        static_cast<unsigned>(display_stats.total_frame_us /
+                              display_stats.frames),
+        static_cast<unsigned>(display_stats.max_frame_us),
+        static_cast<unsigned>(display_stats.bytes_pushed),
+        static_cast<unsigned>(display_stats.coalesced));
+  }
 
-  client.write('^');
-  pb_encode(&pb_stream, Control_fields, &control);
-  b64_encode_stream.Flush();
-  client.write("$\r\n");
-  pb_stream.bytes_written = 0;
+  uint32_t i2c_errors = i2c_bus.errors();
+  if (i2c_errors > 0) {
+    Serial.printf("i2c: %u operations, %u errors, %u recoveries\n",
+                  static_cast<unsigned>(i2c_bus.operations()),
+                  static_cast<unsigned>(i2c_errors),
+                  static_cast<unsigned>(i2c_bus.recoveries()));
+  }
+
+  uint32_t coalesced_interrupts = switches.coalesced_interrupts();
+  if (coalesced_interrupts > 0) {
+    Serial.printf("switches: %u coalesced interrupts\n",
+                  static_cast<unsigned>(coalesced_interrupts));
+  }
 
-  last_control = control;
+  uint32_t frame_overflows = frame_queue.overflows();
+  uint32_t event_overflows = event_queue.overflows();
+  uint32_t sample_overflows = encoder_samples.overflows();
+  if (frame_overflows > 0 || event_overflows > 0 || sample_overflows > 0) {
+    Serial.printf("queue overflows: %u frames, %u events, %u samples\n",
+                  static_cast<unsigned>(frame_overflows),
+                  static_cast<unsigned>(event_overflows),
+                  static_cast<unsigned>(sample_overflows));
+  }
 }
 
-void ExtLoop() {
+// Gives the host a short window after connecting to select wire options by
+// sending selector bytes. Hosts that send nothing get base64 frames with
+// absolute values.
+void NegotiateWireOptions(WireOptions* options) {
+  *options = WireOptions();
+
+  unsigned long start = millis();
+  while ((millis() - start) < kNegotiationTimeoutMs) {
+    if (!client.available()) {
+      delay(1);
+      continue;
+    }
+
+    switch (client.read()) {
+      case kCobsModeSelector:
+        options->frame_mode = FrameMode::kCobs;
+        break;
+
+      case kDeltaModeSelector:
+        options->value_mode = ValueMode::kDelta;
+        break;
+
+      case kChangedFieldsModeSelector:
+        options->field_mode = FieldMode::kChanged;
+        break;
+
+      case kEventsModeSelector:
+        options->key_mode = KeyMode::kEvents;
+        break;
+
+      case kMotionModeSelector:
+        options->motion_mode = MotionMode::kEstimated;
+        break;
+
+      case '\n':
+        return;
+    }
+  }
+}
+
+// Connects to the host, negotiates wire options and publishes them as a new
+// session, then sends queued frames and redraws the display until the
+// connection drops. Runs on `kNetworkCore`.
+void NetworkLoop() {
+  static uint32_t last_session = 0;
+
   Serial.print("connecting to ");
   Serial.println(kHost);
 
@@ -215,32 +648,205 @@ void ExtLoop() {
     delay(2000);
     return;
   }
+  // Frames are already assembled into a single segment; don't let Nagle hold
+  // them back waiting for the previous ACK.
+  client.setNoDelay(true);
+  NegotiateWireOptions(&negotiated_options);
+  network_options = negotiated_options;
+
+  if (++last_session == 0) {
+    ++last_session;
+  }
+  session.store(last_session, std::memory_order_release);
+
+  while (client.connected()) {
+    // Sleep until the input task queues a frame; the timeout keeps the reply
+    // drain and latency report going while idle.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kKeepaliveIntervalMs));
+
+    ControlFrame frame;
+    bool display_changed = false;
+    while (frame_queue.Pop(&frame)) {
+      if (frame.session != last_session) {
+        continue;
+      }
+      WriteControl(frame.wire);
+      if (frame.input_us != 0) {
+        latency_stats.Record(micros() - frame.input_us);
+      }
+      MergeControl(frame.display, &display_state);
+      display_changed = true;
+    }
+    if (display_changed) {
+      display.Update(display_state);
+    }
+    ReportLatency(millis());
+
+    // Read all the lines of the reply from server and print them to Serial
+    while (client.available()) {
+      client.read();
+    }
+  }
 
+  session.store(0, std::memory_order_release);
+  client.stop();
+
+  Serial.println();
+  Serial.println("closing connection");
+}
+
+void NetworkTask(void* /*unused*/) {
   while (true) {
-    control = Control_init_default;
-    // This will send the request to the server
-    unsigned long timeout = millis();
+    NetworkLoop();
+  }
+}
+
+// Picks up the session published by the network task, resetting the
+// per-connection encoder state when it changes. Returns false while there is
+// no connection to send frames to.
+bool SyncSession() {
+  uint32_t current = session.load(std::memory_order_acquire);
+  if (current == input_session) {
+    return current != 0;
+  }
+  if (current != 0) {
+    input_options = negotiated_options;
+    // The connection may have dropped and been renegotiated while copying.
+    if (session.load(std::memory_order_acquire) != current) {
+      return false;
+    }
+  }
 
-    control.has_value = true;
-    control.value = static_cast<int32_t>(encoder.getCount());
+  input_session = current;
+  frames_since_keyframe = kKeyframeInterval;
+  sent_state = Control_init_default;
+  current_state.has_velocity = false;
+  current_state.has_acceleration = false;
+  snapshot_pending = true;
+  resend_pending = false;
+  carried_key_pressed = 0;
+  carried_key_released = 0;
+  carried_input_us = 0;
+  carried_events_count = 0;
+  return current != 0;
+}
 
-    switches.Poll();
-    keypad.Poll();
+// Hands a frame to the network task. If the queue is full the frame is dropped
+// instead of blocking input sampling. Its key bitmasks, events and input time
+// are then carried into the next frame, which is sent regardless of changes,
+// forces a value keyframe and carries the full merged state so that the host
+// resynchronizes. The display always gets the merged state, so a dropped frame
+// never loses a change there.
+void QueueFrame(const Control& wire_control, uint32_t input_us) {
+  ControlFrame frame;
+  frame.session = input_session;
+  frame.input_us = input_us;
+  frame.wire = wire_control;
+  frame.display = current_state;
+  if (frame_queue.Push(frame)) {
+    xTaskNotifyGive(network_task);
+    return;
+  }
 
-    WriteControl();
+  carried_key_pressed = control.key_pressed;
+  carried_key_released = control.key_released;
+  carried_input_us = input_us;
+  memcpy(carried_events, wire_control.events,
+         wire_control.events_count * sizeof(carried_events[0]));
+  carried_events_count = wire_control.events_count;
+  resend_pending = true;
+  frames_since_keyframe = kKeyframeInterval;
+}
 
-    UpdateDisplay(control);
+// One input iteration: drains the encoder samples, polls the I2C expanders and
+// queues a frame if anything changed. Runs in the Arduino loop task.
+void ExtLoop() {
+  if (loop_task == nullptr) {
+    loop_task = xTaskGetCurrentTaskHandle();
+  }
 
-    // Read all the lines of the reply from server and print them to Serial
-    while (client.available()) {
-      client.read();
+  // Sleep until an expander interrupt or I2C completion, or the next encoder
+  // poll.
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kEncoderPollMs));
+
+  control = Control_init_default;
+  if (carried_key_pressed != 0) {
+    control.has_key_pressed = true;
+    control.key_pressed = carried_key_pressed;
+  }
+  if (carried_key_released != 0) {
+    control.has_key_released = true;
+    control.key_released = carried_key_released;
+  }
+  carried_key_pressed = 0;
+  carried_key_released = 0;
+
+  EncoderSample sample;
+  while (encoder_samples.Pop(&sample)) {
+    if (sample.count != encoder_count) {
+      SetPendingInput(sample.time_us);
     }
+    encoder_count = sample.count;
+    // The estimator assumes one sample period between updates, so after
+    // dropped samples it would read the jump in count as motion. Restart it
+    // from this sample instead.
+    if (has_last_sample && sample.time_us - last_sample_us > kMaxSampleGapUs) {
+      motion_estimator.Reset();
+    }
+    last_sample_us = sample.time_us;
+    has_last_sample = true;
+    motion_estimator.Update(sample.count);
+  }
+  control.has_value = true;
+  control.value = static_cast<int32_t>(encoder_count);
+
+  // Inputs arriving after this point are carried by the next frame. The input
+  // time of an expander interrupt is held over until the I2C read it triggered
+  // has been dispatched and a frame is queued.
+  uint32_t input_us =
+      pending_input_us.exchange(0, std::memory_order_relaxed);
+  if (carried_input_us != 0) {
+    input_us = carried_input_us;
+    carried_input_us = 0;
+  }
+
+  switches.Poll();
+  keypad.Poll();
 
-    delay(100);
+  bool connected = SyncSession();
+  if (connected && input_options.motion_mode == MotionMode::kEstimated) {
+    control.has_velocity = true;
+    control.velocity = motion_estimator.velocity();
+    control.has_acceleration = true;
+    control.acceleration = motion_estimator.acceleration();
   }
+  MergeControl(control, &current_state);
 
-  Serial.println();
-  Serial.println("closing connection");
+  if (!connected) {
+    event_queue.Clear();
+    return;
+  }
+  if (input_options.key_mode != KeyMode::kEvents) {
+    event_queue.Clear();
+  }
+
+  unsigned long now = millis();
+  bool keepalive =
+      resend_pending || (now - last_frame_ms) >= kKeepaliveIntervalMs;
+  Control wire_control;
+  if (!SelectFields(&wire_control, keepalive)) {
+    if (switches.InputPending() || keypad.InputPending()) {
+      carried_input_us = input_us;
+    }
+    return;
+  }
+  if (input_options.value_mode == ValueMode::kDelta) {
+    SetValueDelta(&wire_control);
+  }
+  resend_pending = false;
+  last_frame_ms = now;
+
+  QueueFrame(wire_control, input_us);
 }
 
 }  // namespace jog_controller
@@ -0,0 +1,73 @@
+#ifndef FRAME_STREAM_H_
+#define FRAME_STREAM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stream.h"
+
+namespace util {
+
+// Assembles a delimited frame into a fixed buffer of `kCapacity` bytes and
+// forwards it downstream in a single write. A frame is started with `Begin`,
+// which stages the prefix, and completed with `End`, which appends the suffix
+// and sends the whole frame. `kCapacity` must cover the prefix, suffix and the
+// largest payload.
+template <int kCapacity>
+class FrameStream : public Stream<uint8_t> {
+ public:
+  FrameStream(const char* prefix, const char* suffix)
+      : prefix_(prefix), suffix_(suffix) {}
+
+  // Discards any partially assembled frame and stages the prefix.
+  bool Begin() {
+    size_ = 0;
+    return Append(prefix_);
+  }
+
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    int available = kCapacity - size_;
+    if (count > available) {
+      count = available;
+    }
+    memcpy(buffer_ + size_, buffer, count);
+    size_ += count;
+    return count;
+  }
+
+  // Appends the suffix and sends the assembled frame downstream with exactly
+  // one write. Returns false if the frame overflowed or the write was short.
+  bool End() {
+    bool ok = Append(suffix_);
+    ++frames_;
+    if (ok) {
+      ++sends_;
+      ok = (stream()->WriteBuffer(buffer_, size_) == size_);
+    }
+    size_ = 0;
+    return ok;
+  }
+
+  // Number of frames completed with `End`.
+  uint32_t frames() const { return frames_; }
+
+  // Number of downstream writes issued. Never exceeds `frames()`.
+  uint32_t sends() const { return sends_; }
+
+ private:
+  bool Append(const char* str) {
+    int length = strlen(str);
+    return WriteBuffer(reinterpret_cast<const uint8_t*>(str), length) == length;
+  }
+
+  const char* prefix_;
+  const char* suffix_;
+  uint8_t buffer_[kCapacity];
+  int size_ = 0;
+  uint32_t frames_ = 0;
+  uint32_t sends_ = 0;
+};
+
+}  // namespace util
+
+#endif  // FRAME_STREAM_H_
@@ -0,0 +1,84 @@
+#include "glyph_atlas.h"
+
+#include <string.h>
+
+namespace jog_controller {
+
+void GlyphAtlas::Begin() {
+  int count = strlen(charset_);
+  if (count > kMaxGlyphs) {
+    count = kMaxGlyphs;
+  }
+
+  // Lay the cells out side by side in a single mask.
+  int16_t width = 0;
+  for (int i = 0; i < count; ++i) {
+    uint8_t c = charset_[i];
+    offsets_[i] = width;
+    advances_[i] = 0;
+    if (c >= font_->first && c <= font_->last) {
+      advances_[i] = font_->glyph[c - font_->first].xAdvance;
+    }
+    width += advances_[i];
+  }
+
+  masks_ = new GFXcanvas1(width, height_);
+  masks_->setFont(font_);
+  masks_->setTextWrap(false);
+  masks_->setTextColor(1);
+  for (int i = 0; i < count; ++i) {
+    masks_->setCursor(offsets_[i], baseline_);
+    masks_->print(charset_[i]);
+  }
+}
+
+int GlyphAtlas::Find(char c) const {
+  const char* found = strchr(charset_, c);
+  if (c == '\0' || found == nullptr || found - charset_ >= kMaxGlyphs) {
+    return -1;
+  }
+  return found - charset_;
+}
+
+int16_t GlyphAtlas::Advance(char c) const {
+  int index = Find(c);
+  return index < 0 ? 0 : advances_[index];
+}
+
+int16_t GlyphAtlas::Blit(char c, GFXcanvas16* canvas, int16_t x, int16_t y,
+                         uint16_t color, uint16_t background) const {
+  int index = Find(c);
+  if (index < 0 || masks_ == nullptr) {
+    return 0;
+  }
+
+  int16_t advance = advances_[index];
+  int16_t columns = advance;
+  if (x + columns > canvas->width()) {
+    columns = canvas->width() - x;
+  }
+  int16_t rows = height_;
+  if (y + rows > canvas->height()) {
+    rows = canvas->height() - y;
+  }
+  if (x < 0 || y < 0 || columns <= 0 || rows <= 0) {
+    return advance;
+  }
+
+  // GFXcanvas1 stores rows MSB-first, padded to whole bytes.
+  const uint8_t* mask = masks_->getBuffer();
+  int mask_stride = (masks_->width() + 7) / 8;
+  uint16_t* pixels = canvas->getBuffer();
+  for (int16_t row = 0; row < rows; ++row) {
+    const uint8_t* mask_row = mask + row * mask_stride;
+    uint16_t* out = pixels + (y + row) * canvas->width() + x;
+    for (int16_t column = 0; column < columns; ++column) {
+      int bit = offsets_[index] + column;
+      out[column] = (mask_row[bit / 8] & (0x80 >> (bit % 8))) ? color
+                                                               : background;
+    }
+  }
+  return advance;
+}
+
+}  // namespace jog_controller
@@ -0,0 +1,52 @@
+#ifndef GLYPH_ATLAS_H_
+#define GLYPH_ATLAS_H_
+
+#include <Adafruit_GFX.h>
+#include <stdint.h>
+
+namespace jog_controller {
+
+// Glyphs of one GFX font for a fixed character set, rasterized once into a
+// 1-bit mask so that text can be drawn without going through Adafruit GFX's
+// per-pixel glyph renderer. Each glyph occupies a cell as wide as its advance
+// and `height` rows tall, with the baseline `baseline` rows from the top; a
+// blit writes the whole cell, background included, so redrawing a character
+// never needs a separate clear.
+class GlyphAtlas {
+ public:
+  GlyphAtlas(const GFXfont* font, const char* charset, int16_t height,
+             int16_t baseline)
+      : font_(font), charset_(charset), height_(height), baseline_(baseline) {}
+
+  // Rasterizes the character set. Call once at boot, before any blit.
+  void Begin();
+
+  // Advance width of `c` in pixels, or 0 if `c` is not in the character set.
+  int16_t Advance(char c) const;
+
+  // Draws the cell of `c` with its top-left corner at (`x`, `y`) into
+  // `canvas`, clipped to the canvas. Returns the advance of `c`; characters
+  // outside the set draw nothing.
+  int16_t Blit(char c, GFXcanvas16* canvas, int16_t x, int16_t y,
+               uint16_t color, uint16_t background) const;
+
+  int16_t height() const { return height_; }
+
+ private:
+  static constexpr int kMaxGlyphs = 64;
+
+  // Index of `c` in the character set, or -1.
+  int Find(char c) const;
+
+  const GFXfont* font_;
+  const char* charset_;
+  int16_t height_;
+  int16_t baseline_;
+  GFXcanvas1* masks_ = nullptr;
+  int16_t offsets_[kMaxGlyphs] = {};
+  int16_t advances_[kMaxGlyphs] = {};
+};
+
+}  // namespace jog_controller
+
+#endif  // GLYPH_ATLAS_H_
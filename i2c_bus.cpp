@@ -0,0 +1,171 @@
+#include "i2c_bus.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace jog_controller {
+namespace {
+
+// Half an SCL period during recovery; 100 kHz is safe for every device.
+constexpr uint32_t kRecoveryHalfPeriodUs = 5;
+// A slave stuck mid-byte releases SDA within nine clocks.
+constexpr int kRecoveryClocks = 9;
+
+}  // namespace
+
+bool I2cBus::Transaction::Add(const uint8_t* write, int write_length,
+                              int read_length) {
+  if (operation_count >= kMaxOperations || write_length < 0 ||
+      write_length > kMaxWriteSize || read_length < 0 ||
+      read_length > kMaxReadSize) {
+    return false;
+  }
+
+  Operation& operation = operations[operation_count++];
+  if (write_length > 0) {
+    memcpy(operation.write, write, write_length);
+  }
+  operation.write_length = write_length;
+  operation.read_length = read_length;
+  return true;
+}
+
+void I2cBus::Begin(uint32_t frequency) {
+  frequency_ = frequency;
+  wire_->begin(sda_pin_, scl_pin_, frequency_);
+  current_frequency_ = frequency_;
+  for (int i = 0; i < kNumPriorities; ++i) {
+    queues_[i] = xQueueCreate(kQueueLength, sizeof(Transaction));
+  }
+}
+
+void I2cBus::Start(BaseType_t core, UBaseType_t priority) {
+  xTaskCreatePinnedToCore(&I2cBus::StaticTask, "i2c", kTaskStackSize, this,
+                          priority, &task_, core);
+}
+
+bool I2cBus::Submit(const Transaction& transaction) {
+  if (transaction.operation_count == 0) {
+    return false;
+  }
+  int priority = static_cast<int>(transaction.device->priority);
+  if (xQueueSend(queues_[priority], &transaction, 0) != pdTRUE) {
+    return false;
+  }
+  if (task_ != nullptr) {
+    xTaskNotifyGive(task_);
+  }
+  return true;
+}
+
+void I2cBus::StaticTask(void* bus) { static_cast<I2cBus*>(bus)->Task(); }
+
+void I2cBus::Task() {
+  while (true) {
+    int priority = NextPriority();
+    if (priority < 0) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    Transaction& transaction = current_[priority];
+    Operation& operation = transaction.operations[next_operation_[priority]++];
+    bool ok = Execute(*transaction.device, &operation);
+    operations_.fetch_add(1, std::memory_order_relaxed);
+    if (!ok) {
+      errors_.fetch_add(1, std::memory_order_relaxed);
+      if (digitalRead(sda_pin_) == LOW) {
+        Recover();
+      }
+    }
+
+    if (!ok || next_operation_[priority] == transaction.operation_count) {
+      active_[priority] = false;
+      transaction.ok = ok;
+      if (transaction.callback != nullptr) {
+        transaction.callback(transaction.context, transaction);
+      }
+      if (completion_handler_ != nullptr) {
+        completion_handler_();
+      }
+    }
+  }
+}
+
+int I2cBus::NextPriority() {
+  for (int i = 0; i < kNumPriorities; ++i) {
+    if (active_[i]) {
+      return i;
+    }
+    if (xQueueReceive(queues_[i], &current_[i], 0) == pdTRUE) {
+      active_[i] = true;
+      next_operation_[i] = 0;
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool I2cBus::Execute(const Device& device, Operation* operation) {
+  SetFrequency(std::min(frequency_, device.max_frequency));
+
+  if (operation->write_length > 0) {
+    wire_->beginTransmission(device.address);
+    wire_->write(operation->write, operation->write_length);
+    bool stop = (operation->read_length == 0);
+    if (wire_->endTransmission(stop) != 0) {
+      return false;
+    }
+  }
+
+  if (operation->read_length > 0) {
+    int received = wire_->requestFrom(static_cast<int>(device.address),
+                                      static_cast<int>(operation->read_length));
+    if (received != operation->read_length) {
+      return false;
+    }
+    for (int i = 0; i < operation->read_length; ++i) {
+      operation->read[i] = wire_->read();
+    }
+  }
+  return true;
+}
+
+void I2cBus::SetFrequency(uint32_t frequency) {
+  if (frequency == current_frequency_) {
+    return;
+  }
+  wire_->setClock(frequency);
+  current_frequency_ = frequency;
+}
+
+void I2cBus::Recover() {
+  recoveries_.fetch_add(1, std::memory_order_relaxed);
+  wire_->end();
+
+  pinMode(sda_pin_, INPUT_PULLUP);
+  pinMode(scl_pin_, OUTPUT_OPEN_DRAIN);
+  digitalWrite(scl_pin_, HIGH);
+  for (int i = 0; i < kRecoveryClocks && digitalRead(sda_pin_) == LOW; ++i) {
+    digitalWrite(scl_pin_, LOW);
+    delayMicroseconds(kRecoveryHalfPeriodUs);
+    digitalWrite(scl_pin_, HIGH);
+    delayMicroseconds(kRecoveryHalfPeriodUs);
+  }
+
+  // STOP: SDA rises while SCL is high.
+  pinMode(sda_pin_, OUTPUT_OPEN_DRAIN);
+  digitalWrite(sda_pin_, LOW);
+  delayMicroseconds(kRecoveryHalfPeriodUs);
+  digitalWrite(scl_pin_, HIGH);
+  delayMicroseconds(kRecoveryHalfPeriodUs);
+  digitalWrite(sda_pin_, HIGH);
+  delayMicroseconds(kRecoveryHalfPeriodUs);
+
+  wire_->begin(sda_pin_, scl_pin_, frequency_);
+  current_frequency_ = frequency_;
+}
+
+}  // namespace jog_controller
@@ -0,0 +1,145 @@
+#ifndef I2C_BUS_H_
+#define I2C_BUS_H_
+
+#include <Wire.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
+#include <atomic>
+
+namespace jog_controller {
+
+// Runs I2C transactions for several drivers from a dedicated task, so that no
+// driver blocks its caller on the bus. Drivers describe a transaction as a
+// short list of operations on one device and submit it without waiting; the
+// bus task runs it and reports the outcome through a completion callback.
+//
+// Each device has a priority. Between any two operations the task moves to
+// the highest-priority transaction pending, so a short high-priority read
+// (E-stop) waits for at most one operation of a longer low-priority scan.
+// Transactions of the same priority run whole and in submission order.
+//
+// The bus clock is set per device to the lower of the bus frequency and the
+// device's maximum, so fast-mode devices can share the bus with 100 kHz ones.
+// After a failed operation the task checks for a slave holding SDA low and, if
+// so, clocks it free and re-initializes the controller.
+class I2cBus {
+ public:
+  enum class Priority { kHigh = 0, kNormal, kLow };
+
+  static constexpr int kMaxOperations = 5;
+  static constexpr int kMaxWriteSize = 2;
+  static constexpr int kMaxReadSize = 3;
+
+  struct Device {
+    uint8_t address;
+    Priority priority;
+    // Highest SCL frequency the device supports, in Hz.
+    uint32_t max_frequency;
+  };
+
+  // Writes `write_length` bytes, then reads `read_length` bytes with a
+  // repeated start. Either part may be empty.
+  struct Operation {
+    uint8_t write[kMaxWriteSize];
+    uint8_t write_length;
+    uint8_t read[kMaxReadSize];
+    uint8_t read_length;
+  };
+
+  struct Transaction;
+
+  // Called from the bus task when a transaction completes or fails. Must not
+  // block.
+  using Callback = void (*)(void* context, const Transaction& transaction);
+
+  struct Transaction {
+    const Device* device = nullptr;
+    Operation operations[kMaxOperations] = {};
+    int operation_count = 0;
+    Callback callback = nullptr;
+    void* context = nullptr;
+    // Free for the submitter to identify the transaction in its callback.
+    int tag = 0;
+    // Set before the callback: true if every operation succeeded. On failure
+    // the remaining operations are skipped.
+    bool ok = false;
+
+    // Appends an operation; returns false if the transaction is full or a
+    // length is out of range.
+    bool Add(const uint8_t* write, int write_length, int read_length);
+  };
+
+  I2cBus(TwoWire* wire, int sda_pin, int scl_pin)
+      : wire_(wire), sda_pin_(sda_pin), scl_pin_(scl_pin) {}
+
+  // Initializes the controller at `frequency` Hz (100 kHz, 400 kHz fast mode
+  // or 1 MHz fast mode plus) and creates the transaction queues. The wire
+  // interface may still be used directly until `Start`.
+  void Begin(uint32_t frequency);
+
+  // Starts the bus task. From here on only the bus task touches the wire
+  // interface.
+  void Start(BaseType_t core, UBaseType_t priority);
+
+  // Queues `transaction` without blocking. Returns false if it has no
+  // operations or the queue for its device's priority is full. May be called
+  // from any task, including from a completion callback.
+  bool Submit(const Transaction& transaction);
+
+  // Registers a function called from the bus task after each completion
+  // callback, for example to wake the task that consumes the results.
+  void RegisterCompletionHandler(void (*handler)()) {
+    completion_handler_ = handler;
+  }
+
+  TwoWire* wire() { return wire_; }
+
+  // Counters since boot. May be read from any task.
+  uint32_t operations() const { return operations_.load(); }
+  uint32_t errors() const { return errors_.load(); }
+  uint32_t recoveries() const { return recoveries_.load(); }
+
+ private:
+  static constexpr int kNumPriorities = 3;
+  static constexpr int kQueueLength = 8;
+  static constexpr int kTaskStackSize = 3072;
+
+  static void StaticTask(void* bus);
+  void Task();
+
+  // Returns the highest-priority transaction in progress, dequeuing a new one
+  // if needed, or -1 if there is none.
+  int NextPriority();
+
+  bool Execute(const Device& device, Operation* operation);
+  void SetFrequency(uint32_t frequency);
+
+  // Frees a slave holding SDA low by clocking SCL until it releases the line,
+  // then issues a STOP and re-initializes the controller.
+  void Recover();
+
+  TwoWire* wire_;
+  int sda_pin_;
+  int scl_pin_;
+  uint32_t frequency_ = 100000;
+  uint32_t current_frequency_ = 0;
+  TaskHandle_t task_ = nullptr;
+  QueueHandle_t queues_[kNumPriorities] = {};
+  void (*completion_handler_)() = nullptr;
+
+  // Transaction in progress at each priority, owned by the bus task.
+  Transaction current_[kNumPriorities];
+  int next_operation_[kNumPriorities] = {};
+  bool active_[kNumPriorities] = {};
+
+  std::atomic<uint32_t> operations_{0};
+  std::atomic<uint32_t> errors_{0};
+  std::atomic<uint32_t> recoveries_{0};
+};
+
+}  // namespace jog_controller
+
+#endif  // I2C_BUS_H_
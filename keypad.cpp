@@ -11,6 +11,11 @@ Keypad* keypad_instance_ = nullptr;
 
 constexpr int kRowFieldOffset = 0;
 constexpr int kColFieldOffset = 4;
+
+// Rows driven low, columns floating high: any key press pulls a column low and
+// fires the PCF8574 interrupt.
+const uint8_t kIdlePins =
+    ~util::MakeField<uint8_t>(0x0f, 4, kRowFieldOffset);
 }  // namespace
 
 void Keypad::StaticIsr() { keypad_instance_->Isr(); }
@@ -27,68 +32,158 @@ void Keypad::Isr() {
   }
 
   interrupt_triggered_ = 1;
+
+  if (interrupt_handler_ != nullptr) {
+    interrupt_handler_();
+  }
+}
+
+void Keypad::Begin() {
+  ArmInterrupt();
+
+  I2cBus::Transaction reset;
+  reset.device = &device_;
+  reset.Add(&kIdlePins, 1, 0);
+  bus_->Submit(reset);
+  ++transactions_;
 }
 
 void Keypad::Poll() {
-  if (interrupt_triggered_ == 0) {
+  if (scan_ready_.load(std::memory_order_acquire)) {
+    DispatchKeys(scan_result_);
+    scan_ready_.store(false, std::memory_order_relaxed);
+  }
+
+  if (interrupt_triggered_ == 0 ||
+      scan_in_flight_.load(std::memory_order_acquire)) {
     return;
   }
 
-  for (int i = 0; i < kNumRows; ++i) {
-    WriteRowPins(1 << i);
+  // The interrupt stays pending until the scan completes, so that a failed
+  // submission is retried on the next Poll.
+  scan_in_flight_.store(true, std::memory_order_relaxed);
+  if (!SubmitScan(scan_mode_)) {
+    scan_in_flight_.store(false, std::memory_order_relaxed);
+  }
+}
 
-    uint8_t col_mask = 0;
-    if (!ReadColPins(&col_mask)) {
+bool Keypad::SubmitScan(ScanMode scan_mode) {
+  I2cBus::Transaction scan;
+  scan.device = &device_;
+  scan.callback = &Keypad::StaticOnScan;
+  scan.context = this;
+  scan.tag = static_cast<int>(scan_mode);
+
+  switch (scan_mode) {
+    case ScanMode::kRowScan:
+      for (int i = 0; i < kNumRows; ++i) {
+        uint8_t pins = ~util::MakeField<uint8_t>(1 << i, kNumRows,
+                                                 kRowFieldOffset);
+        scan.Add(&pins, 1, 1);
+      }
       break;
-    }
 
-    for (int j = 0; j < kNumCols; ++j) {
-      int button_index = j + i * kNumCols;
-      if (col_mask & (1 << j)) {
-        if (key_states_[button_index] == KeyState::kReleased) {
-          key_states_[button_index] = KeyState::kPressed;
-          handler_(button_index, KeyState::kPressed);
-        }
-      } else {
-        if (key_states_[button_index] == KeyState::kPressed) {
-          key_states_[button_index] = KeyState::kReleased;
-          handler_(button_index, KeyState::kReleased);
-        }
-      }
+    case ScanMode::kInversion: {
+      // In the idle state the rows are driven low and the columns float high,
+      // so the columns of any pressed keys already read low. Then swap roles:
+      // drive the columns low and let the rows float high.
+      uint8_t pins = ~util::MakeFieldMask<uint8_t>(kNumCols, kColFieldOffset);
+      scan.Add(nullptr, 0, 1);
+      scan.Add(&pins, 1, 1);
+      break;
     }
   }
+  scan.Add(&kIdlePins, 1, 0);
 
-  ResetPins();
-  interrupt_triggered_ = 0;
+  if (!bus_->Submit(scan)) {
+    return false;
+  }
+  for (int i = 0; i < scan.operation_count; ++i) {
+    transactions_ += (scan.operations[i].write_length > 0) +
+                     (scan.operations[i].read_length > 0);
+  }
+  return true;
 }
 
-void Keypad::WriteRowPins(uint8_t row_mask) {
-  bus_->beginTransmission(address_);
-  bus_->write(~util::MakeField<uint8_t>(row_mask, kNumRows, kRowFieldOffset));
-  bus_->endTransmission();
+void Keypad::StaticOnScan(void* keypad, const I2cBus::Transaction& scan) {
+  static_cast<Keypad*>(keypad)->OnScan(scan);
 }
 
-void Keypad::Begin() {
-  ResetPins();
-  ArmInterrupt();
-}
+void Keypad::OnScan(const I2cBus::Transaction& scan) {
+  // The interrupt that triggered the scan is still pending and the PCF8574
+  // will not fire again, so the next Poll retries. The bus completion handler
+  // wakes the loop.
+  if (!scan.ok) {
+    scan_in_flight_.store(false, std::memory_order_release);
+    return;
+  }
 
-bool Keypad::ReadColPins(uint8_t* col_mask) {
-  if (col_mask == nullptr) {
-    return false;
+  uint16_t pressed = 0;
+  switch (static_cast<ScanMode>(scan.tag)) {
+    case ScanMode::kRowScan:
+      for (int i = 0; i < kNumRows; ++i) {
+        uint8_t col_mask = util::GetField<uint8_t>(~scan.operations[i].read[0],
+                                                   kNumCols, kColFieldOffset);
+        pressed |= MakeKeyMask(1 << i, col_mask);
+      }
+      break;
+
+    case ScanMode::kInversion: {
+      uint8_t col_mask = util::GetField<uint8_t>(~scan.operations[0].read[0],
+                                                 kNumCols, kColFieldOffset);
+      uint8_t row_mask = util::GetField<uint8_t>(~scan.operations[1].read[0],
+                                                 kNumRows, kRowFieldOffset);
+
+      // With several rows and several columns active, the intersection
+      // contains keys that may not be pressed; only a row-by-row scan can tell
+      // them apart.
+      if (util::CountOnes<uint8_t>(row_mask) > 1 &&
+          util::CountOnes<uint8_t>(col_mask) > 1) {
+        ++ghosted_scans_;
+        if (!SubmitScan(ScanMode::kRowScan)) {
+          scan_in_flight_.store(false, std::memory_order_release);
+        }
+        return;
+      }
+      pressed = MakeKeyMask(row_mask, col_mask);
+      break;
+    }
   }
-  // Start read transmission.
-  bus_->requestFrom(address_, 1);
 
-  auto start = micros();
-  while (bus_->available() != 1) {
-    if ((micros() - start) > 1000) {
-      return false;
+  // The whole transaction, including the final return to idle, is complete,
+  // so interrupts up to here came from the scan's own writes. Discard them,
+  // as the synchronous scan did by clearing the flag after resetting the pins.
+  interrupt_triggered_ = 0;
+  scan_result_ = pressed;
+  scan_ready_.store(true, std::memory_order_release);
+  scan_in_flight_.store(false, std::memory_order_release);
+}
+
+uint16_t Keypad::MakeKeyMask(uint8_t row_mask, uint8_t col_mask) {
+  uint16_t keys = 0;
+  for (int i = 0; i < kNumRows; ++i) {
+    if (row_mask & (1 << i)) {
+      keys |= static_cast<uint16_t>(col_mask) << (i * kNumCols);
     }
   }
+  return keys;
+}
 
-  *col_mask = util::GetField<uint8_t>(~bus_->read(), kNumCols, kColFieldOffset);
-  return true;
+void Keypad::DispatchKeys(uint16_t pressed) {
+  for (int button_index = 0; button_index < kNumRows * kNumCols;
+       ++button_index) {
+    if (pressed & (1 << button_index)) {
+      if (key_states_[button_index] == KeyState::kReleased) {
+        key_states_[button_index] = KeyState::kPressed;
+        handler_(button_index, KeyState::kPressed);
+      }
+    } else {
+      if (key_states_[button_index] == KeyState::kPressed) {
+        key_states_[button_index] = KeyState::kReleased;
+        handler_(button_index, KeyState::kReleased);
+      }
+    }
+  }
 }
 
 }  // namespace jog_controller
@@ -1,7 +1,11 @@
 #ifndef KEYPAD_H_
 #define KEYPAD_H_
 
-#include <Wire.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "i2c_bus.h"
 
 namespace jog_controller {
 
@@ -9,26 +13,65 @@ enum class KeyState { kReleased = 0, kPressed };
 
 class Keypad {
  public:
+  // How the matrix is resolved after an interrupt. kRowScan drives each row in
+  // turn and reads the columns: four write/read pairs. kInversion reads the
+  // columns with all rows driven low, then drives the columns low and reads
+  // the rows, which takes two reads and two writes including the return to
+  // idle. When several rows and several columns are active at once the
+  // inversion result is ambiguous (ghosting), so that scan falls back to
+  // kRowScan.
+  enum class ScanMode { kRowScan = 0, kInversion };
+
   // Function signature for a key handler.
   using KeyHandler = void (*)(int, KeyState);
+  // Function signature for an interrupt handler. Called from interrupt
+  // context, so it must only do ISR-safe work such as waking a task.
+  using InterruptHandler = void (*)();
 
-  Keypad(TwoWire* bus, uint8_t address, int interrupt_pin)
+  // The PCF8574 is limited to standard-mode I2C.
+  static constexpr uint32_t kMaxFrequency = 100000;
+
+  Keypad(I2cBus* bus, uint8_t address, int interrupt_pin)
       : bus_(bus),
-        address_(address),
+        device_{address, I2cBus::Priority::kNormal, kMaxFrequency},
         interrupt_pin_(interrupt_pin),
         interrupt_triggered_(0) {}
 
-  // Initializes the keypad driver and sets up interrupts.
+  // Initializes the keypad driver, sets up interrupts and queues the return of
+  // the I/O expander to its idle state.
   void Begin();
 
   // Registers a key handler for this keypad.
   void RegisterKeyHandler(KeyHandler handler) { handler_ = handler; }
 
-  // If an interrupt was triggered prior to calling Poll, polls the PCF8574 for
-  // four cycles to get the indices of pressed/released key(s). Invokes the
-  // registered key handler for each pressed/released key.
+  // Registers a handler that is called whenever the keypad interrupt fires,
+  // so that the caller can schedule a Poll right away.
+  void RegisterInterruptHandler(InterruptHandler handler) {
+    interrupt_handler_ = handler;
+  }
+
+  void SetScanMode(ScanMode scan_mode) { scan_mode_ = scan_mode; }
+
+  // Invokes the registered key handler for each key pressed or released
+  // according to the last completed scan. Then, if an interrupt was triggered
+  // and no scan is in flight, submits a scan of the PCF8574 according to the
+  // scan mode. Never waits for the bus.
   void Poll();
 
+  // True from a keypad interrupt until the scan it triggered has been
+  // dispatched by Poll.
+  bool InputPending() const {
+    return interrupt_triggered_ != 0 ||
+           scan_in_flight_.load(std::memory_order_acquire) ||
+           scan_ready_.load(std::memory_order_acquire);
+  }
+
+  // Number of I2C transactions issued to the PCF8574.
+  uint32_t transactions() const { return transactions_.load(); }
+
+  // Number of inversion scans that were ambiguous and fell back to a row scan.
+  uint32_t ghosted_scans() const { return ghosted_scans_.load(); }
+
  private:
   static constexpr int kNumRows = 4;
   static constexpr int kNumCols = 4;
@@ -37,26 +80,45 @@ class Keypad {
   // INT line.
   void ArmInterrupt();
 
-  // Reset the state of the pins on the I/O expander.
-  void ResetPins() { WriteRowPins(0x0f); }
+  // Submits a scan as a single bus transaction: kRowScan drives each row in
+  // turn and reads the columns, kInversion reads the columns, drives the
+  // columns and reads the rows. Both end by returning the pins to the idle
+  // state, rows driven low. Returns false if the bus queue is full.
+  bool SubmitScan(ScanMode scan_mode);
 
-  // Writes the row pins of the I/O expander to the given mask value. The upper
-  // 4 bits of `row_mask` are ignored.
-  void WriteRowPins(uint8_t row_mask);
+  static void StaticOnScan(void* keypad, const I2cBus::Transaction& scan);
+  // Decodes a completed scan on the bus task and publishes the key mask for
+  // the next Poll, or falls back to a row scan on ghosting. Interrupts raised
+  // while the scan was in flight are discarded.
+  void OnScan(const I2cBus::Transaction& scan);
 
-  // Reads the column pins of the I/O expander, returning the result in
-  // col_mask. Returns false on error.
-  bool ReadColPins(uint8_t* col_mask);
+  // Returns the key mask for every key at the intersection of a row in
+  // `row_mask` and a column in `col_mask`.
+  static uint16_t MakeKeyMask(uint8_t row_mask, uint8_t col_mask);
+
+  // Invokes the key handler for every key whose state differs from `pressed`.
+  void DispatchKeys(uint16_t pressed);
 
   static void StaticIsr();
   void Isr();
 
-  TwoWire* bus_;
-  uint8_t address_;
+  I2cBus* bus_;
+  I2cBus::Device device_;
   int interrupt_pin_;
-  int interrupt_triggered_;
+  volatile int interrupt_triggered_;
   KeyState key_states_[kNumRows * kNumCols] = {};
   KeyHandler handler_ = nullptr;
+  InterruptHandler interrupt_handler_ = nullptr;
+  ScanMode scan_mode_ = ScanMode::kInversion;
+
+  // Handoff from the bus task: `scan_result_` holds a bit per pressed key, as
+  // `col + row * kNumCols`, and is valid once `scan_ready_` is set.
+  std::atomic<bool> scan_in_flight_{false};
+  std::atomic<bool> scan_ready_{false};
+  uint16_t scan_result_ = 0;
+
+  std::atomic<uint32_t> transactions_{0};
+  std::atomic<uint32_t> ghosted_scans_{0};
 };
 
 }  // namespace jog_controller
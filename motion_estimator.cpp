@@ -0,0 +1,89 @@
+#include "motion_estimator.h"
+
+namespace util {
+namespace {
+
+// Gains are applied in Q24. 2 * gamma is only about 1.8 in Q16, which would
+// round to a 13% error; in Q24 every gain is within 0.2%.
+constexpr int kGainFractionBits = 24;
+
+// Critically damped alpha-beta-gamma gains for a discount factor `theta`;
+// larger values smooth more and respond more slowly.
+constexpr double kTheta = 0.97;
+constexpr double kAlpha = 1 - kTheta * kTheta * kTheta;
+constexpr double kBeta = 1.5 * (1 - kTheta) * (1 - kTheta) * (1 + kTheta);
+constexpr double kGamma =
+    0.5 * (1 - kTheta) * (1 - kTheta) * (1 - kTheta);
+
+constexpr int64_t ToGain(double gain) {
+  return static_cast<int64_t>(gain * (int64_t{1} << kGainFractionBits) + 0.5);
+}
+
+constexpr int64_t kAlphaGain = ToGain(kAlpha);
+constexpr int64_t kBetaGain = ToGain(kBeta);
+// The acceleration update is 2 * gamma / T^2 with T = 1 sample.
+constexpr int64_t kGammaGain = ToGain(2 * kGamma);
+
+// Returns `value * 2^-shift`, rounded to nearest.
+int64_t RoundShift(int64_t value, int shift) {
+  return (value + (int64_t{1} << (shift - 1))) >> shift;
+}
+
+// Returns `gain * value * 2^-kGainFractionBits`, rounded to nearest. The
+// product is split at the binary point so that it cannot overflow for any
+// residual the state can hold.
+int64_t ApplyGain(int64_t gain, int64_t value) {
+  int64_t whole = value >> kGainFractionBits;
+  int64_t fraction = value & ((int64_t{1} << kGainFractionBits) - 1);
+  return whole * gain + RoundShift(fraction * gain, kGainFractionBits);
+}
+
+int32_t Saturate(int64_t value) {
+  if (value > INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (value < INT32_MIN) {
+    return INT32_MIN;
+  }
+  return static_cast<int32_t>(value);
+}
+
+}  // namespace
+
+void MotionEstimator::Update(int64_t count) {
+  if (!initialized_) {
+    initialized_ = true;
+    last_count_ = count;
+    offset_ = 0;
+    velocity_ = 0;
+    acceleration_ = 0;
+    return;
+  }
+
+  // Predict one sample ahead, relative to the new count, and correct by the
+  // residual between the measurement and the prediction.
+  int64_t predicted = offset_ + velocity_ + acceleration_ / 2 -
+                      (count - last_count_) * (int64_t{1} << kStateFractionBits);
+  int64_t residual = -predicted;
+
+  offset_ = predicted + ApplyGain(kAlphaGain, residual);
+  velocity_ += acceleration_ + ApplyGain(kBetaGain, residual);
+  acceleration_ += ApplyGain(kGammaGain, residual);
+  last_count_ = count;
+}
+
+int32_t MotionEstimator::velocity() const {
+  return Saturate(RoundShift(velocity_ * static_cast<int64_t>(sample_rate_hz_),
+                             kStateFractionBits));
+}
+
+int32_t MotionEstimator::acceleration() const {
+  // Scale by the rate in two steps to keep the intermediate within 64 bits.
+  int64_t per_second_sample =
+      RoundShift(acceleration_ * static_cast<int64_t>(sample_rate_hz_), 16);
+  return Saturate(RoundShift(
+      per_second_sample * static_cast<int64_t>(sample_rate_hz_),
+      kStateFractionBits - 16));
+}
+
+}  // namespace util
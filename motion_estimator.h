@@ -0,0 +1,49 @@
+#ifndef MOTION_ESTIMATOR_H_
+#define MOTION_ESTIMATOR_H_
+
+#include <stdint.h>
+
+namespace util {
+
+// Estimates the velocity and acceleration of a counter sampled at a fixed rate,
+// such as a quadrature encoder count, with an alpha-beta-gamma tracking filter.
+// All arithmetic is 64-bit fixed point and nothing is allocated, so `Update`
+// is cheap enough to run per sample at kilohertz rates.
+//
+// The gains are fixed per sample, so the response time scales with the sample
+// period: about 30 samples, or 30 ms at 1 kHz.
+class MotionEstimator {
+ public:
+  explicit MotionEstimator(uint32_t sample_rate_hz)
+      : sample_rate_hz_(sample_rate_hz) {}
+
+  // Forgets all history; the next sample initializes the filter at rest.
+  void Reset() { initialized_ = false; }
+
+  // Feeds the next sample of the counter.
+  void Update(int64_t count);
+
+  // Estimated velocity in counts per second, rounded and saturated to 32 bits.
+  int32_t velocity() const;
+
+  // Estimated acceleration in counts per second squared, rounded and saturated
+  // to 32 bits.
+  int32_t acceleration() const;
+
+ private:
+  // Filter state is kept in units of counts and samples with this many
+  // fraction bits. Position is stored as an offset from the last sample so
+  // that it stays small regardless of the absolute count.
+  static constexpr int kStateFractionBits = 32;
+
+  uint32_t sample_rate_hz_;
+  bool initialized_ = false;
+  int64_t last_count_ = 0;
+  int64_t offset_ = 0;
+  int64_t velocity_ = 0;
+  int64_t acceleration_ = 0;
+};
+
+}  // namespace util
+
+#endif  // MOTION_ESTIMATOR_H_
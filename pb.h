@@ -47,6 +47,16 @@
  * the string processing slightly and slightly increases code size. */
 /* #define PB_VALIDATE_UTF8 1 */
 
+/* Expand each message descriptor into a RAM table of decoded field records
+ * on first use, so that field iterators don't re-parse the packed
+ * field_info words on every step. Costs RAM per message type. */
+/* #define PB_ENABLE_DESCRIPTOR_CACHE 1 */
+
+/* Build a direct tag -> field index table alongside the descriptor cache,
+ * making pb_field_iter_find() constant time for messages whose largest tag
+ * is below PB_TAG_INDEX_MAX_TAG. Implies PB_ENABLE_DESCRIPTOR_CACHE. */
+/* #define PB_ENABLE_TAG_INDEX 1 */
+
 /******************************************************************
  * You usually don't need to change anything below this line.     *
  * Feel free to look around and use the defined macros, though.   *
@@ -160,6 +170,17 @@ extern "C" {
 #  define PB_STATIC_ASSERT(COND,MSG)
 #endif
 
+/* The direct tag index is built on top of the descriptor cache. */
+#if defined(PB_ENABLE_TAG_INDEX) && !defined(PB_ENABLE_DESCRIPTOR_CACHE)
+#define PB_ENABLE_DESCRIPTOR_CACHE 1
+#endif
+
+/* Messages with a largest tag at or above this fall back to scanning the
+ * descriptor cache instead of getting a direct tag index. */
+#ifndef PB_TAG_INDEX_MAX_TAG
+#define PB_TAG_INDEX_MAX_TAG 256
+#endif
+
 /* Number of required fields to keep track of. */
 #ifndef PB_MAX_REQUIRED_FIELDS
 #define PB_MAX_REQUIRED_FIELDS 64
@@ -223,8 +244,13 @@ typedef uint_least8_t pb_type_t;
  * pb_byte_t[data_size] rather than pb_bytes_array_t. */
 #define PB_LTYPE_FIXED_LENGTH_BYTES 0x0BU
 
+/* Zero-copy bytes or string, stored as pb_view_t pointing into the input
+ * buffer instead of being copied. Use the BYTES_VIEW or STRING_VIEW field
+ * type in the field list. Can only be decoded from buffer streams. */
+#define PB_LTYPE_VIEW 0x0CU
+
 /* Number of declared LTYPES */
-#define PB_LTYPES_COUNT 0x0CU
+#define PB_LTYPES_COUNT 0x0DU
 #define PB_LTYPE_MASK 0x0FU
 
 /**** Field repetition rules ****/
@@ -277,6 +303,39 @@ typedef struct pb_field_iter_s pb_field_iter_t;
  * to specify struct fields.
  */
 typedef struct pb_msgdesc_s pb_msgdesc_t;
+
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+/* Decoded form of one field_info entry, plus the running indexes that the
+ * iterator would otherwise compute while walking the descriptor. */
+typedef struct pb_field_cache_entry_s pb_field_cache_entry_t;
+struct pb_field_cache_entry_s {
+    uint32_t data_offset;
+    pb_size_t tag;
+    pb_size_t data_size;
+    pb_size_t array_size;
+    pb_size_t field_info_index;
+    pb_size_t required_field_index;
+    pb_size_t submessage_index;
+    int_least8_t size_offset;
+    pb_type_t type;
+    const pb_msgdesc_t *submsg_desc;
+};
+
+/* Per-message cache storage, allocated by PB_BIND. Filled in by
+ * pb_field_cache_init(), or lazily by the first pb_field_iter_begin(). */
+typedef struct pb_field_cache_s pb_field_cache_t;
+struct pb_field_cache_s {
+    pb_field_cache_entry_t *entries;
+#ifdef PB_ENABLE_TAG_INDEX
+    /* tag_index[tag] is the field index + 1, or 0 for unknown tags.
+     * tag_index_size is 0 if the message has no direct index. */
+    pb_size_t *tag_index;
+    pb_size_t tag_index_size;
+#endif
+    bool ready;
+};
+#endif
+
 struct pb_msgdesc_s {
     const uint32_t *field_info;
     const pb_msgdesc_t * const * submsg_info;
@@ -287,6 +346,10 @@ struct pb_msgdesc_s {
     pb_size_t field_count;
     pb_size_t required_field_count;
     pb_size_t largest_tag;
+
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+    pb_field_cache_t *field_cache;
+#endif
 };
 
 /* Iterator for message descriptor */
@@ -338,6 +401,18 @@ struct pb_bytes_array_s {
 };
 typedef struct pb_bytes_array_s pb_bytes_array_t;
 
+/* This structure is used for PB_LTYPE_VIEW fields.
+ * After decoding, bytes points into the buffer given to
+ * pb_istream_from_buffer() and is valid only as long as that buffer is
+ * alive and unchanged. String views are not null terminated. For encoding,
+ * point it at any data that stays valid until pb_encode() returns.
+ */
+typedef struct pb_view_s pb_view_t;
+struct pb_view_s {
+    const pb_byte_t *bytes;
+    size_t size;
+};
+
 /* This structure is used for giving the callback function.
  * It is stored in the message structure and filled in by the method that
  * calls pb_decode.
@@ -432,7 +507,8 @@ struct pb_extension_s {
 #define pb_extension_init_zero {NULL,NULL,NULL,false}
 
 /* Memory allocation functions to use. You can define pb_realloc and
- * pb_free to custom functions if you want. */
+ * pb_free to custom functions if you want. A different allocator can also
+ * be set per input stream, see pb_allocator_t in pb_decode.h. */
 #ifdef PB_ENABLE_MALLOC
 #   ifndef pb_realloc
 #       define pb_realloc(ptr, size) realloc(ptr, size)
@@ -456,8 +532,34 @@ struct pb_extension_s {
 /* Force expansion of macro value */
 #define PB_EXPAND(x) x
 
+/* Storage for the optional descriptor cache. The arrays have one spare
+ * slot so that they are never zero-length. */
+#ifdef PB_ENABLE_TAG_INDEX
+#define PB_TAG_INDEX_SIZE(largest_tag) \
+    ((largest_tag) < PB_TAG_INDEX_MAX_TAG ? (largest_tag) + 1 : 0)
+#define PB_GEN_TAG_INDEX(msgname, structname) \
+    static pb_size_t structname ## _tag_index[1 + PB_TAG_INDEX_SIZE(0 msgname ## _FIELDLIST(PB_GEN_LARGEST_TAG, structname))];
+#define PB_GEN_TAG_INDEX_REF(msgname, structname) \
+    structname ## _tag_index, PB_TAG_INDEX_SIZE(0 msgname ## _FIELDLIST(PB_GEN_LARGEST_TAG, structname)),
+#else
+#define PB_GEN_TAG_INDEX(msgname, structname)
+#define PB_GEN_TAG_INDEX_REF(msgname, structname)
+#endif
+
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+#define PB_GEN_FIELD_CACHE(msgname, structname) \
+    PB_GEN_TAG_INDEX(msgname, structname) \
+    static pb_field_cache_entry_t structname ## _field_cache_entries[1 msgname ## _FIELDLIST(PB_GEN_FIELD_COUNT, structname)]; \
+    static pb_field_cache_t structname ## _field_cache = {structname ## _field_cache_entries, PB_GEN_TAG_INDEX_REF(msgname, structname) false};
+#define PB_GEN_FIELD_CACHE_REF(structname) &structname ## _field_cache,
+#else
+#define PB_GEN_FIELD_CACHE(msgname, structname)
+#define PB_GEN_FIELD_CACHE_REF(structname)
+#endif
+
 /* Binding of a message field set into a specific structure */
 #define PB_BIND(msgname, structname, width) \
+    PB_GEN_FIELD_CACHE(msgname, structname) \
     const uint32_t structname ## _field_info[] PB_PROGMEM = \
     { \
         msgname ## _FIELDLIST(PB_GEN_FIELD_INFO_ ## width, structname) \
@@ -477,6 +579,7 @@ struct pb_extension_s {
        0 msgname ## _FIELDLIST(PB_GEN_FIELD_COUNT, structname), \
        0 msgname ## _FIELDLIST(PB_GEN_REQ_FIELD_COUNT, structname), \
        0 msgname ## _FIELDLIST(PB_GEN_LARGEST_TAG, structname), \
+       PB_GEN_FIELD_CACHE_REF(structname) \
     }; \
     msgname ## _FIELDLIST(PB_GEN_FIELD_INFO_ASSERT_ ## width, structname)
 
@@ -683,6 +786,8 @@ struct pb_extension_s {
 #define PB_SI_PB_LTYPE_UINT64(t)
 #define PB_SI_PB_LTYPE_EXTENSION(t)
 #define PB_SI_PB_LTYPE_FIXED_LENGTH_BYTES(t)
+#define PB_SI_PB_LTYPE_BYTES_VIEW(t)
+#define PB_SI_PB_LTYPE_STRING_VIEW(t)
 #define PB_SUBMSG_DESCRIPTOR(t)    &(t ## _msg),
 
 /* The field descriptors use a variable width format, with width of either
@@ -802,6 +907,8 @@ struct pb_extension_s {
 #define PB_FI_WIDTH_PB_LTYPE_UINT64    1
 #define PB_FI_WIDTH_PB_LTYPE_EXTENSION 1
 #define PB_FI_WIDTH_PB_LTYPE_FIXED_LENGTH_BYTES 2
+#define PB_FI_WIDTH_PB_LTYPE_BYTES_VIEW 2
+#define PB_FI_WIDTH_PB_LTYPE_STRING_VIEW 2
 
 /* The mapping from protobuf types to LTYPEs is done using these macros. */
 #define PB_LTYPE_MAP_BOOL               PB_LTYPE_BOOL
@@ -825,6 +932,8 @@ struct pb_extension_s {
 #define PB_LTYPE_MAP_UINT64             PB_LTYPE_UVARINT
 #define PB_LTYPE_MAP_EXTENSION          PB_LTYPE_EXTENSION
 #define PB_LTYPE_MAP_FIXED_LENGTH_BYTES PB_LTYPE_FIXED_LENGTH_BYTES
+#define PB_LTYPE_MAP_BYTES_VIEW         PB_LTYPE_VIEW
+#define PB_LTYPE_MAP_STRING_VIEW        PB_LTYPE_VIEW
 
 /* These macros are used for giving out error messages.
  * They are mostly a debugging aid; the main error information
@@ -5,15 +5,21 @@
 
 #include "pb_common.h"
 
-static bool load_descriptor_values(pb_field_iter_t *iter)
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+static bool field_cache_ready(const pb_msgdesc_t *desc)
+{
+    return desc->field_cache != NULL && desc->field_cache->ready;
+}
+#endif
+
+/* Decode the packed field_info words at iter->field_info_index into the
+ * iterator's type, tag and size members. */
+static void decode_descriptor_words(pb_field_iter_t *iter, uint32_t *data_offset_out, int_least8_t *size_offset_out)
 {
     uint32_t word0;
     uint32_t data_offset;
     int_least8_t size_offset;
 
-    if (iter->index >= iter->descriptor->field_count)
-        return false;
-
     word0 = PB_PROGMEM_READU32(iter->descriptor->field_info[iter->field_info_index]);
     iter->type = (pb_type_t)((word0 >> 8) & 0xFF);
 
@@ -71,6 +77,45 @@ static bool load_descriptor_values(pb_field_iter_t *iter)
         }
     }
 
+    *data_offset_out = data_offset;
+    *size_offset_out = size_offset;
+}
+
+static bool load_descriptor_values(pb_field_iter_t *iter)
+{
+    uint32_t data_offset;
+    int_least8_t size_offset;
+
+    if (iter->index >= iter->descriptor->field_count)
+        return false;
+
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+    if (field_cache_ready(iter->descriptor))
+    {
+        const pb_field_cache_entry_t *entry = &iter->descriptor->field_cache->entries[iter->index];
+        iter->type = entry->type;
+        iter->tag = entry->tag;
+        iter->array_size = entry->array_size;
+        iter->data_size = entry->data_size;
+        iter->submsg_desc = entry->submsg_desc;
+        data_offset = entry->data_offset;
+        size_offset = entry->size_offset;
+    }
+    else
+#endif
+    {
+        decode_descriptor_words(iter, &data_offset, &size_offset);
+
+        if (PB_LTYPE_IS_SUBMSG(iter->type))
+        {
+            iter->submsg_desc = iter->descriptor->submsg_info[iter->submessage_index];
+        }
+        else
+        {
+            iter->submsg_desc = NULL;
+        }
+    }
+
     if (!iter->message)
     {
         /* Avoid doing arithmetic on null pointers, it is undefined */
@@ -107,15 +152,6 @@ static bool load_descriptor_values(pb_field_iter_t *iter)
         }
     }
 
-    if (PB_LTYPE_IS_SUBMSG(iter->type))
-    {
-        iter->submsg_desc = iter->descriptor->submsg_info[iter->submessage_index];
-    }
-    else
-    {
-        iter->submsg_desc = NULL;
-    }
-
     return true;
 }
 
@@ -131,6 +167,15 @@ static void advance_iterator(pb_field_iter_t *iter)
         iter->submessage_index = 0;
         iter->required_field_index = 0;
     }
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+    else if (field_cache_ready(iter->descriptor))
+    {
+        const pb_field_cache_entry_t *entry = &iter->descriptor->field_cache->entries[iter->index];
+        iter->field_info_index = entry->field_info_index;
+        iter->required_field_index = entry->required_field_index;
+        iter->submessage_index = entry->submessage_index;
+    }
+#endif
     else
     {
         /* Increment indexes based on previous field type.
@@ -153,8 +198,61 @@ static void advance_iterator(pb_field_iter_t *iter)
     }
 }
 
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+void pb_field_cache_init(const pb_msgdesc_t *desc)
+{
+    pb_field_iter_t iter;
+    pb_field_cache_t *cache = desc->field_cache;
+
+    if (cache == NULL || cache->ready)
+        return;
+
+    /* Walk the packed descriptor once, recording each field. The cache is
+     * not marked ready until the walk is complete, so the iterator functions
+     * below take the uncached path. */
+    memset(&iter, 0, sizeof(iter));
+    iter.descriptor = desc;
+
+    while (load_descriptor_values(&iter))
+    {
+        uint32_t data_offset;
+        int_least8_t size_offset;
+        pb_field_cache_entry_t *entry = &cache->entries[iter.index];
+
+        decode_descriptor_words(&iter, &data_offset, &size_offset);
+        entry->data_offset = data_offset;
+        entry->size_offset = size_offset;
+        entry->tag = iter.tag;
+        entry->type = iter.type;
+        entry->data_size = iter.data_size;
+        entry->array_size = iter.array_size;
+        entry->field_info_index = iter.field_info_index;
+        entry->required_field_index = iter.required_field_index;
+        entry->submessage_index = iter.submessage_index;
+        entry->submsg_desc = iter.submsg_desc;
+
+#ifdef PB_ENABLE_TAG_INDEX
+        if (iter.tag < cache->tag_index_size && PB_LTYPE(iter.type) != PB_LTYPE_EXTENSION)
+        {
+            cache->tag_index[iter.tag] = (pb_size_t)(iter.index + 1);
+        }
+#endif
+
+        advance_iterator(&iter);
+        if (iter.index == 0)
+            break;
+    }
+
+    cache->ready = true;
+}
+#endif
+
 bool pb_field_iter_begin(pb_field_iter_t *iter, const pb_msgdesc_t *desc, void *message)
 {
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+    pb_field_cache_init(desc);
+#endif
+
     memset(iter, 0, sizeof(*iter));
 
     iter->descriptor = desc;
@@ -192,6 +290,19 @@ bool pb_field_iter_next(pb_field_iter_t *iter)
     return iter->index != 0;
 }
 
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+/* Position the iterator at field index using the descriptor cache. */
+static bool seek_cached_field(pb_field_iter_t *iter, pb_size_t index)
+{
+    const pb_field_cache_entry_t *entry = &iter->descriptor->field_cache->entries[index];
+    iter->index = index;
+    iter->field_info_index = entry->field_info_index;
+    iter->required_field_index = entry->required_field_index;
+    iter->submessage_index = entry->submessage_index;
+    return load_descriptor_values(iter);
+}
+#endif
+
 bool pb_field_iter_find(pb_field_iter_t *iter, uint32_t tag)
 {
     if (iter->tag == tag)
@@ -202,6 +313,37 @@ bool pb_field_iter_find(pb_field_iter_t *iter, uint32_t tag)
     {
         return false;
     }
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+    else if (field_cache_ready(iter->descriptor))
+    {
+        const pb_field_cache_t *cache = iter->descriptor->field_cache;
+        const pb_field_cache_entry_t *entries = cache->entries;
+        pb_size_t i;
+
+#ifdef PB_ENABLE_TAG_INDEX
+        if (tag < cache->tag_index_size)
+        {
+            /* Direct lookup; 0 marks a tag with no field. */
+            i = cache->tag_index[tag];
+            if (i == 0)
+                return false;
+
+            return seek_cached_field(iter, (pb_size_t)(i - 1));
+        }
+#endif
+
+        /* Scan the decoded tags directly, without touching field_info. */
+        for (i = 0; i < iter->descriptor->field_count; i++)
+        {
+            if (entries[i].tag == tag && PB_LTYPE(entries[i].type) != PB_LTYPE_EXTENSION)
+            {
+                return seek_cached_field(iter, i);
+            }
+        }
+
+        return false;
+    }
+#endif
     else
     {
         pb_size_t start = iter->index;
@@ -11,6 +11,14 @@
 extern "C" {
 #endif
 
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+/* Fill in the descriptor cache of desc, if it has one and it is not ready
+ * yet. pb_field_iter_begin() does this lazily; call it up front for every
+ * message type (and submessage type) before iterating from several threads,
+ * because lazy initialization is not synchronized. */
+void pb_field_cache_init(const pb_msgdesc_t *desc);
+#endif
+
 /* Initialize the field iterator structure to beginning.
  * Returns false if the message type is empty. */
 bool pb_field_iter_begin(pb_field_iter_t *iter, const pb_msgdesc_t *desc, void *message);
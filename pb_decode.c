@@ -33,12 +33,14 @@ static bool checkreturn default_extension_decoder(pb_istream_t *stream, pb_exten
 static bool checkreturn decode_extension(pb_istream_t *stream, uint32_t tag, pb_wire_type_t wire_type, pb_extension_t *extension);
 static bool pb_field_set_to_default(pb_field_iter_t *field);
 static bool pb_message_set_to_defaults(pb_field_iter_t *iter);
+static bool defaults_are_copyable(const pb_msgdesc_t *fields, const void *message);
 static bool checkreturn pb_dec_bool(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_bytes(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_string(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_submessage(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_fixed_length_bytes(pb_istream_t *stream, const pb_field_iter_t *field);
+static bool checkreturn pb_dec_view(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_skip_varint(pb_istream_t *stream);
 static bool checkreturn pb_skip_string(pb_istream_t *stream);
 
@@ -46,7 +48,8 @@ static bool checkreturn pb_skip_string(pb_istream_t *stream);
 static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t data_size, size_t array_size);
 static void initialize_pointer_field(void *pItem, pb_field_iter_t *field);
 static bool checkreturn pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *field);
-static void pb_release_single_field(pb_field_iter_t *field);
+static void pb_release_single_field(pb_field_iter_t *field, pb_allocator_t *allocator);
+static bool pb_arena_contains(const void *ptr);
 #endif
 
 #ifdef PB_WITHOUT_64BIT
@@ -59,10 +62,6 @@ static void pb_release_single_field(pb_field_iter_t *field);
 
 #define PB_WT_PACKED ((pb_wire_type_t)0xFF)
 
-typedef struct {
-    uint32_t bitfield[(PB_MAX_REQUIRED_FIELDS + 31) / 32];
-} pb_fields_seen_t;
-
 /*******************************
  * pb_istream_t implementation *
  *******************************/
@@ -159,6 +158,9 @@ pb_istream_t pb_istream_from_buffer(const pb_byte_t *buf, size_t msglen)
     stream.bytes_left = msglen;
 #ifndef PB_NO_ERRMSG
     stream.errmsg = NULL;
+#endif
+#ifdef PB_ENABLE_MALLOC
+    stream.allocator = NULL;
 #endif
     return stream;
 }
@@ -167,10 +169,125 @@ pb_istream_t pb_istream_from_buffer(const pb_byte_t *buf, size_t msglen)
  * Helper functions *
  ********************/
 
+/* The longest run of bytes the varint decoders below will read before either
+ * completing or failing with "varint overflow". */
+#define PB_VARINT_MAX_READ 11
+
+/* Streams created by pb_istream_from_buffer() (and substreams of them) read
+ * from contiguous memory at stream->state, so varints can be decoded straight
+ * from the buffer instead of one callback per byte. */
+static bool is_buffer_stream(const pb_istream_t *stream)
+{
+#ifdef PB_BUFFER_ONLY
+    PB_UNUSED(stream);
+    return true;
+#else
+    return stream->callback == buf_read;
+#endif
+}
+
+/* Fast path of pb_decode_varint32_eof() for buffer streams with at least
+ * PB_VARINT_MAX_READ bytes left, so that no per-byte bounds checks are
+ * needed. Consumes the same bytes and reports the same errors. */
+static bool checkreturn buf_decode_varint32(pb_istream_t *stream, uint32_t *dest)
+{
+    const pb_byte_t *start = (const pb_byte_t*)stream->state;
+    const pb_byte_t *p = start;
+    pb_byte_t byte = *p++;
+    uint32_t result;
+    bool overflow = false;
+
+    if ((byte & 0x80) == 0)
+    {
+        result = byte;
+    }
+    else
+    {
+        uint_fast8_t bitpos = 7;
+        result = byte & 0x7F;
+
+        do
+        {
+            byte = *p++;
+
+            if (bitpos >= 32)
+            {
+                pb_byte_t sign_extension = (bitpos < 63) ? 0xFF : 0x01;
+                bool valid_extension = ((byte & 0x7F) == 0x00 ||
+                         ((result >> 31) != 0 && byte == sign_extension));
+
+                if (bitpos >= 64 || !valid_extension)
+                {
+                    overflow = true;
+                    break;
+                }
+            }
+            else
+            {
+                result |= (uint32_t)(byte & 0x7F) << bitpos;
+            }
+            bitpos = (uint_fast8_t)(bitpos + 7);
+        } while (byte & 0x80);
+
+        if (!overflow && bitpos == 35 && (byte & 0x70) != 0)
+        {
+            overflow = true;
+        }
+    }
+
+    stream->state = (pb_byte_t*)stream->state + (p - start);
+    stream->bytes_left -= (size_t)(p - start);
+
+    if (overflow)
+        PB_RETURN_ERROR(stream, "varint overflow");
+
+    *dest = result;
+    return true;
+}
+
+#ifndef PB_WITHOUT_64BIT
+/* Fast path of pb_decode_varint(), under the same conditions as
+ * buf_decode_varint32(). */
+static bool checkreturn buf_decode_varint(pb_istream_t *stream, uint64_t *dest)
+{
+    const pb_byte_t *start = (const pb_byte_t*)stream->state;
+    const pb_byte_t *p = start;
+    pb_byte_t byte;
+    uint_fast8_t bitpos = 0;
+    uint64_t result = 0;
+    bool overflow = false;
+
+    do
+    {
+        if (bitpos >= 64)
+        {
+            overflow = true;
+            break;
+        }
+
+        byte = *p++;
+        result |= (uint64_t)(byte & 0x7F) << bitpos;
+        bitpos = (uint_fast8_t)(bitpos + 7);
+    } while (byte & 0x80);
+
+    stream->state = (pb_byte_t*)stream->state + (p - start);
+    stream->bytes_left -= (size_t)(p - start);
+
+    if (overflow)
+        PB_RETURN_ERROR(stream, "varint overflow");
+
+    *dest = result;
+    return true;
+}
+#endif
+
 static bool checkreturn pb_decode_varint32_eof(pb_istream_t *stream, uint32_t *dest, bool *eof)
 {
     pb_byte_t byte;
     uint32_t result;
+
+    if (is_buffer_stream(stream) && stream->bytes_left >= PB_VARINT_MAX_READ)
+        return buf_decode_varint32(stream, dest);
     
     if (!pb_readbyte(stream, &byte))
     {
@@ -242,6 +359,9 @@ bool checkreturn pb_decode_varint(pb_istream_t *stream, uint64_t *dest)
     pb_byte_t byte;
     uint_fast8_t bitpos = 0;
     uint64_t result = 0;
+
+    if (is_buffer_stream(stream) && stream->bytes_left >= PB_VARINT_MAX_READ)
+        return buf_decode_varint(stream, dest);
     
     do
     {
@@ -456,6 +576,12 @@ static bool checkreturn decode_basic_field(pb_istream_t *stream, pb_wire_type_t
 
             return pb_dec_fixed_length_bytes(stream, field);
 
+        case PB_LTYPE_VIEW:
+            if (wire_type != PB_WT_STRING)
+                PB_RETURN_ERROR(stream, "wrong wire type");
+
+            return pb_dec_view(stream, field);
+
         default:
             PB_RETURN_ERROR(stream, "invalid field type");
     }
@@ -584,7 +710,11 @@ static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t
     /* Allocate new or expand previous allocation */
     /* Note: on failure the old pointer will remain in the structure,
      * the message must be freed by caller also on error return. */
-    ptr = pb_realloc(ptr, array_size * data_size);
+    if (stream->allocator)
+        ptr = stream->allocator->realloc(stream->allocator, ptr, array_size * data_size);
+    else
+        ptr = pb_realloc(ptr, array_size * data_size);
+
     if (ptr == NULL)
         PB_RETURN_ERROR(stream, "realloc failed");
     
@@ -625,7 +755,7 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
             {
                 /* Duplicate field, have to release the old allocation first. */
                 /* FIXME: Does this work correctly for oneofs? */
-                pb_release_single_field(field);
+                pb_release_single_field(field, stream->allocator);
             }
         
             if (PB_HTYPE(field->type) == PB_HTYPE_ONEOF)
@@ -966,140 +1096,147 @@ static bool pb_message_set_to_defaults(pb_field_iter_t *iter)
  * Decode all fields *
  *********************/
 
-static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
+static bool checkreturn frame_init(pb_istream_t *stream, pb_decode_frame_t *frame,
+                                   const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
 {
-    uint32_t extension_range_start = 0;
-    pb_extension_t *extensions = NULL;
+    frame->end = (size_t)-1;
+    frame->extensions = NULL;
+    frame->extension_range_start = 0;
 
     /* 'fixed_count_field' and 'fixed_count_size' track position of a repeated fixed
      * count field. This can only handle _one_ repeated fixed count field that
      * is unpacked and unordered among other (non repeated fixed count) fields.
      */
-    pb_size_t fixed_count_field = PB_SIZE_MAX;
-    pb_size_t fixed_count_size = 0;
-    pb_size_t fixed_count_total_size = 0;
-
-    pb_fields_seen_t fields_seen = {{0, 0}};
-    const uint32_t allbits = ~(uint32_t)0;
-    pb_field_iter_t iter;
+    frame->fixed_count_field = PB_SIZE_MAX;
+    frame->fixed_count_size = 0;
+    frame->fixed_count_total_size = 0;
+    memset(frame->fields_seen, 0, sizeof(frame->fields_seen));
 
-    if (pb_field_iter_begin(&iter, fields, dest_struct))
+    if (pb_field_iter_begin(&frame->iter, fields, dest_struct))
     {
         if ((flags & PB_DECODE_NOINIT) == 0)
         {
-            if (!pb_message_set_to_defaults(&iter))
+            if (!pb_message_set_to_defaults(&frame->iter))
                 PB_RETURN_ERROR(stream, "failed to set defaults");
         }
     }
 
-    while (stream->bytes_left)
-    {
-        uint32_t tag;
-        pb_wire_type_t wire_type;
-        bool eof;
+    return true;
+}
 
-        if (!pb_decode_tag(stream, &wire_type, &tag, &eof))
+/* Move the iterator to the regular (non-extension) field with the given tag. */
+static bool frame_find_field(pb_decode_frame_t *frame, uint32_t tag)
+{
+    return pb_field_iter_find(&frame->iter, tag) &&
+           PB_LTYPE(frame->iter.type) != PB_LTYPE_EXTENSION;
+}
+
+/* Check if an unknown tag falls in the extension range of the message. */
+static bool frame_is_extension_tag(pb_decode_frame_t *frame, uint32_t tag)
+{
+    if (frame->extension_range_start == 0)
+    {
+        if (pb_field_iter_find_extension(&frame->iter))
         {
-            if (eof)
-                break;
-            else
-                return false;
+            frame->extensions = *(pb_extension_t* const *)frame->iter.pData;
+            frame->extension_range_start = frame->iter.tag;
         }
 
-        if (tag == 0)
+        if (!frame->extensions)
         {
-          if (flags & PB_DECODE_NULLTERMINATED)
-          {
-            break;
-          }
-          else
-          {
-            PB_RETURN_ERROR(stream, "zero tag");
-          }
+            frame->extension_range_start = (uint32_t)-1;
         }
+    }
 
-        if (!pb_field_iter_find(&iter, tag) || PB_LTYPE(iter.type) == PB_LTYPE_EXTENSION)
-        {
-            /* No match found, check if it matches an extension. */
-            if (extension_range_start == 0)
-            {
-                if (pb_field_iter_find_extension(&iter))
-                {
-                    extensions = *(pb_extension_t* const *)iter.pData;
-                    extension_range_start = iter.tag;
-                }
+    return tag >= frame->extension_range_start;
+}
 
-                if (!extensions)
-                {
-                    extension_range_start = (uint32_t)-1;
-                }
-            }
+/* Bookkeeping for the field found by frame_find_field(), done before its
+ * value is decoded. */
+static bool checkreturn frame_mark_field(pb_istream_t *stream, pb_decode_frame_t *frame)
+{
+    pb_field_iter_t *iter = &frame->iter;
 
-            if (tag >= extension_range_start)
+    /* If a repeated fixed count field was found, get size from
+     * 'fixed_count_field' as there is no counter contained in the struct.
+     */
+    if (PB_HTYPE(iter->type) == PB_HTYPE_REPEATED && iter->pSize == &iter->array_size)
+    {
+        if (frame->fixed_count_field != iter->index) {
+            /* If the new fixed count field does not match the previous one,
+             * check that the previous one is NULL or that it finished
+             * receiving all the expected data.
+             */
+            if (frame->fixed_count_field != PB_SIZE_MAX &&
+                frame->fixed_count_size != frame->fixed_count_total_size)
             {
-                size_t pos = stream->bytes_left;
-
-                if (!decode_extension(stream, tag, wire_type, extensions))
-                    return false;
-
-                if (pos != stream->bytes_left)
-                {
-                    /* The field was handled */
-                    continue;
-                }
+                PB_RETURN_ERROR(stream, "wrong size for fixed count field");
             }
 
-            /* No match found, skip data */
-            if (!pb_skip_field(stream, wire_type))
-                return false;
-            continue;
+            frame->fixed_count_field = iter->index;
+            frame->fixed_count_size = 0;
+            frame->fixed_count_total_size = iter->array_size;
         }
 
-        /* If a repeated fixed count field was found, get size from
-         * 'fixed_count_field' as there is no counter contained in the struct.
-         */
-        if (PB_HTYPE(iter.type) == PB_HTYPE_REPEATED && iter.pSize == &iter.array_size)
-        {
-            if (fixed_count_field != iter.index) {
-                /* If the new fixed count field does not match the previous one,
-                 * check that the previous one is NULL or that it finished
-                 * receiving all the expected data.
-                 */
-                if (fixed_count_field != PB_SIZE_MAX &&
-                    fixed_count_size != fixed_count_total_size)
-                {
-                    PB_RETURN_ERROR(stream, "wrong size for fixed count field");
-                }
+        iter->pSize = &frame->fixed_count_size;
+    }
 
-                fixed_count_field = iter.index;
-                fixed_count_size = 0;
-                fixed_count_total_size = iter.array_size;
-            }
+    if (PB_HTYPE(iter->type) == PB_HTYPE_REQUIRED
+        && iter->required_field_index < PB_MAX_REQUIRED_FIELDS)
+    {
+        uint32_t tmp = ((uint32_t)1 << (iter->required_field_index & 31));
+        frame->fields_seen[iter->required_field_index >> 5] |= tmp;
+    }
 
-            iter.pSize = &fixed_count_size;
-        }
+    return true;
+}
 
-        if (PB_HTYPE(iter.type) == PB_HTYPE_REQUIRED
-            && iter.required_field_index < PB_MAX_REQUIRED_FIELDS)
+/* Decode the value of one field, whose tag has already been read. */
+static bool checkreturn frame_decode_field(pb_istream_t *stream, pb_decode_frame_t *frame,
+                                           uint32_t tag, pb_wire_type_t wire_type)
+{
+    if (!frame_find_field(frame, tag))
+    {
+        /* No match found, check if it matches an extension. */
+        if (frame_is_extension_tag(frame, tag))
         {
-            uint32_t tmp = ((uint32_t)1 << (iter.required_field_index & 31));
-            fields_seen.bitfield[iter.required_field_index >> 5] |= tmp;
+            size_t pos = stream->bytes_left;
+
+            if (!decode_extension(stream, tag, wire_type, frame->extensions))
+                return false;
+
+            if (pos != stream->bytes_left)
+            {
+                /* The field was handled */
+                return true;
+            }
         }
 
-        if (!decode_field(stream, wire_type, &iter))
-            return false;
+        /* No match found, skip data */
+        return pb_skip_field(stream, wire_type);
     }
 
+    if (!frame_mark_field(stream, frame))
+        return false;
+
+    return decode_field(stream, wire_type, &frame->iter);
+}
+
+/* Checks done once all fields of a message have been decoded. */
+static bool checkreturn frame_finish(pb_istream_t *stream, const pb_decode_frame_t *frame)
+{
+    const uint32_t allbits = ~(uint32_t)0;
+
     /* Check that all elements of the last decoded fixed count field were present. */
-    if (fixed_count_field != PB_SIZE_MAX &&
-        fixed_count_size != fixed_count_total_size)
+    if (frame->fixed_count_field != PB_SIZE_MAX &&
+        frame->fixed_count_size != frame->fixed_count_total_size)
     {
         PB_RETURN_ERROR(stream, "wrong size for fixed count field");
     }
 
     /* Check that all required fields were present. */
     {
-        pb_size_t req_field_count = iter.descriptor->required_field_count;
+        pb_size_t req_field_count = frame->iter.descriptor->required_field_count;
 
         if (req_field_count > 0)
         {
@@ -1111,14 +1248,14 @@ static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t
             /* Check the whole words */
             for (i = 0; i < (req_field_count >> 5); i++)
             {
-                if (fields_seen.bitfield[i] != allbits)
+                if (frame->fields_seen[i] != allbits)
                     PB_RETURN_ERROR(stream, "missing required field");
             }
 
             /* Check the remaining bits (if any) */
             if ((req_field_count & 31) != 0)
             {
-                if (fields_seen.bitfield[req_field_count >> 5] !=
+                if (frame->fields_seen[req_field_count >> 5] !=
                     (allbits >> (uint_least8_t)(32 - (req_field_count & 31))))
                 {
                     PB_RETURN_ERROR(stream, "missing required field");
@@ -1130,6 +1267,46 @@ static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t
     return true;
 }
 
+static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
+{
+    pb_decode_frame_t frame;
+
+    if (!frame_init(stream, &frame, fields, dest_struct, flags))
+        return false;
+
+    while (stream->bytes_left)
+    {
+        uint32_t tag;
+        pb_wire_type_t wire_type;
+        bool eof;
+
+        if (!pb_decode_tag(stream, &wire_type, &tag, &eof))
+        {
+            if (eof)
+                break;
+            else
+                return false;
+        }
+
+        if (tag == 0)
+        {
+          if (flags & PB_DECODE_NULLTERMINATED)
+          {
+            break;
+          }
+          else
+          {
+            PB_RETURN_ERROR(stream, "zero tag");
+          }
+        }
+
+        if (!frame_decode_field(stream, &frame, tag, wire_type))
+            return false;
+    }
+
+    return frame_finish(stream, &frame);
+}
+
 bool checkreturn pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
 {
     bool status;
@@ -1152,7 +1329,7 @@ bool checkreturn pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields,
     
 #ifdef PB_ENABLE_MALLOC
     if (!status)
-        pb_release(fields, dest_struct);
+        pb_release_ex(fields, dest_struct, stream->allocator);
 #endif
     
     return status;
@@ -1166,68 +1343,606 @@ bool checkreturn pb_decode(pb_istream_t *stream, const pb_msgdesc_t *fields, voi
 
 #ifdef PB_ENABLE_MALLOC
     if (!status)
-        pb_release(fields, dest_struct);
+        pb_release_ex(fields, dest_struct, stream->allocator);
 #endif
 
     return status;
 }
 
-#ifdef PB_ENABLE_MALLOC
-/* Given an oneof field, if there has already been a field inside this oneof,
- * release it before overwriting with a different one. */
-static bool pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *field)
+/* True if a structure set to defaults can be duplicated with memcpy() to
+ * initialize another one. Callback and extension fields are left alone by
+ * pb_message_set_to_defaults(), so copying them would clobber caller state. */
+static bool defaults_are_copyable(const pb_msgdesc_t *fields, const void *message)
 {
-    pb_field_iter_t old_field = *field;
-    pb_size_t old_tag = *(pb_size_t*)field->pSize; /* Previous which_ value */
-    pb_size_t new_tag = field->tag; /* New which_ value */
-
-    if (old_tag == 0)
-        return true; /* Ok, no old data in union */
+    pb_field_iter_t iter;
 
-    if (old_tag == new_tag)
-        return true; /* Ok, old data is of same type => merge */
+    if (!pb_field_iter_begin_const(&iter, fields, message))
+        return true;
 
-    /* Release old data. The find can fail if the message struct contains
-     * invalid data. */
-    if (!pb_field_iter_find(&old_field, old_tag))
-        PB_RETURN_ERROR(stream, "invalid union tag");
+    do
+    {
+        if (PB_ATYPE(iter.type) == PB_ATYPE_CALLBACK ||
+            PB_LTYPE(iter.type) == PB_LTYPE_EXTENSION)
+        {
+            return false;
+        }
 
-    pb_release_single_field(&old_field);
+        if (PB_ATYPE(iter.type) == PB_ATYPE_STATIC &&
+            PB_LTYPE_IS_SUBMSG(iter.type) &&
+            !defaults_are_copyable(iter.submsg_desc, iter.pData))
+        {
+            return false;
+        }
+    } while (pb_field_iter_next(&iter));
 
     return true;
 }
 
-static void pb_release_single_field(pb_field_iter_t *field)
+bool checkreturn pb_decode_many(pb_istream_t *stream, const pb_msgdesc_t *fields,
+                                void *dest_array, size_t struct_size,
+                                size_t max_count, size_t *count)
 {
-    pb_type_t type;
-    type = field->type;
+    pb_byte_t *dest = (pb_byte_t*)dest_array;
+    bool copy_defaults = false;
+    size_t i;
 
-    if (PB_HTYPE(type) == PB_HTYPE_ONEOF)
-    {
-        if (*(pb_size_t*)field->pSize != field->tag)
-            return; /* This is not the current field in the union */
-    }
+    *count = 0;
 
-    /* Release anything contained inside an extension or submsg.
-     * This has to be done even if the submsg itself is statically
-     * allocated. */
-    if (PB_LTYPE(type) == PB_LTYPE_EXTENSION)
+    if (max_count == 0 || stream->bytes_left == 0)
+        return true;
+
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+    pb_field_cache_init(fields);
+#endif
+
+    /* Set the first structure to defaults once. When possible, each following
+     * structure is then copied from its still untouched predecessor right
+     * before that one is decoded, so the defaults are only computed once. */
     {
-        /* Release fields from all extensions in the linked list */
-        pb_extension_t *ext = *(pb_extension_t**)field->pData;
-        while (ext != NULL)
+        pb_field_iter_t iter;
+        if (pb_field_iter_begin(&iter, fields, dest))
         {
-            pb_field_iter_t ext_iter;
-            if (pb_field_iter_begin_extension(&ext_iter, ext))
-            {
-                pb_release_single_field(&ext_iter);
-            }
-            ext = ext->next;
+            if (!pb_message_set_to_defaults(&iter))
+                PB_RETURN_ERROR(stream, "failed to set defaults");
         }
     }
-    else if (PB_LTYPE_IS_SUBMSG(type) && PB_ATYPE(type) != PB_ATYPE_CALLBACK)
+
+    for (i = 0; i < max_count && stream->bytes_left > 0; i++)
     {
-        /* Release fields in submessage or submsg array */
+        pb_byte_t *message = dest + i * struct_size;
+        unsigned int flags = (i == 0 || copy_defaults) ? PB_DECODE_NOINIT : 0;
+        pb_istream_t substream;
+        bool status;
+
+        if (!pb_make_string_substream(stream, &substream))
+            return false;
+
+        /* The substream has already been split off the parent stream, so
+         * any bytes left there belong to the next message. */
+        if (i + 1 < max_count && stream->bytes_left > 0)
+        {
+            if (i == 0)
+                copy_defaults = defaults_are_copyable(fields, dest);
+
+            if (copy_defaults)
+                memcpy(message + struct_size, message, struct_size);
+        }
+
+        status = pb_decode_inner(&substream, fields, message, flags);
+
+        if (!pb_close_string_substream(stream, &substream))
+            return false;
+
+        if (!status)
+        {
+#ifdef PB_ENABLE_MALLOC
+            pb_release_ex(fields, message, stream->allocator);
+#endif
+            return false;
+        }
+
+        *count = i + 1;
+    }
+
+    return true;
+}
+
+/*****************************************
+ * Incremental (resumable) decoding      *
+ *****************************************/
+
+/* Values of pb_decode_ctx_t.state */
+#define PB_INC_PREFIX   0 /* Reading the length prefix of a delimited message */
+#define PB_INC_TAG      1 /* Reading a field tag */
+#define PB_INC_LENGTH   2 /* Reading the length of a PB_WT_STRING value */
+#define PB_INC_VARINT   3 /* Reading a PB_WT_VARINT value */
+#define PB_INC_BYTES    4 /* Reading the remaining bytes of a value */
+#define PB_INC_COMPLETE 5
+#define PB_INC_ERROR    6
+
+/* Values of pb_decode_ctx_t.action: what to do with the current value */
+#define PB_INC_DECODE   0 /* Decode it with frame_decode_field() */
+#define PB_INC_SKIP     1 /* Unknown field, discard */
+#define PB_INC_DESCEND  2 /* Static submessage, decode its fields in a new frame */
+
+static pb_decode_status_t incremental_error(pb_decode_ctx_t *ctx, const char *msg)
+{
+    PB_UNUSED(msg);
+    PB_SET_ERROR(ctx, msg);
+    ctx->state = PB_INC_ERROR;
+
+#ifdef PB_ENABLE_MALLOC
+    pb_release_ex(ctx->frames[0].iter.descriptor, ctx->frames[0].iter.message, ctx->allocator);
+#endif
+
+    return PB_DECODE_ERROR;
+}
+
+/* Append bytes of a value that straddles feed boundaries to field_buf. */
+static bool incremental_collect(pb_decode_ctx_t *ctx, const pb_byte_t *buf, size_t count)
+{
+    if (count > PB_INCREMENTAL_FIELD_SIZE - ctx->field_len)
+        return false;
+
+    memcpy(ctx->field_buf[ctx->field_buf_index] + ctx->field_len, buf, count);
+    ctx->field_len += count;
+    return true;
+}
+
+/* Add one byte to the tag or length varint being read, with the same rules
+ * as pb_decode_varint32(). Returns 1 when the varint is complete, 0 if more
+ * bytes are needed and -1 on overflow. */
+static int incremental_varint(pb_decode_ctx_t *ctx, pb_byte_t byte)
+{
+    uint_fast8_t bitpos = (uint_fast8_t)(7 * ctx->varint_bytes);
+
+    if (bitpos >= 32)
+    {
+        /* Note: The varint could have trailing 0x80 bytes, or 0xFF for negative. */
+        pb_byte_t sign_extension = (bitpos < 63) ? 0xFF : 0x01;
+        bool valid_extension = ((byte & 0x7F) == 0x00 ||
+                 ((ctx->varint >> 31) != 0 && byte == sign_extension));
+
+        if (bitpos >= 64 || !valid_extension)
+            return -1;
+    }
+    else
+    {
+        if (bitpos == 28 && (byte & 0x80) == 0 && (byte & 0x70) != 0)
+            return -1;
+
+        ctx->varint |= (uint32_t)(byte & 0x7F) << bitpos;
+    }
+
+    ctx->varint_bytes++;
+    return (byte & 0x80) ? 0 : 1;
+}
+
+/* Open a new frame for the static submessage field at frame->iter. Does the
+ * same preparations as decode_static_field() and pb_dec_submessage(). */
+static bool checkreturn incremental_descend(pb_istream_t *stream, pb_decode_ctx_t *ctx,
+                                            pb_decode_frame_t *frame, size_t length)
+{
+    pb_field_iter_t *field = &frame->iter;
+    unsigned int flags = PB_DECODE_NOINIT;
+
+    if (ctx->depth >= PB_INCREMENTAL_MAX_DEPTH)
+        PB_RETURN_ERROR(stream, "max nesting depth exceeded");
+
+    if (field->submsg_desc == NULL)
+        PB_RETURN_ERROR(stream, "invalid field descriptor");
+
+    if (!frame_mark_field(stream, frame))
+        return false;
+
+#ifdef PB_ENABLE_MALLOC
+    if (PB_HTYPE(field->type) == PB_HTYPE_ONEOF)
+    {
+        if (!pb_release_union_field(stream, field))
+            return false;
+    }
+#endif
+
+    switch (PB_HTYPE(field->type))
+    {
+        case PB_HTYPE_REQUIRED:
+            break;
+
+        case PB_HTYPE_OPTIONAL:
+            if (field->pSize != NULL)
+                *(bool*)field->pSize = true;
+            break;
+
+        case PB_HTYPE_REPEATED:
+        {
+            pb_size_t *size = (pb_size_t*)field->pSize;
+            field->pData = (char*)field->pField + field->data_size * (*size);
+
+            if ((*size)++ >= field->array_size)
+                PB_RETURN_ERROR(stream, "array overflow");
+
+            flags = 0;
+            break;
+        }
+
+        case PB_HTYPE_ONEOF:
+            if (*(pb_size_t*)field->pSize != field->tag)
+            {
+                memset(field->pData, 0, (size_t)field->data_size);
+
+                if (!pb_field_set_to_default(field))
+                    PB_RETURN_ERROR(stream, "failed to set defaults");
+            }
+            *(pb_size_t*)field->pSize = field->tag;
+            break;
+
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+
+    if (!frame_init(stream, &ctx->frames[ctx->depth], field->submsg_desc, field->pData, flags))
+        return false;
+
+    ctx->frames[ctx->depth].end = ctx->position + length;
+    ctx->depth++;
+    return true;
+}
+
+/* Called with the tag in ctx->varint. Decides how the value is handled and
+ * which state reads it. */
+static bool checkreturn incremental_start_field(pb_istream_t *stream, pb_decode_ctx_t *ctx,
+                                                pb_decode_frame_t *frame)
+{
+    ctx->tag = ctx->varint >> 3;
+    ctx->wire_type = (pb_wire_type_t)(ctx->varint & 7);
+    ctx->varint = 0;
+    ctx->varint_bytes = 0;
+    ctx->field_len = 0;
+
+    if (frame_find_field(frame, ctx->tag))
+    {
+        if (ctx->wire_type == PB_WT_STRING &&
+            PB_ATYPE(frame->iter.type) == PB_ATYPE_STATIC &&
+            PB_LTYPE(frame->iter.type) == PB_LTYPE_SUBMESSAGE)
+        {
+            ctx->action = PB_INC_DESCEND;
+        }
+        else
+        {
+            ctx->action = PB_INC_DECODE;
+        }
+    }
+    else
+    {
+        ctx->action = frame_is_extension_tag(frame, ctx->tag) ? PB_INC_DECODE : PB_INC_SKIP;
+    }
+
+    switch (ctx->wire_type)
+    {
+        case PB_WT_VARINT: ctx->state = PB_INC_VARINT; break;
+        case PB_WT_64BIT: ctx->state = PB_INC_BYTES; ctx->remaining = 8; break;
+        case PB_WT_STRING: ctx->state = PB_INC_LENGTH; break;
+        case PB_WT_32BIT: ctx->state = PB_INC_BYTES; ctx->remaining = 4; break;
+        default: PB_RETURN_ERROR(stream, "invalid wire_type");
+    }
+
+    return true;
+}
+
+/* Called when the whole value of the current field has been read. value
+ * points to it, including the length prefix of PB_WT_STRING values. */
+static bool checkreturn incremental_end_field(pb_istream_t *stream, pb_decode_ctx_t *ctx,
+                                              pb_decode_frame_t *frame,
+                                              const pb_byte_t *value, size_t length)
+{
+    ctx->state = PB_INC_TAG;
+
+    if (ctx->action == PB_INC_DECODE)
+    {
+        pb_istream_t valuestream = pb_istream_from_buffer(value, length);
+#ifdef PB_ENABLE_MALLOC
+        valuestream.allocator = ctx->allocator;
+#endif
+
+        if (!frame_decode_field(&valuestream, frame, ctx->tag, ctx->wire_type))
+            PB_RETURN_ERROR(stream, PB_GET_ERROR(&valuestream));
+    }
+
+    return true;
+}
+
+void pb_decode_incremental_init(pb_decode_ctx_t *ctx, const pb_msgdesc_t *fields,
+                                void *dest_struct, unsigned int flags)
+{
+    pb_istream_t stream = PB_ISTREAM_EMPTY;
+
+    ctx->depth = 1;
+    ctx->state = (flags & PB_DECODE_DELIMITED) ? PB_INC_PREFIX : PB_INC_TAG;
+    ctx->action = PB_INC_SKIP;
+    ctx->varint_bytes = 0;
+    ctx->flags = flags;
+    ctx->position = 0;
+    ctx->varint = 0;
+    ctx->tag = 0;
+    ctx->wire_type = PB_WT_VARINT;
+    ctx->remaining = 0;
+    ctx->field_len = 0;
+    ctx->field_buf_index = 0;
+#ifndef PB_NO_ERRMSG
+    ctx->errmsg = NULL;
+#endif
+#ifdef PB_ENABLE_MALLOC
+    ctx->allocator = NULL;
+#endif
+
+    if (!frame_init(&stream, &ctx->frames[0], fields, dest_struct, flags))
+        incremental_error(ctx, PB_GET_ERROR(&stream));
+}
+
+pb_decode_status_t pb_decode_incremental(pb_decode_ctx_t *ctx, const pb_byte_t *buf,
+                                         size_t count, size_t *consumed)
+{
+    pb_istream_t stream = PB_ISTREAM_EMPTY;
+    size_t pos = 0;
+    size_t value_start = 0; /* Where the current call's part of the value begins */
+
+#ifdef PB_ENABLE_MALLOC
+    /* Oneof members replaced by incremental_descend() are released with this */
+    stream.allocator = ctx->allocator;
+#endif
+    *consumed = 0;
+
+    while (ctx->state != PB_INC_COMPLETE && ctx->state != PB_INC_ERROR)
+    {
+        pb_decode_frame_t *frame = &ctx->frames[ctx->depth - 1];
+        size_t avail;
+
+        if (ctx->state == PB_INC_TAG && ctx->varint_bytes == 0 &&
+            ctx->position == frame->end)
+        {
+            /* All bytes of this (sub)message have been read */
+            if (!frame_finish(&stream, frame))
+                return incremental_error(ctx, PB_GET_ERROR(&stream));
+
+            if (ctx->depth == 1)
+                ctx->state = PB_INC_COMPLETE;
+            else
+                ctx->depth--;
+            continue;
+        }
+
+        if (pos == count)
+        {
+            /* Keep the partial value until the next call */
+            if (ctx->action == PB_INC_DECODE && ctx->state >= PB_INC_LENGTH &&
+                !incremental_collect(ctx, buf + value_start, count - value_start))
+            {
+                return incremental_error(ctx, "field too large for incremental buffer");
+            }
+
+            *consumed = count;
+            return PB_DECODE_NEED_MORE;
+        }
+
+        avail = count - pos;
+        if (frame->end - ctx->position < avail)
+            avail = frame->end - ctx->position;
+
+        if (avail == 0)
+            return incremental_error(ctx, "parent stream too short");
+
+        if (ctx->state == PB_INC_BYTES)
+        {
+            size_t n = (ctx->remaining < avail) ? ctx->remaining : avail;
+            pos += n;
+            ctx->position += n;
+            ctx->remaining -= n;
+        }
+        else
+        {
+            pb_byte_t byte = buf[pos++];
+            ctx->position++;
+
+            if (ctx->state == PB_INC_VARINT)
+            {
+                /* Skipped varints have no length limit, as in pb_skip_varint() */
+                if (ctx->action != PB_INC_SKIP && ++ctx->varint_bytes > 10)
+                    return incremental_error(ctx, "varint overflow");
+
+                if (byte & 0x80)
+                    continue;
+
+                ctx->varint_bytes = 0;
+            }
+            else
+            {
+                int status = incremental_varint(ctx, byte);
+
+                if (status < 0)
+                    return incremental_error(ctx, "varint overflow");
+                if (status == 0)
+                    continue;
+            }
+        }
+
+        switch (ctx->state)
+        {
+            case PB_INC_PREFIX:
+                frame->end = ctx->position + ctx->varint;
+                ctx->varint = 0;
+                ctx->varint_bytes = 0;
+                ctx->state = PB_INC_TAG;
+                continue;
+
+            case PB_INC_TAG:
+                if ((ctx->varint >> 3) == 0)
+                {
+                    if (ctx->depth == 1 && (ctx->flags & PB_DECODE_NULLTERMINATED))
+                    {
+                        ctx->state = PB_INC_COMPLETE;
+                        continue;
+                    }
+
+                    return incremental_error(ctx, "zero tag");
+                }
+
+                if (!incremental_start_field(&stream, ctx, frame))
+                    return incremental_error(ctx, PB_GET_ERROR(&stream));
+
+                value_start = pos;
+                continue;
+
+            case PB_INC_LENGTH:
+            {
+                size_t length = ctx->varint;
+                ctx->varint = 0;
+                ctx->varint_bytes = 0;
+
+                if (length > frame->end - ctx->position)
+                    return incremental_error(ctx, "parent stream too short");
+
+                if (ctx->action == PB_INC_DESCEND)
+                {
+                    if (!incremental_descend(&stream, ctx, frame, length))
+                        return incremental_error(ctx, PB_GET_ERROR(&stream));
+
+                    ctx->state = PB_INC_TAG;
+                    continue;
+                }
+
+                ctx->remaining = length;
+                ctx->state = PB_INC_BYTES;
+
+                if (length > 0)
+                    continue;
+                break;
+            }
+
+            default:
+                if (ctx->remaining > 0)
+                    continue;
+                break;
+        }
+
+        /* The value of the current field is complete. Decode it in place if
+         * it all arrived in this call, otherwise from field_buf. */
+        if (ctx->action == PB_INC_DECODE && ctx->field_len > 0)
+        {
+            if (!incremental_collect(ctx, buf + value_start, pos - value_start))
+                return incremental_error(ctx, "field too large for incremental buffer");
+
+            if (!incremental_end_field(&stream, ctx, frame,
+                                       ctx->field_buf[ctx->field_buf_index], ctx->field_len))
+                return incremental_error(ctx, PB_GET_ERROR(&stream));
+
+            /* A view may point into this buffer until the next call */
+            ctx->field_buf_index = (uint_least8_t)(ctx->field_buf_index ^ 1);
+        }
+        else
+        {
+            if (!incremental_end_field(&stream, ctx, frame, buf + value_start, pos - value_start))
+                return incremental_error(ctx, PB_GET_ERROR(&stream));
+        }
+    }
+
+    *consumed = pos;
+    return (ctx->state == PB_INC_COMPLETE) ? PB_DECODE_COMPLETE : PB_DECODE_ERROR;
+}
+
+pb_decode_status_t pb_decode_incremental_finish(pb_decode_ctx_t *ctx)
+{
+    pb_istream_t stream = PB_ISTREAM_EMPTY;
+
+    if (ctx->state == PB_INC_COMPLETE)
+        return PB_DECODE_COMPLETE;
+
+    if (ctx->state == PB_INC_ERROR)
+        return PB_DECODE_ERROR;
+
+    if (ctx->state != PB_INC_TAG || ctx->varint_bytes != 0 || ctx->depth != 1 ||
+        (ctx->frames[0].end != (size_t)-1 && ctx->position != ctx->frames[0].end))
+    {
+        return incremental_error(ctx, "io error");
+    }
+
+    if (!frame_finish(&stream, &ctx->frames[0]))
+        return incremental_error(ctx, PB_GET_ERROR(&stream));
+
+    ctx->state = PB_INC_COMPLETE;
+    return PB_DECODE_COMPLETE;
+}
+
+#ifdef PB_ENABLE_MALLOC
+/* Given an oneof field, if there has already been a field inside this oneof,
+ * release it before overwriting with a different one. */
+static bool pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *field)
+{
+    pb_field_iter_t old_field = *field;
+    pb_size_t old_tag = *(pb_size_t*)field->pSize; /* Previous which_ value */
+    pb_size_t new_tag = field->tag; /* New which_ value */
+
+    if (old_tag == 0)
+        return true; /* Ok, no old data in union */
+
+    if (old_tag == new_tag)
+        return true; /* Ok, old data is of same type => merge */
+
+    /* Release old data. The find can fail if the message struct contains
+     * invalid data. */
+    if (!pb_field_iter_find(&old_field, old_tag))
+        PB_RETURN_ERROR(stream, "invalid union tag");
+
+    pb_release_single_field(&old_field, stream->allocator);
+
+    return true;
+}
+
+/* Free memory of a pointer field, using the same allocator that decoded it.
+ * Without one, arena blocks are skipped: they belong to the arena. */
+static void release_pointer(pb_allocator_t *allocator, void *ptr)
+{
+    if (allocator)
+    {
+        if (allocator->free)
+            allocator->free(allocator, ptr);
+    }
+    else if (!pb_arena_contains(ptr))
+    {
+        pb_free(ptr);
+    }
+}
+
+static void pb_release_single_field(pb_field_iter_t *field, pb_allocator_t *allocator)
+{
+    pb_type_t type;
+    type = field->type;
+
+    if (PB_HTYPE(type) == PB_HTYPE_ONEOF)
+    {
+        if (*(pb_size_t*)field->pSize != field->tag)
+            return; /* This is not the current field in the union */
+    }
+
+    /* Release anything contained inside an extension or submsg.
+     * This has to be done even if the submsg itself is statically
+     * allocated. */
+    if (PB_LTYPE(type) == PB_LTYPE_EXTENSION)
+    {
+        /* Release fields from all extensions in the linked list */
+        pb_extension_t *ext = *(pb_extension_t**)field->pData;
+        while (ext != NULL)
+        {
+            pb_field_iter_t ext_iter;
+            if (pb_field_iter_begin_extension(&ext_iter, ext))
+            {
+                pb_release_single_field(&ext_iter, allocator);
+            }
+            ext = ext->next;
+        }
+    }
+    else if (PB_LTYPE_IS_SUBMSG(type) && PB_ATYPE(type) != PB_ATYPE_CALLBACK)
+    {
+        /* Release fields in submessage or submsg array */
         pb_size_t count = 1;
         
         if (PB_ATYPE(type) == PB_ATYPE_POINTER)
@@ -1254,7 +1969,7 @@ static void pb_release_single_field(pb_field_iter_t *field)
         {
             for (; count > 0; count--)
             {
-                pb_release(field->submsg_desc, field->pData);
+                pb_release_ex(field->submsg_desc, field->pData, allocator);
                 field->pData = (char*)field->pData + field->data_size;
             }
         }
@@ -1271,7 +1986,7 @@ static void pb_release_single_field(pb_field_iter_t *field)
             pb_size_t count = *(pb_size_t*)field->pSize;
             for (; count > 0; count--)
             {
-                pb_free(*pItem);
+                release_pointer(allocator, *pItem);
                 *pItem++ = NULL;
             }
         }
@@ -1283,26 +1998,189 @@ static void pb_release_single_field(pb_field_iter_t *field)
         }
         
         /* Release main pointer */
-        pb_free(*(void**)field->pField);
+        release_pointer(allocator, *(void**)field->pField);
         *(void**)field->pField = NULL;
     }
 }
 
 void pb_release(const pb_msgdesc_t *fields, void *dest_struct)
+{
+    pb_release_ex(fields, dest_struct, NULL);
+}
+
+void pb_release_ex(const pb_msgdesc_t *fields, void *dest_struct, pb_allocator_t *allocator)
 {
     pb_field_iter_t iter;
     
     if (!dest_struct)
         return; /* Ignore NULL pointers, similar to free() */
 
+    if (allocator && !allocator->free)
+        return; /* Memory is reclaimed by the allocator owner */
+
     if (!pb_field_iter_begin(&iter, fields, dest_struct))
         return; /* Empty message type */
     
     do
     {
-        pb_release_single_field(&iter);
+        pb_release_single_field(&iter, allocator);
     } while (pb_field_iter_next(&iter));
 }
+
+/* Blocks are aligned for any field type and preceded by their size, which
+ * is needed when a block that is not the latest one grows. */
+typedef union {
+    void *p;
+    double d;
+    pb_int64_t i;
+} pb_arena_align_t;
+
+#define PB_ARENA_ALIGN sizeof(pb_arena_align_t)
+#define PB_ARENA_ROUND(x) (((x) + PB_ARENA_ALIGN - 1) / PB_ARENA_ALIGN * PB_ARENA_ALIGN)
+#define PB_ARENA_HEADER PB_ARENA_ROUND(sizeof(size_t))
+
+/* Address ranges of the buffers of initialized arenas. Only compared
+ * against, so a range left behind by an arena that went out of scope is
+ * harmless until its memory is reused. */
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} pb_arena_range_t;
+
+static pb_arena_range_t pb_arena_ranges[PB_ARENA_MAX_COUNT];
+
+static bool pb_arena_contains(const void *ptr)
+{
+    uintptr_t address = (uintptr_t)ptr;
+    size_t i;
+
+    for (i = 0; i < PB_ARENA_MAX_COUNT; i++)
+    {
+        if (address >= pb_arena_ranges[i].start && address < pb_arena_ranges[i].end)
+            return true;
+    }
+
+    return false;
+}
+
+static void *pb_arena_realloc(pb_allocator_t *allocator, void *ptr, size_t size)
+{
+    pb_arena_t *arena = (pb_arena_t*)allocator;
+    size_t old_size = 0;
+    pb_byte_t *block;
+
+    if (size > arena->size)
+        return NULL;
+
+    size = PB_ARENA_ROUND(size);
+
+    if (ptr != NULL)
+    {
+        old_size = *(size_t*)((pb_byte_t*)ptr - PB_ARENA_HEADER);
+
+        if (ptr == arena->last)
+        {
+            /* Grow or shrink the latest block in place */
+            size_t start = (size_t)((pb_byte_t*)ptr - arena->buffer);
+            if (size > arena->size - start)
+                return NULL;
+
+            arena->used = start + size;
+            *(size_t*)((pb_byte_t*)ptr - PB_ARENA_HEADER) = size;
+            arena->allocations++;
+            return ptr;
+        }
+    }
+
+    if (PB_ARENA_HEADER + size > arena->size - arena->used)
+        return NULL;
+
+    block = arena->buffer + arena->used + PB_ARENA_HEADER;
+    *(size_t*)(block - PB_ARENA_HEADER) = size;
+    arena->used += PB_ARENA_HEADER + size;
+
+    if (ptr != NULL)
+        memcpy(block, ptr, (old_size < size) ? old_size : size);
+
+    arena->last = block;
+    arena->allocations++;
+    return block;
+}
+
+bool pb_arena_init(pb_arena_t *arena, void *buffer, size_t size)
+{
+    /* Start at an aligned address, block offsets are then aligned too */
+    size_t misalign = (size_t)((uintptr_t)buffer % PB_ARENA_ALIGN);
+    size_t skip = misalign ? PB_ARENA_ALIGN - misalign : 0;
+    uintptr_t start = (uintptr_t)buffer;
+    uintptr_t end = start + size;
+    pb_arena_range_t *free_range = NULL;
+    size_t i;
+
+    if (skip > size)
+        skip = size;
+
+    arena->allocator.realloc = &pb_arena_realloc;
+    arena->allocator.free = NULL;
+    arena->buffer = (pb_byte_t*)buffer + skip;
+    arena->size = size - skip;
+    pb_arena_reset(arena);
+
+    if (arena->size == 0)
+        return true; /* Nothing will be allocated from it */
+
+    /* The memory of an overlapping range now belongs to this arena, so the
+     * arena that recorded it can no longer be in use. */
+    for (i = 0; i < PB_ARENA_MAX_COUNT; i++)
+    {
+        pb_arena_range_t *range = &pb_arena_ranges[i];
+        if (range->start < end && start < range->end)
+        {
+            range->start = 0;
+            range->end = 0;
+        }
+
+        if (free_range == NULL && range->end == 0)
+            free_range = range;
+    }
+
+    if (free_range == NULL)
+    {
+        /* Without a record pb_release() would free its blocks */
+        arena->size = 0;
+        return false;
+    }
+
+    free_range->start = start;
+    free_range->end = end;
+    return true;
+}
+
+void pb_arena_reset(pb_arena_t *arena)
+{
+    arena->used = 0;
+    arena->last = NULL;
+    arena->allocations = 0;
+}
+
+void pb_arena_deinit(pb_arena_t *arena)
+{
+    uintptr_t address = (uintptr_t)arena->buffer;
+    size_t i;
+
+    for (i = 0; i < PB_ARENA_MAX_COUNT; i++)
+    {
+        pb_arena_range_t *range = &pb_arena_ranges[i];
+        if (address >= range->start && address < range->end)
+        {
+            range->start = 0;
+            range->end = 0;
+        }
+    }
+
+    arena->size = 0;
+    pb_arena_reset(arena);
+}
 #endif
 
 /* Field decoders */
@@ -1623,6 +2501,28 @@ static bool checkreturn pb_dec_fixed_length_bytes(pb_istream_t *stream, const pb
     return pb_read(stream, (pb_byte_t*)field->pData, (size_t)field->data_size);
 }
 
+static bool checkreturn pb_dec_view(pb_istream_t *stream, const pb_field_iter_t *field)
+{
+    uint32_t size;
+    const pb_byte_t *bytes;
+    pb_view_t *view = (pb_view_t*)field->pData;
+
+    /* The view points into the stream memory, so there must be some */
+    if (!is_buffer_stream(stream))
+        PB_RETURN_ERROR(stream, "view requires buffer stream");
+
+    if (!pb_decode_varint32(stream, &size))
+        return false;
+
+    bytes = (const pb_byte_t*)stream->state;
+    if (!pb_read(stream, NULL, (size_t)size))
+        return false;
+
+    view->bytes = bytes;
+    view->size = (size_t)size;
+    return true;
+}
+
 #ifdef PB_CONVERT_DOUBLE_FLOAT
 bool pb_decode_double_as_float(pb_istream_t *stream, float *dest)
 {
@@ -12,6 +12,18 @@
 extern "C" {
 #endif
 
+#ifdef PB_ENABLE_MALLOC
+/* Allocator used for pointer fields. When a stream has no allocator,
+ * pb_realloc() and pb_free() are used. realloc must behave like the C
+ * function of the same name. If free is NULL, memory is reclaimed by the
+ * allocator owner in bulk and releasing messages is a no-op. */
+typedef struct pb_allocator_s pb_allocator_t;
+struct pb_allocator_s {
+    void *(*realloc)(pb_allocator_t *allocator, void *ptr, size_t size);
+    void (*free)(pb_allocator_t *allocator, void *ptr);
+};
+#endif
+
 /* Structure for defining custom input streams. You will need to provide
  * a callback function to read the bytes from your storage, which can be
  * for example a file or a network socket.
@@ -43,9 +55,17 @@ struct pb_istream_s
 #ifndef PB_NO_ERRMSG
     const char *errmsg;
 #endif
+
+#ifdef PB_ENABLE_MALLOC
+    /* Allocator for pointer fields, NULL for pb_realloc()/pb_free().
+     * Substreams inherit it from the parent stream. */
+    pb_allocator_t *allocator;
+#endif
 };
 
-#ifndef PB_NO_ERRMSG
+#if !defined(PB_NO_ERRMSG) && defined(PB_ENABLE_MALLOC)
+#define PB_ISTREAM_EMPTY {0,0,0,0,0}
+#elif !defined(PB_NO_ERRMSG) || defined(PB_ENABLE_MALLOC)
 #define PB_ISTREAM_EMPTY {0,0,0,0}
 #else
 #define PB_ISTREAM_EMPTY {0,0,0}
@@ -101,6 +121,26 @@ bool pb_decode(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_stru
 #define PB_DECODE_NULLTERMINATED  0x04U
 bool pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags);
 
+/* Decode a sequence of length-delimited messages of the same type, as written
+ * by repeated pb_encode_delimited() calls, into an array of structures.
+ *
+ * Decoding stops when the stream is exhausted or max_count messages have been
+ * read. *count is set to the number of completely decoded structures, also
+ * when an error is returned. Defaults are computed once for the first
+ * structure and copied to the following ones unless the message contains
+ * callback or extension fields, which the caller must initialize in every
+ * element as for pb_decode().
+ *
+ * Example usage:
+ *    MyMessage msgs[16];
+ *    size_t count;
+ *    pb_istream_t stream = pb_istream_from_buffer(buffer, length);
+ *    pb_decode_many(&stream, MyMessage_fields, msgs, sizeof(MyMessage), 16, &count);
+ */
+bool pb_decode_many(pb_istream_t *stream, const pb_msgdesc_t *fields,
+                    void *dest_array, size_t struct_size,
+                    size_t max_count, size_t *count);
+
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
 #define pb_decode_noinit(s,f,d) pb_decode_ex(s,f,d, PB_DECODE_NOINIT)
 #define pb_decode_delimited(s,f,d) pb_decode_ex(s,f,d, PB_DECODE_DELIMITED)
@@ -111,14 +151,159 @@ bool pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_s
 /* Release any allocated pointer fields. If you use dynamic allocation, you should
  * call this for any successfully decoded message when you are done with it. If
  * pb_decode() returns with an error, the message is already released.
+ * This frees with pb_free(), except for pointers into an arena (see
+ * pb_arena_t), which are left alone. Use pb_release_ex() for messages decoded
+ * with other stream allocators.
  */
 void pb_release(const pb_msgdesc_t *fields, void *dest_struct);
+
+/* Release a message that was decoded with the given allocator. */
+void pb_release_ex(const pb_msgdesc_t *fields, void *dest_struct, pb_allocator_t *allocator);
+
+/* Maximum number of arena buffers recorded at the same time. */
+#ifndef PB_ARENA_MAX_COUNT
+#define PB_ARENA_MAX_COUNT 4
+#endif
+
+/* Bump-pointer allocator over a caller supplied buffer. Allocations are
+ * never freed individually; pb_arena_reset() reclaims all of them at once,
+ * e.g. after a batch of messages has been processed. Releasing an
+ * arena-backed message is a no-op, both with pb_release_ex(fields, msg,
+ * &arena.allocator) and with plain pb_release().
+ *
+ * For that, pb_arena_init() records the buffer's address range, replacing
+ * any recorded range it overlaps. It returns false if PB_ARENA_MAX_COUNT
+ * ranges are already recorded; the arena then has no space and decoding
+ * with it fails. pb_arena_deinit() forgets the range, and must be called
+ * before the buffer is freed or reused for anything but another arena.
+ * Recording is not thread safe: set up arenas before other threads decode.
+ *
+ * Example usage:
+ *    static pb_byte_t memory[4096];
+ *    pb_arena_t arena;
+ *    pb_arena_init(&arena, memory, sizeof(memory));
+ *    stream.allocator = &arena.allocator;
+ */
+typedef struct pb_arena_s pb_arena_t;
+struct pb_arena_s {
+    pb_allocator_t allocator;
+    pb_byte_t *buffer;
+    size_t size;
+    size_t used;
+    void *last;         /* Most recent block, can be resized in place */
+    size_t allocations; /* Successful realloc calls since the last reset */
+};
+
+bool pb_arena_init(pb_arena_t *arena, void *buffer, size_t size);
+void pb_arena_reset(pb_arena_t *arena);
+void pb_arena_deinit(pb_arena_t *arena);
 #else
 /* Allocation is not supported, so release is no-op */
 #define pb_release(fields, dest_struct) PB_UNUSED(fields); PB_UNUSED(dest_struct);
+#define pb_release_ex(fields, dest_struct, allocator) PB_UNUSED(fields); PB_UNUSED(dest_struct); PB_UNUSED(allocator);
 #endif
 
 
+/***********************************
+ * Incremental (resumable) decoding *
+ ***********************************/
+
+/* Maximum submessage nesting handled by the incremental decoder. */
+#ifndef PB_INCREMENTAL_MAX_DEPTH
+#define PB_INCREMENTAL_MAX_DEPTH 8
+#endif
+
+/* Size of the buffer that holds a field value split across two feeds.
+ * Submessages and skipped unknown fields are streamed and are not limited
+ * by this; only a single scalar, string, bytes or packed array value that
+ * straddles a feed boundary must fit. pb_decode_ctx_t holds two of them. */
+#ifndef PB_INCREMENTAL_FIELD_SIZE
+#define PB_INCREMENTAL_FIELD_SIZE 64
+#endif
+
+/* Decoding state of one (sub)message. Used internally by pb_decode() as
+ * well, and stored in pb_decode_ctx_t for each open submessage. */
+typedef struct pb_decode_frame_s pb_decode_frame_t;
+struct pb_decode_frame_s {
+    pb_field_iter_t iter;
+    size_t end; /* Input position where this message ends */
+    pb_extension_t *extensions;
+    uint32_t extension_range_start;
+    pb_size_t fixed_count_field;
+    pb_size_t fixed_count_size;
+    pb_size_t fixed_count_total_size;
+    uint32_t fields_seen[(PB_MAX_REQUIRED_FIELDS + 31) / 32];
+};
+
+typedef enum {
+    PB_DECODE_NEED_MORE = 0, /* All input consumed, message not finished yet */
+    PB_DECODE_COMPLETE = 1,  /* Message fully decoded */
+    PB_DECODE_ERROR = 2      /* Decoding failed, see PB_GET_ERROR(ctx) */
+} pb_decode_status_t;
+
+/* Resumable decoder context. Treat as opaque and set up with
+ * pb_decode_incremental_init(). */
+typedef struct pb_decode_ctx_s pb_decode_ctx_t;
+struct pb_decode_ctx_s {
+    pb_decode_frame_t frames[PB_INCREMENTAL_MAX_DEPTH];
+    pb_size_t depth;
+    uint_least8_t state;
+    uint_least8_t action;
+    uint_least8_t varint_bytes;
+    unsigned int flags;
+    size_t position;
+    uint32_t varint;
+    uint32_t tag;
+    pb_wire_type_t wire_type;
+    size_t remaining;
+    size_t field_len;
+    uint_least8_t field_buf_index;
+    /* Used in turn, so that a view into the last split value stays valid
+     * while the next one is collected */
+    pb_byte_t field_buf[2][PB_INCREMENTAL_FIELD_SIZE];
+#ifndef PB_NO_ERRMSG
+    const char *errmsg;
+#endif
+#ifdef PB_ENABLE_MALLOC
+    pb_allocator_t *allocator; /* As in pb_istream_t, set after init */
+#endif
+};
+
+/* Prepare ctx for decoding one message into dest_struct. Supported flags
+ * are PB_DECODE_NOINIT, PB_DECODE_DELIMITED and PB_DECODE_NULLTERMINATED
+ * with the same meaning as for pb_decode_ex(). Callback fields must be set
+ * up by the caller beforehand, as for pb_decode().
+ */
+void pb_decode_incremental_init(pb_decode_ctx_t *ctx, const pb_msgdesc_t *fields,
+                                void *dest_struct, unsigned int flags);
+
+/* Feed the next count bytes of input, for example whatever recv() returned.
+ * Partial varints, fields and open submessages are kept in ctx between calls.
+ * *consumed is set to the number of bytes used; on PB_DECODE_COMPLETE any
+ * remaining bytes belong to the next message.
+ *
+ * PB_LTYPE_VIEW fields point into buf, or into ctx if the value was split
+ * across calls, so they are only valid until the next call.
+ *
+ * Without PB_DECODE_DELIMITED or PB_DECODE_NULLTERMINATED the end of the
+ * message is not visible in the data, so call pb_decode_incremental_finish()
+ * once the input has ended.
+ *
+ * Example usage:
+ *    pb_decode_ctx_t ctx;
+ *    pb_decode_incremental_init(&ctx, MyMessage_fields, &msg, PB_DECODE_DELIMITED);
+ *    while ((count = recv(sock, buf, sizeof(buf), 0)) > 0) {
+ *        status = pb_decode_incremental(&ctx, buf, count, &used);
+ *        ...
+ *    }
+ */
+pb_decode_status_t pb_decode_incremental(pb_decode_ctx_t *ctx, const pb_byte_t *buf,
+                                         size_t count, size_t *consumed);
+
+/* Signal the end of input. Returns PB_DECODE_COMPLETE if the input ended on
+ * a message boundary and all required fields were present. */
+pb_decode_status_t pb_decode_incremental_finish(pb_decode_ctx_t *ctx);
+
 /**************************************
  * Functions for manipulating streams *
  **************************************/
@@ -36,6 +36,7 @@ static bool checkreturn pb_enc_bytes(pb_ostream_t *stream, const pb_field_iter_t
 static bool checkreturn pb_enc_string(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_submessage(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_fixed_length_bytes(pb_ostream_t *stream, const pb_field_iter_t *field);
+static bool checkreturn pb_enc_view(pb_ostream_t *stream, const pb_field_iter_t *field);
 
 #ifdef PB_WITHOUT_64BIT
 #define pb_int64_t int32_t
@@ -307,6 +308,10 @@ static bool checkreturn pb_check_proto3_default_value(const pb_field_iter_t *fie
              * it anyway. */
             return field->data_size == 0;
         }
+        else if (PB_LTYPE(type) == PB_LTYPE_VIEW)
+        {
+            return ((const pb_view_t*)field->pData)->size == 0;
+        }
         else if (PB_LTYPE_IS_SUBMSG(type))
         {
             /* Check all fields in the submessage to find if any of them
@@ -394,6 +399,9 @@ static bool checkreturn encode_basic_field(pb_ostream_t *stream, const pb_field_
         case PB_LTYPE_FIXED_LENGTH_BYTES:
             return pb_enc_fixed_length_bytes(stream, field);
 
+        case PB_LTYPE_VIEW:
+            return pb_enc_view(stream, field);
+
         default:
             PB_RETURN_ERROR(stream, "invalid field type");
     }
@@ -689,6 +697,7 @@ bool pb_encode_tag_for_field ( pb_ostream_t* stream, const pb_field_iter_t* fiel
         case PB_LTYPE_SUBMESSAGE:
         case PB_LTYPE_SUBMSG_W_CB:
         case PB_LTYPE_FIXED_LENGTH_BYTES:
+        case PB_LTYPE_VIEW:
             wiretype = PB_WT_STRING;
             break;
         
@@ -937,6 +946,16 @@ static bool checkreturn pb_enc_fixed_length_bytes(pb_ostream_t *stream, const pb
     return pb_encode_string(stream, (const pb_byte_t*)field->pData, (size_t)field->data_size);
 }
 
+static bool checkreturn pb_enc_view(pb_ostream_t *stream, const pb_field_iter_t *field)
+{
+    const pb_view_t *view = (const pb_view_t*)field->pData;
+
+    if (view->bytes == NULL && view->size > 0)
+        PB_RETURN_ERROR(stream, "invalid view");
+
+    return pb_encode_string(stream, view->bytes, view->size);
+}
+
 #ifdef PB_CONVERT_DOUBLE_FLOAT
 bool pb_encode_float_as_double(pb_ostream_t *stream, float value)
 {
@@ -9,7 +9,7 @@ namespace util {
 bool PbStreamCallback(pb_ostream_t* stream, const pb_byte_t* buf,
                       size_t count) {
   return reinterpret_cast<util::Stream<uint8_t>*>(stream->state)
-      ->WriteBuffer(buf, count);
+             ->WriteBuffer(buf, count) == static_cast<int>(count);
 }
 
 pb_ostream_t WrapStream(util::Stream<uint8_t>* stream) {
@@ -0,0 +1,79 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace util {
+
+// Fixed-capacity lock-free queue for exactly one producer thread and one
+// consumer thread. `kCapacity` must be a power of two. Elements are copied in
+// and out, so `T` should be a small trivially copyable value.
+//
+// Each index is written by only one side: the producer advances `tail_` with
+// a release store after filling the slot, and the consumer advances `head_`
+// with a release store after copying the slot out. A full queue rejects the
+// push and counts an overflow rather than blocking the producer.
+template <typename T, uint32_t kCapacity>
+class SpscQueue {
+ public:
+  static_assert(kCapacity > 0 && (kCapacity & (kCapacity - 1)) == 0,
+                "kCapacity must be a power of two");
+
+  // Producer side. Copies `value` into the queue. Returns false, and counts
+  // an overflow, if the queue is full.
+  bool Push(const T& value) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+      overflows_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots_[tail & (kCapacity - 1)] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Moves the oldest element into `value`. Returns false if
+  // the queue is empty.
+  bool Pop(T* value) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *value = slots_[head & (kCapacity - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Discards every element queued so far.
+  void Clear() {
+    head_.store(tail_.load(std::memory_order_acquire),
+                std::memory_order_release);
+  }
+
+  // Number of elements queued. Exact only when called from the producer or
+  // consumer while the other side is idle; otherwise a snapshot.
+  uint32_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  // Number of pushes rejected because the queue was full. May be read from
+  // either side.
+  uint32_t overflows() const {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Free-running indices; only their difference and low bits are used, so
+  // wrap-around at 2^32 is harmless.
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> overflows_{0};
+  T slots_[kCapacity];
+};
+
+}  // namespace util
+
+#endif  // SPSC_QUEUE_H_
@@ -1,6 +1,9 @@
 #ifndef STREAM_H_
 #define STREAM_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <iostream>
 
 namespace util {
@@ -8,16 +11,14 @@ namespace util {
 template <typename T>
 class Stream {
  public:
-  virtual bool Write(const T& token) = 0;
-  int WriteBuffer(const T* buffer, int count) {
-    int written = 0;
-    for (; written < count; ++written) {
-      if (!Write(*buffer++)) {
-        return written;
-      }
-    }
-    return count;
-  }
+  // Writes up to `count` tokens from `buffer` to the stream. Returns the number
+  // of tokens accepted; a short count indicates an error. This is the primary
+  // write path; stages should forward whole runs downstream in as few calls as
+  // possible.
+  virtual int WriteBuffer(const T* buffer, int count) = 0;
+
+  // Writes a single token. Built on `WriteBuffer`.
+  bool Write(const T& token) { return WriteBuffer(&token, 1) == 1; }
 
   void RegisterDownstream(Stream<T>* stream) { stream_ = stream; }
 
@@ -32,9 +33,9 @@ class OstreamAdapter : public Stream<uint8_t> {
  public:
   OstreamAdapter(std::ostream* ostream) : ostream_(ostream) {}
 
-  bool Write(const uint8_t& token) final {
-    ostream_->put(token);
-    return true;
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    ostream_->write(reinterpret_cast<const char*>(buffer), count);
+    return ostream_->good() ? count : 0;
   }
 
  private:
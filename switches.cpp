@@ -8,6 +8,24 @@ namespace jog_controller {
 namespace {
 Switches* switches_instance_ = nullptr;
 
+// MCP23017 IOCON register address with IOCON.BANK = 0, as expected by the
+// Adafruit driver.
+constexpr uint8_t kIoconBank0Register = 0x0a;
+// IOCON with IOCON.BANK = 1. With BANK = 0 the same address is GPINTENB, which
+// the Adafruit setup rewrites anyway.
+constexpr uint8_t kIoconBank1Register = 0x05;
+// IOCON.BANK, plus IOCON.ODR to keep the interrupt outputs open drain.
+constexpr uint8_t kIoconBank1OpenDrain = 0x84;
+
+// With IOCON.BANK = 1 each port's registers are contiguous: INTF, INTCAP and
+// GPIO of port A start at 0x07, and port B's are 0x10 above.
+constexpr uint8_t kIntfaRegister = 0x07;
+constexpr uint8_t kPortRegisterStride = 0x10;
+constexpr int kPortReadSize = 3;
+
+constexpr int kPortA = 0;
+constexpr int kPortB = 1;
+
 constexpr int kLedPin = 0;
 constexpr int kFeedholdPin = 6;
 constexpr int kEstopPin = 7;
@@ -18,6 +36,14 @@ constexpr int kAxisFieldOffset = 8;
 constexpr int kMultiplierFieldSize = 2;
 constexpr int kMultiplierFieldOffset = 14;
 
+void WriteRegister(TwoWire* wire, uint8_t address, uint8_t reg,
+                   uint8_t value) {
+  wire->beginTransmission(address);
+  wire->write(reg);
+  wire->write(value);
+  wire->endTransmission();
+}
+
 int ExtractAxisIndex(uint16_t mask) {
   uint8_t axis_mask =
       util::GetField<uint16_t>(mask, kAxisFieldSize, kAxisFieldOffset);
@@ -36,15 +62,29 @@ int ExtractMultiplierIndex(uint16_t mask) {
 
 }  // namespace
 
-void Switches::Isr() {
+void Switches::Isr(int port) {
   if (key_handler_ == nullptr || rotary_switch_handler_ == nullptr) {
     return;
   }
 
-  ++interrupt_triggered_;
+  // The line stays asserted until the port is read, so a second falling edge
+  // before the read was submitted means an interrupt was missed; keep the
+  // earlier timestamp.
+  Port& state = ports_[port];
+  if (state.pending.load(std::memory_order_relaxed)) {
+    coalesced_interrupts_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    state.interrupt_us = micros();
+    state.pending.store(true, std::memory_order_release);
+  }
+
+  if (interrupt_handler_ != nullptr) {
+    interrupt_handler_();
+  }
 }
 
-void Switches::StaticIsr() { switches_instance_->Isr(); }
+void Switches::StaticIsrA() { switches_instance_->Isr(kPortA); }
+void Switches::StaticIsrB() { switches_instance_->Isr(kPortB); }
 
 void Switches::SetLedState(bool state) {
   io_expander_.digitalWrite(kLedPin, state ? LOW : HIGH);
@@ -52,12 +92,19 @@ void Switches::SetLedState(bool state) {
 
 void Switches::Begin() {
   switches_instance_ = this;
-  io_expander_.begin(0, bus_);
+
+  // An ESP32-only reset leaves the expander powered and in IOCON.BANK = 1 from
+  // the previous boot. Return it to BANK = 0 before the Adafruit driver
+  // touches any register.
+  TwoWire* wire = bus_->wire();
+  WriteRegister(wire, device_.address, kIoconBank1Register, 0x00);
+
+  io_expander_.begin(device_.address & 0x07, wire);
 
   pinMode(interrupt_a_pin_, INPUT_PULLUP);
   pinMode(interrupt_b_pin_, INPUT_PULLUP);
-  attachInterrupt(interrupt_a_pin_, &Switches::StaticIsr, FALLING);
-  attachInterrupt(interrupt_b_pin_, &Switches::StaticIsr, FALLING);
+  attachInterrupt(interrupt_a_pin_, &Switches::StaticIsrA, FALLING);
+  attachInterrupt(interrupt_b_pin_, &Switches::StaticIsrB, FALLING);
 
   io_expander_.pinMode(kLedPin, OUTPUT);
   SetLedState(true);
@@ -70,15 +117,102 @@ void Switches::Begin() {
 
   // Don't mirror, open drain, low active state for IOA, IOB
   io_expander_.setupInterrupts(false, true, LOW);
+
+  WriteRegister(wire, device_.address, kIoconBank0Register,
+                kIoconBank1OpenDrain);
+
+  // Read both ports once, which also clears an interrupt left asserted from
+  // before boot.
+  for (Port& port : ports_) {
+    port.interrupt_us = micros();
+    port.pending.store(true, std::memory_order_release);
+  }
 }
 
 void Switches::Poll() {
-  if (interrupt_triggered_ == interrupt_triggered_follow_) {
-    return;
+  for (int port = 0; port < kNumPorts; ++port) {
+    if (ports_[port].read_ready.load(std::memory_order_acquire)) {
+      DispatchPort(port);
+      ports_[port].read_ready.store(false, std::memory_order_relaxed);
+    }
   }
 
-  uint16_t mask = io_expander_.readGPIOAB();
+  for (int port = 0; port < kNumPorts; ++port) {
+    if (ports_[port].pending.load(std::memory_order_acquire) &&
+        !ports_[port].read_in_flight.load(std::memory_order_acquire)) {
+      SubmitRead(port);
+    }
+  }
+}
 
+void Switches::SubmitRead(int port) {
+  Port& state = ports_[port];
+  uint8_t intf_register = kIntfaRegister + port * kPortRegisterStride;
+
+  I2cBus::Transaction read;
+  read.device = &device_;
+  read.callback = &Switches::StaticOnRead;
+  read.context = this;
+  read.tag = port;
+  read.Add(&intf_register, 1, kPortReadSize);
+
+  // Take the timestamp before clearing `pending` so that an interrupt after
+  // this point, which the read may or may not capture, is read again.
+  state.capture_us = state.interrupt_us;
+  state.pending.store(false, std::memory_order_relaxed);
+  state.read_in_flight.store(true, std::memory_order_relaxed);
+  if (!bus_->Submit(read)) {
+    state.read_in_flight.store(false, std::memory_order_relaxed);
+    state.pending.store(true, std::memory_order_relaxed);
+  }
+}
+
+void Switches::StaticOnRead(void* switches, const I2cBus::Transaction& read) {
+  static_cast<Switches*>(switches)->OnRead(read);
+}
+
+void Switches::OnRead(const I2cBus::Transaction& read) {
+  Port& state = ports_[read.tag];
+  if (read.ok) {
+    const I2cBus::Operation& operation = read.operations[0];
+    state.flags = operation.read[0];
+    state.captured = operation.read[1];
+    state.live = operation.read[2];
+    state.read_us = micros();
+    state.read_ready.store(true, std::memory_order_release);
+  } else {
+    // The interrupt is still asserted and will not fire again; retry.
+    state.pending.store(true, std::memory_order_release);
+  }
+  state.read_in_flight.store(false, std::memory_order_release);
+}
+
+void Switches::DispatchPort(int port) {
+  const Port& state = ports_[port];
+  int shift = port * 8;
+  uint16_t port_mask = 0xff << shift;
+
+  // INTCAP only holds a capture if the port flagged an interrupt.
+  if (state.flags != 0) {
+    event_time_us_ = state.capture_us;
+    port_state_ = (port_state_ & ~port_mask) | (state.captured << shift);
+    DispatchSwitches(port_state_);
+  }
+
+  // Changes while the interrupt was asserted raise no new interrupt, so catch
+  // up with the live state, stamped with the time of the read.
+  uint16_t live_state = (port_state_ & ~port_mask) | (state.live << shift);
+  if (live_state != port_state_) {
+    if (state.flags != 0) {
+      coalesced_interrupts_.fetch_add(1, std::memory_order_relaxed);
+    }
+    event_time_us_ = state.read_us;
+    port_state_ = live_state;
+    DispatchSwitches(port_state_);
+  }
+}
+
+void Switches::DispatchSwitches(uint16_t mask) {
   int axis_index = ExtractAxisIndex(mask);
   int multiplier_index = ExtractMultiplierIndex(mask);
 
@@ -106,8 +240,6 @@ void Switches::Poll() {
                  current_feedhold_ ? KeyState::kReleased : KeyState::kPressed);
     current_feedhold_ = feedhold;
   }
-
-  ++interrupt_triggered_follow_;
 }
 
 }  // namespace jog_controller
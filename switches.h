@@ -2,7 +2,11 @@
 #define SWITCHES_H_
 
 #include <Adafruit_MCP23017.h>
+#include <stdint.h>
 
+#include <atomic>
+
+#include "i2c_bus.h"
 #include "keypad.h"
 
 namespace jog_controller {
@@ -16,14 +20,23 @@ class Switches {
 
   using RotarySwitchHandler = void (*)(RotarySwitch, int);
 
-  Switches(TwoWire* bus, uint8_t address, int interrupt_a_pin,
+  // The MCP23017 supports fast-mode plus I2C.
+  static constexpr uint32_t kMaxFrequency = 1000000;
+
+  // The switches are read at high priority so that an E-stop change is never
+  // queued behind a keypad scan.
+  Switches(I2cBus* bus, uint8_t address, int interrupt_a_pin,
            int interrupt_b_pin)
-      : bus_(bus),
-        address_(address),
-        interrupt_a_pin_(interrupt_a_pin),
+      : interrupt_a_pin_(interrupt_a_pin),
         interrupt_b_pin_(interrupt_b_pin),
-        interrupt_triggered_(0), interrupt_triggered_follow_(0) {}
-
+        bus_(bus),
+        device_{address, I2cBus::Priority::kHigh, kMaxFrequency} {}
+
+  // Configures the MCP23017 and its interrupts, then switches it to
+  // IOCON.BANK = 1 so that each port's INTF, INTCAP and GPIO registers can be
+  // read in one burst. Talks to the expander directly, so it must be called
+  // before the bus task is started. The first Poll reads both ports to learn
+  // the initial switch positions.
   void Begin();
 
   void RegisterRotarySwitchHandler(RotarySwitchHandler handler) {
@@ -32,9 +45,42 @@ class Switches {
   void RegisterKeyHandler(Keypad::KeyHandler handler) {
     key_handler_ = handler;
   }
+  // Registers a handler that is called from interrupt context whenever either
+  // interrupt line fires.
+  void RegisterInterruptHandler(Keypad::InterruptHandler handler) {
+    interrupt_handler_ = handler;
+  }
 
+  // Invokes the handlers for any change in the last completed port reads.
+  // Then, for each port whose interrupt line fired and that has no read in
+  // flight, submits a read of that port's INTF, INTCAP and GPIO registers.
+  // Never waits for the bus.
   void Poll();
 
+  // Time of the interrupt for the transition being dispatched, in micros().
+  // Only meaningful inside the handlers.
+  uint32_t event_time_us() const { return event_time_us_; }
+
+  // True from an interrupt on either port until the read it triggered has
+  // been dispatched by Poll.
+  bool InputPending() const {
+    for (const Port& port : ports_) {
+      if (port.pending.load(std::memory_order_acquire) ||
+          port.read_in_flight.load(std::memory_order_acquire) ||
+          port.read_ready.load(std::memory_order_acquire)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Interrupts merged into an earlier one before it was read: either the line
+  // fired again before the read was submitted, or the port changed again while
+  // its interrupt was asserted. May be read from any task.
+  uint32_t coalesced_interrupts() const { return coalesced_interrupts_.load(); }
+
+  // Goes through the Adafruit driver, which assumes IOCON.BANK = 0, so this is
+  // only valid inside Begin before the bank switch.
   void SetLedState(bool state);
 
  private:
@@ -42,20 +88,58 @@ class Switches {
 
   RotarySwitchHandler rotary_switch_handler_;
   Keypad::KeyHandler key_handler_;
+  Keypad::InterruptHandler interrupt_handler_ = nullptr;
+
+  static constexpr int kNumPorts = 2;
+
+  // Interrupt and read state of one MCP23017 port.
+  struct Port {
+    // Set by the ISR with the time of the falling edge on the port's
+    // interrupt line; cleared when a read is submitted.
+    std::atomic<bool> pending{false};
+    volatile uint32_t interrupt_us = 0;
+    // Time of the interrupt the in-flight read will capture.
+    uint32_t capture_us = 0;
+
+    // Handoff from the bus task, valid once `read_ready` is set.
+    std::atomic<bool> read_in_flight{false};
+    std::atomic<bool> read_ready{false};
+    uint8_t flags = 0;
+    uint8_t captured = 0;
+    uint8_t live = 0;
+    uint32_t read_us = 0;
+  };
 
   int interrupt_a_pin_;
   int interrupt_b_pin_;
-  uint8_t interrupt_triggered_;
-  uint8_t interrupt_triggered_follow_;
-  TwoWire* bus_;
-  uint8_t address_;
+  I2cBus* bus_;
+  I2cBus::Device device_;
+
+  Port ports_[kNumPorts];
+  std::atomic<uint32_t> coalesced_interrupts_{0};
+
+  // Last dispatched state, GPIOA in the low byte and GPIOB in the high byte.
+  uint16_t port_state_ = 0;
+  uint32_t event_time_us_ = 0;
   int current_axis_index_ = 0;
   int current_multiplier_index_ = 0;
   bool current_feedhold_ = false;
   bool current_estop_ = false;
 
-  static void StaticIsr();
-  void Isr();
+  static void StaticIsrA();
+  static void StaticIsrB();
+  void Isr(int port);
+
+  void SubmitRead(int port);
+  static void StaticOnRead(void* switches, const I2cBus::Transaction& read);
+  void OnRead(const I2cBus::Transaction& read);
+
+  // Dispatches the captured and then the live state of a completed read.
+  void DispatchPort(int port);
+
+  // Invokes the handlers for every switch whose position in the port state
+  // `mask` differs from the last one seen.
+  void DispatchSwitches(uint16_t mask);
 };
 
 }  // namespace jog_controller
@@ -0,0 +1,324 @@
+// Decodes messages with pointer fields into a pb_arena_t and with libc malloc,
+// and checks that both decode the same, that pb_release() and pb_release_ex()
+// leave arena blocks alone, that a full arena fails decoding cleanly and how
+// pb_arena_init() records and forgets buffers. Reports allocator calls and
+// decode-and-release time per message for both.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+// A message with pointer fields, bound by hand the way the generator would.
+struct Entry {
+  char* text;
+  pb_bytes_array_t* data;
+  uint32_t stamp;
+};
+
+struct Log {
+  char* name;
+  pb_size_t values_count;
+  int32_t* values;
+  pb_size_t entries_count;
+  Entry* entries;
+};
+
+#define Entry_FIELDLIST(X, a)                 \
+  X(a, POINTER, OPTIONAL, STRING, text, 1)    \
+  X(a, POINTER, OPTIONAL, BYTES, data, 2)     \
+  X(a, STATIC, REQUIRED, UINT32, stamp, 3)
+#define Entry_CALLBACK NULL
+#define Entry_DEFAULT NULL
+
+#define Log_FIELDLIST(X, a)                     \
+  X(a, POINTER, OPTIONAL, STRING, name, 1)      \
+  X(a, POINTER, REPEATED, SINT32, values, 2)    \
+  X(a, POINTER, REPEATED, MESSAGE, entries, 3)
+#define Log_CALLBACK NULL
+#define Log_DEFAULT NULL
+#define Log_entries_MSGTYPE Entry
+
+extern const pb_msgdesc_t Entry_msg;
+extern const pb_msgdesc_t Log_msg;
+#define Entry_fields &Entry_msg
+#define Log_fields &Log_msg
+
+PB_BIND(Entry, Entry, AUTO)
+PB_BIND(Log, Log, AUTO)
+
+namespace {
+
+constexpr size_t kLogMaxSize = 4096;
+constexpr size_t kArenaSize = 64 * 1024;
+
+// libc malloc behind a stream allocator, counting the calls.
+struct CountingAllocator {
+  pb_allocator_t allocator;
+  size_t reallocs;
+  size_t frees;
+};
+
+void* CountingRealloc(pb_allocator_t* allocator, void* ptr, size_t size) {
+  ++reinterpret_cast<CountingAllocator*>(allocator)->reallocs;
+  return realloc(ptr, size);
+}
+
+void CountingFree(pb_allocator_t* allocator, void* ptr) {
+  ++reinterpret_cast<CountingAllocator*>(allocator)->frees;
+  free(ptr);
+}
+
+// The storage behind the pointers of an encoded Log.
+struct LogSource {
+  std::string name;
+  std::vector<int32_t> values;
+  std::vector<std::string> texts;
+  std::vector<std::vector<uint8_t>> data;
+  std::vector<Entry> entries;
+  Log log;
+};
+
+// A log of a few entries, each with a short text and some bytes: a
+// firmware-update manifest or an event dump rather than jog traffic.
+void RandomLog(test::Random* random, LogSource* source) {
+  source->name.assign(1 + random->Uniform(20), 'n');
+  source->values.resize(random->Uniform(32));
+  for (int32_t& value : source->values) {
+    value = static_cast<int32_t>(random->Next());
+  }
+  size_t entries = random->Uniform(8);
+  source->texts.resize(entries);
+  source->data.resize(entries);
+  source->entries.resize(entries);
+  for (size_t i = 0; i < entries; ++i) {
+    source->texts[i].assign(random->Uniform(40), 't');
+    source->data[i].resize(sizeof(pb_size_t) + random->Uniform(64));
+    random->Fill(source->data[i].data() + sizeof(pb_size_t),
+                 source->data[i].size() - sizeof(pb_size_t));
+    pb_bytes_array_t* bytes =
+        reinterpret_cast<pb_bytes_array_t*>(source->data[i].data());
+    bytes->size =
+        static_cast<pb_size_t>(source->data[i].size() - sizeof(pb_size_t));
+    source->entries[i].text =
+        random->Uniform(4) == 0 ? nullptr : &source->texts[i][0];
+    source->entries[i].data = random->Uniform(4) == 0 ? nullptr : bytes;
+    source->entries[i].stamp = static_cast<uint32_t>(random->Next());
+  }
+  source->log.name = &source->name[0];
+  source->log.values_count = static_cast<pb_size_t>(source->values.size());
+  source->log.values = source->values.data();
+  source->log.entries_count = static_cast<pb_size_t>(entries);
+  source->log.entries = source->entries.data();
+}
+
+std::vector<uint8_t> Encode(const Log& log) {
+  uint8_t buffer[kLogMaxSize];
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  CHECK(pb_encode(&stream, Log_fields, &log));
+  return std::vector<uint8_t>(buffer, buffer + stream.bytes_written);
+}
+
+bool Decode(const std::vector<uint8_t>& input, pb_allocator_t* allocator,
+            Log* log) {
+  pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+  stream.allocator = allocator;
+  return pb_decode(&stream, Log_fields, log);
+}
+
+bool InBuffer(const void* ptr, const uint8_t* buffer, size_t size) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t start = reinterpret_cast<uintptr_t>(buffer);
+  return address >= start && address < start + size;
+}
+
+// Decodes random logs both ways and releases them. Plain pb_release() on an
+// arena-backed log would hand arena addresses to free() if it did not skip
+// them, which aborts.
+void TestDecoding(int trials) {
+  static uint8_t memory[kArenaSize];
+  pb_arena_t arena;
+  CHECK(pb_arena_init(&arena, memory, sizeof(memory)));
+  CountingAllocator counting = {{&CountingRealloc, &CountingFree}, 0, 0};
+
+  test::Random random(109);
+  for (int trial = 0; trial < trials; ++trial) {
+    LogSource source;
+    RandomLog(&random, &source);
+    std::vector<uint8_t> input = Encode(source.log);
+
+    Log from_malloc = {};
+    CHECK(Decode(input, &counting.allocator, &from_malloc));
+    Log from_arena = {};
+    CHECK(Decode(input, &arena.allocator, &from_arena));
+    CHECK(Encode(from_malloc) == input);
+    CHECK(Encode(from_arena) == input);
+    CHECK(InBuffer(from_arena.name, memory, sizeof(memory)));
+
+    pb_release_ex(Log_fields, &from_malloc, &counting.allocator);
+    CHECK(from_malloc.name == nullptr && from_malloc.values_count == 0);
+
+    if (trial % 2 == 0) {
+      // A no-op: the arena owns the memory.
+      pb_release_ex(Log_fields, &from_arena, &arena.allocator);
+      CHECK(Encode(from_arena) == input);
+    } else {
+      pb_release(Log_fields, &from_arena);
+      CHECK(from_arena.name == nullptr && from_arena.values_count == 0 &&
+            from_arena.entries == nullptr);
+    }
+    pb_arena_reset(&arena);
+  }
+  CHECK(counting.frees > 0 && counting.frees <= counting.reallocs);
+
+  // Plain pb_release() still frees what malloc allocated, also next to
+  // arena blocks.
+  LogSource source;
+  RandomLog(&random, &source);
+  Log log = {};
+  CHECK(Decode(Encode(source.log), &arena.allocator, &log));
+  log.name = static_cast<char*>(malloc(8));
+  pb_release(Log_fields, &log);
+  CHECK(log.name == nullptr);
+  pb_arena_deinit(&arena);
+}
+
+// A log that does not fit fails to decode, and is released through the
+// arena's allocator on the way out.
+void TestFullArena() {
+  test::Random random(113);
+  LogSource source;
+  do {
+    RandomLog(&random, &source);
+  } while (source.log.entries_count < 4);
+  std::vector<uint8_t> input = Encode(source.log);
+
+  static uint8_t memory[kArenaSize];
+  for (size_t size = 0; size < 512; size += 8) {
+    pb_arena_t arena;
+    CHECK(pb_arena_init(&arena, memory, size));
+    Log log = {};
+    pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+    stream.allocator = &arena.allocator;
+    if (!pb_decode(&stream, Log_fields, &log)) {
+      CHECK(strcmp(PB_GET_ERROR(&stream), "realloc failed") == 0);
+      CHECK(arena.used <= arena.size);
+    } else {
+      CHECK(Encode(log) == input);
+    }
+    pb_release(Log_fields, &log);
+    pb_arena_deinit(&arena);
+  }
+}
+
+void TestRecording() {
+  static uint8_t memory[PB_ARENA_MAX_COUNT + 1][256];
+  pb_arena_t arenas[PB_ARENA_MAX_COUNT + 1];
+  for (int i = 0; i < PB_ARENA_MAX_COUNT; ++i) {
+    CHECK(pb_arena_init(&arenas[i], memory[i], sizeof(memory[i])));
+  }
+
+  // No range is left: the arena gets no space.
+  pb_arena_t& extra = arenas[PB_ARENA_MAX_COUNT];
+  CHECK(!pb_arena_init(&extra, memory[PB_ARENA_MAX_COUNT],
+                       sizeof(memory[PB_ARENA_MAX_COUNT])));
+  CHECK(extra.size == 0);
+  CHECK(extra.allocator.realloc(&extra.allocator, nullptr, 1) == nullptr);
+
+  // Initializing a recorded buffer again, or part of it, replaces its range.
+  CHECK(pb_arena_init(&arenas[0], memory[0], sizeof(memory[0])));
+  CHECK(pb_arena_init(&arenas[1], memory[1] + 64, 64));
+  // An empty buffer takes no range.
+  pb_arena_t empty;
+  CHECK(pb_arena_init(&empty, nullptr, 0));
+
+  pb_arena_deinit(&arenas[2]);
+  CHECK(arenas[2].size == 0);
+  CHECK(pb_arena_init(&extra, memory[PB_ARENA_MAX_COUNT],
+                      sizeof(memory[PB_ARENA_MAX_COUNT])));
+  CHECK(extra.allocator.realloc(&extra.allocator, nullptr, 1) != nullptr);
+
+  for (pb_arena_t& arena : arenas) {
+    pb_arena_deinit(&arena);
+  }
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(127);
+  std::vector<std::vector<uint8_t>> inputs;
+  size_t bytes = 0;
+  for (int i = 0; i < 1000; ++i) {
+    LogSource source;
+    RandomLog(&random, &source);
+    inputs.push_back(Encode(source.log));
+    bytes += inputs.back().size();
+  }
+  double messages = static_cast<double>(inputs.size()) * repetitions;
+
+  CountingAllocator counting = {{&CountingRealloc, &CountingFree}, 0, 0};
+  static uint8_t memory[kArenaSize];
+  pb_arena_t arena;
+  CHECK(pb_arena_init(&arena, memory, sizeof(memory)));
+  size_t arena_blocks = 0;
+  for (const std::vector<uint8_t>& input : inputs) {
+    Log log = {};
+    CHECK(Decode(input, &counting.allocator, &log));
+    pb_release_ex(Log_fields, &log, &counting.allocator);
+    CHECK(Decode(input, &arena.allocator, &log));
+    arena_blocks += arena.allocations;
+    pb_arena_reset(&arena);
+  }
+
+  // libc directly, as pb_realloc() and pb_free().
+  uint64_t start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    for (const std::vector<uint8_t>& input : inputs) {
+      Log log = {};
+      CHECK(Decode(input, nullptr, &log));
+      test::DoNotOptimize(log);
+      pb_release(Log_fields, &log);
+    }
+  }
+  double malloc_ns = (test::NowNs() - start) / messages;
+
+  start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    for (const std::vector<uint8_t>& input : inputs) {
+      Log log = {};
+      CHECK(Decode(input, &arena.allocator, &log));
+      test::DoNotOptimize(log);
+      pb_release(Log_fields, &log);
+      pb_arena_reset(&arena);
+    }
+  }
+  double arena_ns = (test::NowNs() - start) / messages;
+  pb_arena_deinit(&arena);
+
+  printf("%.0f-byte logs: malloc %.1f reallocs + %.1f frees, %6.1f ns "
+         "(%.0f MB/s); arena %.1f blocks, no libc calls, %6.1f ns "
+         "(%.0f MB/s)\n",
+         static_cast<double>(bytes) / inputs.size(),
+         static_cast<double>(counting.reallocs) / inputs.size(),
+         static_cast<double>(counting.frees) / inputs.size(), malloc_ns,
+         bytes * repetitions / (malloc_ns * messages) * 1e3,
+         static_cast<double>(arena_blocks) / inputs.size(), arena_ns,
+         bytes * repetitions / (arena_ns * messages) * 1e3);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const bool full = test::FullRun(argc, argv);
+  TestRecording();
+  TestFullArena();
+  TestDecoding(full ? 100000 : 5000);
+  Benchmark(full ? 500 : 20);
+  return 0;
+}
@@ -0,0 +1,190 @@
+// Checks Base64DecodeStream against the encoder for random messages split at
+// random points, its handling of padding and bad input, and its throughput.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base64_stream.h"
+#include "stream.h"
+#include "test_util.h"
+
+namespace {
+
+// Collects decoded bytes. Fails every write after `capacity` bytes if set.
+class CollectingSink : public util::Stream<uint8_t> {
+ public:
+  explicit CollectingSink(size_t capacity = SIZE_MAX) : capacity_(capacity) {}
+
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    if (data_.size() + count > capacity_) {
+      return 0;
+    }
+    data_.insert(data_.end(), buffer, buffer + count);
+    return count;
+  }
+
+  std::vector<uint8_t>& data() { return data_; }
+
+ private:
+  size_t capacity_;
+  std::vector<uint8_t> data_;
+};
+
+// Decodes `input` in one write followed by a flush. Returns false if either
+// fails.
+bool Decode(const std::string& input, std::vector<uint8_t>* output) {
+  util::Base64DecodeStream decoder;
+  CollectingSink sink;
+  decoder.RegisterDownstream(&sink);
+  int count = static_cast<int>(input.size());
+  bool ok = decoder.WriteBuffer(
+                reinterpret_cast<const uint8_t*>(input.data()), count) ==
+                count &&
+            decoder.Flush();
+  *output = sink.data();
+  return ok;
+}
+
+void TestRoundTrip() {
+  test::Random random(3);
+  for (int trial = 0; trial < 20000; ++trial) {
+    std::vector<uint8_t> message(random.Uniform(300));
+    random.Fill(message.data(), message.size());
+    std::vector<uint8_t> encoded(util::Base64EncodedSize(message.size()));
+    int encoded_size = util::Base64Encode(message.data(), message.size(),
+                                          encoded.data());
+
+    util::Base64DecodeStream decoder;
+    CollectingSink sink;
+    decoder.RegisterDownstream(&sink);
+    int position = 0;
+    while (position < encoded_size) {
+      int chunk = 1 + random.Uniform(encoded_size - position);
+      CHECK(decoder.WriteBuffer(encoded.data() + position, chunk) == chunk);
+      position += chunk;
+    }
+    CHECK(decoder.Flush());
+    CHECK(sink.data() == message);
+
+    // The bulk decoder accepts the same input and produces the same bytes.
+    std::vector<uint8_t> bulk(encoded_size / 4 * 3);
+    CHECK(util::Base64Decode(encoded.data(), encoded_size, bulk.data()) ==
+          static_cast<int>(message.size()));
+    CHECK(memcmp(bulk.data(), message.data(), message.size()) == 0);
+  }
+}
+
+void TestPadding() {
+  std::vector<uint8_t> output;
+  CHECK(Decode("QQ==", &output) && output == std::vector<uint8_t>{'A'});
+  CHECK(Decode("QUI=", &output) &&
+        output == (std::vector<uint8_t>{'A', 'B'}));
+  CHECK(Decode("QUJD", &output) &&
+        output == (std::vector<uint8_t>{'A', 'B', 'C'}));
+
+  CHECK(!Decode("Q===", &output));
+  CHECK(!Decode("====", &output));
+  CHECK(!Decode("QQ=A", &output));
+  CHECK(!Decode("QQ==QUJD", &output));
+}
+
+void TestRejects() {
+  std::vector<uint8_t> output;
+  CHECK(!Decode("QU*D", &output));
+  CHECK(!Decode("QUJD\n", &output));
+  // Incomplete quanta are only rejected at Flush.
+  CHECK(!Decode("QUJ", &output));
+
+  // Errors persist until Reset.
+  util::Base64DecodeStream decoder;
+  CollectingSink sink;
+  decoder.RegisterDownstream(&sink);
+  const uint8_t bad[] = {'Q', '*', 'J', 'D'};
+  CHECK(decoder.WriteBuffer(bad, 4) == 1);
+  CHECK(decoder.error());
+  const uint8_t good[] = {'Q', 'U', 'J', 'D'};
+  CHECK(decoder.WriteBuffer(good, 4) == 0);
+  decoder.Reset();
+  CHECK(decoder.WriteBuffer(good, 4) == 4);
+  CHECK(decoder.Flush());
+}
+
+void TestAcceptedCount() {
+  util::Base64DecodeStream decoder;
+  CollectingSink sink(0);
+  decoder.RegisterDownstream(&sink);
+  const uint8_t input[] = {'Q', 'U', 'J', 'D'};
+
+  // Nothing written is nothing accepted, even with a failing downstream.
+  CHECK(decoder.WriteBuffer(input, 0) == 0);
+
+  // When downstream fails, every character whose output was lost is
+  // reported as not accepted.
+  CHECK(decoder.WriteBuffer(input, 4) == 0);
+  CHECK(decoder.error());
+
+  // A long write that fails after earlier drains succeeded reports the
+  // characters drained so far.
+  test::Random random(5);
+  std::vector<uint8_t> message(3000);
+  random.Fill(message.data(), message.size());
+  std::vector<uint8_t> encoded(util::Base64EncodedSize(message.size()));
+  int encoded_size =
+      util::Base64Encode(message.data(), message.size(), encoded.data());
+  util::Base64DecodeStream limited;
+  CollectingSink limited_sink(1000);
+  limited.RegisterDownstream(&limited_sink);
+  int accepted = limited.WriteBuffer(encoded.data(), encoded_size);
+  CHECK(accepted > 0 && accepted < encoded_size);
+  CHECK(static_cast<size_t>(accepted / 4 * 3) == limited_sink.data().size());
+}
+
+void BenchmarkThroughput(bool full) {
+  // Roughly one TCP segment per write.
+  constexpr int kChunk = 1460;
+  const int total = full ? 256 << 20 : 8 << 20;
+
+  std::vector<uint8_t> message(total / 4 * 3);
+  test::Random random(7);
+  random.Fill(message.data(), message.size());
+  std::vector<uint8_t> encoded(util::Base64EncodedSize(message.size()));
+  int encoded_size =
+      util::Base64Encode(message.data(), message.size(), encoded.data());
+
+  class NullSink : public util::Stream<uint8_t> {
+   public:
+    int WriteBuffer(const uint8_t* /*buffer*/, int count) final {
+      return count;
+    }
+  } sink;
+  util::Base64DecodeStream decoder;
+  decoder.RegisterDownstream(&sink);
+
+  uint64_t start = test::NowNs();
+  for (int position = 0; position < encoded_size; position += kChunk) {
+    int chunk = std::min(kChunk, encoded_size - position);
+    CHECK(decoder.WriteBuffer(encoded.data() + position, chunk) == chunk);
+  }
+  CHECK(decoder.Flush());
+  uint64_t elapsed = test::NowNs() - start;
+
+  printf("stream decode: %d MiB in %d-byte writes, %.1f MB/s\n",
+         encoded_size >> 20, kChunk,
+         encoded_size * 1e3 / static_cast<double>(elapsed));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestRoundTrip();
+  TestPadding();
+  TestRejects();
+  TestAcceptedCount();
+  BenchmarkThroughput(test::FullRun(argc, argv));
+  return 0;
+}
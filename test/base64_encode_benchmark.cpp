@@ -0,0 +1,208 @@
+// Compares the block encoder in Base64EncodeStream with the BitPipe encoder it
+// replaced: the output must be byte-identical for every length and write
+// split, and the block encoder is timed against it. Also checks that writes
+// retried after a downstream failure encode every byte exactly once.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "base64_stream.h"
+#include "bit_pipe.h"
+#include "stream.h"
+#include "test_util.h"
+
+namespace {
+
+const uint8_t kForwardLookup[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The previous encoder: pushes each byte into a BitPipe and pops 6-bit
+// indices one at a time, with the same staging and padding.
+class BitPipeEncodeStream : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    for (int i = 0; i < count; ++i) {
+      pipe_.Push(buffer[i], 8);
+      while (pipe_.size() >= 6) {
+        uint16_t index = 0;
+        if (!pipe_.Pop(6, &index) || !Stage(kForwardLookup[index])) {
+          return i;
+        }
+      }
+    }
+    return count;
+  }
+
+  bool Flush() {
+    uint16_t index = 0;
+    switch (pipe_.size()) {
+      case 0:
+        return Drain();
+      case 2:
+        return pipe_.Push(0, 4) && pipe_.Pop(6, &index) &&
+               Stage(kForwardLookup[index]) && Stage('=') && Stage('=') &&
+               Drain();
+      case 4:
+        return pipe_.Push(0, 2) && pipe_.Pop(6, &index) &&
+               Stage(kForwardLookup[index]) && Stage('=') && Drain();
+      default:
+        return false;
+    }
+  }
+
+ private:
+  static constexpr int kStagingSize = 64;
+
+  bool Stage(uint8_t character) {
+    if (staged_ == kStagingSize && !Drain()) {
+      return false;
+    }
+    staging_[staged_++] = character;
+    return true;
+  }
+
+  bool Drain() {
+    int count = staged_;
+    staged_ = 0;
+    return count == 0 || stream()->WriteBuffer(staging_, count) == count;
+  }
+
+  util::BitPipe<uint16_t> pipe_{util::ShiftDirection::kLeft};
+  uint8_t staging_[kStagingSize];
+  int staged_ = 0;
+};
+
+class CollectingSink : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    data_.insert(data_.end(), buffer, buffer + count);
+    return count;
+  }
+
+  std::vector<uint8_t>& data() { return data_; }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+// Records every write but reports some of them as failed, so that the bytes
+// an encoder claims to have accepted can be checked against what it emitted.
+class FailingSink : public util::Stream<uint8_t> {
+ public:
+  explicit FailingSink(test::Random* random) : random_(random) {}
+
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    data_.insert(data_.end(), buffer, buffer + count);
+    return random_->Uniform(3) == 0 ? 0 : count;
+  }
+
+  std::vector<uint8_t>& data() { return data_; }
+
+ private:
+  test::Random* random_;
+  std::vector<uint8_t> data_;
+};
+
+class NullSink : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* /*buffer*/, int count) final {
+    return count;
+  }
+};
+
+// Encodes `size` bytes with `encoder`, written in chunks of `chunk` bytes.
+template <typename Encoder>
+std::vector<uint8_t> Encode(const uint8_t* data, int size, int chunk) {
+  Encoder encoder;
+  CollectingSink sink;
+  encoder.RegisterDownstream(&sink);
+  for (int position = 0; position < size; position += chunk) {
+    int length = size - position < chunk ? size - position : chunk;
+    CHECK(encoder.WriteBuffer(data + position, length) == length);
+  }
+  CHECK(encoder.Flush());
+  return sink.data();
+}
+
+void TestIdenticalOutput() {
+  test::Random random(11);
+  uint8_t data[200];
+  for (int size = 0; size <= 200; ++size) {
+    random.Fill(data, size);
+    std::vector<uint8_t> reference =
+        Encode<BitPipeEncodeStream>(data, size, size > 0 ? size : 1);
+    CHECK(static_cast<int>(reference.size()) == util::Base64EncodedSize(size));
+    for (int chunk = 1; chunk <= size || chunk == 1; ++chunk) {
+      CHECK(Encode<util::Base64EncodeStream>(data, size, chunk) == reference);
+    }
+  }
+}
+
+// Writes in random chunks to a sink that fails now and then, retrying each
+// write from the count the encoder returned. Every input byte must be encoded
+// exactly once.
+void TestRetryAfterFailure() {
+  test::Random random(41);
+  std::vector<uint8_t> data(1000);
+  for (int trial = 0; trial < 2000; ++trial) {
+    int size = random.Uniform(data.size());
+    random.Fill(data.data(), size);
+    std::vector<uint8_t> expected(util::Base64EncodedSize(size));
+    util::Base64Encode(data.data(), size, expected.data());
+
+    util::Base64EncodeStream encoder;
+    FailingSink sink(&random);
+    encoder.RegisterDownstream(&sink);
+    for (int position = 0; position < size;) {
+      int length = 1 + random.Uniform(size - position < 80 ? size - position
+                                                           : 80);
+      int accepted = encoder.WriteBuffer(data.data() + position, length);
+      CHECK(accepted >= 0 && accepted <= length);
+      position += accepted;
+    }
+    while (!encoder.Flush()) {
+    }
+    CHECK(sink.data() == expected);
+  }
+}
+
+// Returns the time per input byte of encoding `frames` messages of `size`
+// bytes, each written in one call and flushed.
+template <typename Encoder>
+double TimeEncode(const uint8_t* data, int size, int frames) {
+  Encoder encoder;
+  NullSink sink;
+  encoder.RegisterDownstream(&sink);
+  uint64_t start = test::NowNs();
+  for (int frame = 0; frame < frames; ++frame) {
+    encoder.WriteBuffer(data, size);
+    encoder.Flush();
+  }
+  return static_cast<double>(test::NowNs() - start) /
+         (static_cast<double>(frames) * size);
+}
+
+void Benchmark(const uint8_t* data, int size, int frames) {
+  double bit_pipe = TimeEncode<BitPipeEncodeStream>(data, size, frames);
+  double block = TimeEncode<util::Base64EncodeStream>(data, size, frames);
+  printf("%7d-byte writes: bitpipe %6.2f ns/byte, block %6.2f ns/byte, "
+         "%.1fx\n",
+         size, bit_pipe, block, bit_pipe / block);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestIdenticalOutput();
+  TestRetryAfterFailure();
+
+  const int scale = test::FullRun(argc, argv) ? 20 : 1;
+  std::vector<uint8_t> data(1 << 20);
+  test::Random random(13);
+  random.Fill(data.data(), data.size());
+  Benchmark(data.data(), 32, 200000 * scale);
+  Benchmark(data.data(), data.size(), 8 * scale);
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Checks that the vectorized base64 functions match the scalar ones on valid
+// and corrupted input, and reports the throughput of both on multi-megabyte
+// buffers.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "base64_simd.h"
+#include "base64_stream.h"
+#include "test_util.h"
+
+namespace {
+
+const char* LevelName(util::Base64SimdLevel level) {
+  switch (level) {
+    case util::Base64SimdLevel::kScalar:
+      return "scalar";
+    case util::Base64SimdLevel::kSse41:
+      return "SSE4.1";
+    case util::Base64SimdLevel::kAvx2:
+      return "AVX2";
+  }
+  return "unknown";
+}
+
+// Compares the scalar and vector decoders on `count` characters. Output
+// buffers get a guard region so that overruns are caught.
+void CheckDecode(const uint8_t* in, int count) {
+  constexpr int kGuard = 64;
+  std::vector<uint8_t> scalar(count / 4 * 3 + kGuard, 0xa5);
+  std::vector<uint8_t> simd(count / 4 * 3 + kGuard, 0xa5);
+  int scalar_size = util::Base64Decode(in, count, scalar.data());
+  int simd_size = util::Base64DecodeSimd(in, count, simd.data());
+  CHECK(scalar_size == simd_size);
+  if (scalar_size >= 0) {
+    CHECK(memcmp(scalar.data(), simd.data(), scalar_size) == 0);
+  }
+  for (size_t i = count / 4 * 3; i < simd.size(); ++i) {
+    CHECK(simd[i] == 0xa5);
+  }
+}
+
+void TestEquivalence() {
+  test::Random random(17);
+  const uint8_t kSpecial[] = {'=', '*', '\n', 0, 0x80, 'A', '/', '+'};
+  for (int trial = 0; trial < 20000; ++trial) {
+    int size = random.Uniform(trial < 1000 ? 200 : 4096);
+    std::vector<uint8_t> data(size);
+    random.Fill(data.data(), size);
+
+    std::vector<uint8_t> scalar(util::Base64EncodedSize(size));
+    std::vector<uint8_t> simd(util::Base64EncodedSize(size));
+    int encoded = util::Base64Encode(data.data(), size, scalar.data());
+    CHECK(util::Base64EncodeSimd(data.data(), size, simd.data()) == encoded);
+    CHECK(scalar == simd);
+    CheckDecode(scalar.data(), encoded);
+
+    // Corrupt a few characters, or truncate, so that acceptance is compared
+    // too.
+    if (encoded > 0) {
+      int corruptions = random.Uniform(3);
+      for (int i = 0; i < corruptions; ++i) {
+        scalar[random.Uniform(encoded)] =
+            kSpecial[random.Uniform(sizeof(kSpecial))];
+      }
+      CheckDecode(scalar.data(), encoded);
+      CheckDecode(scalar.data(), random.Uniform(encoded));
+    }
+  }
+}
+
+// Returns the throughput in GB/s of `function` over `count` input bytes.
+template <typename Function>
+double Throughput(Function function, const uint8_t* in, int count,
+                  uint8_t* out, int repetitions) {
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    test::DoNotOptimize(function(in, count, out));
+  }
+  return static_cast<double>(count) * repetitions /
+         static_cast<double>(test::NowNs() - start);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestEquivalence();
+
+  const bool full = test::FullRun(argc, argv);
+  const int size = (full ? 64 : 8) << 20;
+  const int repetitions = full ? 20 : 3;
+  std::vector<uint8_t> data(size);
+  test::Random random(19);
+  random.Fill(data.data(), size);
+  std::vector<uint8_t> encoded(util::Base64EncodedSize(size));
+  int encoded_size = util::Base64Encode(data.data(), size, encoded.data());
+  std::vector<uint8_t> decoded(size);
+
+  printf("vector level: %s, %d MiB buffers\n",
+         LevelName(util::Base64DetectSimdLevel()), size >> 20);
+  printf("encode: scalar %5.2f GB/s, simd %5.2f GB/s\n",
+         Throughput(util::Base64Encode, data.data(), size, encoded.data(),
+                    repetitions),
+         Throughput(util::Base64EncodeSimd, data.data(), size,
+                    encoded.data(), repetitions));
+  printf("decode: scalar %5.2f GB/s, simd %5.2f GB/s\n",
+         Throughput(util::Base64Decode, encoded.data(), encoded_size,
+                    decoded.data(), repetitions),
+         Throughput(util::Base64DecodeSimd, encoded.data(), encoded_size,
+                    decoded.data(), repetitions));
+  CHECK(memcmp(decoded.data(), data.data(), size) == 0);
+  return 0;
+}
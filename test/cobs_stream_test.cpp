@@ -0,0 +1,357 @@
+// Round-trip and edge-case tests for CobsEncodeStream, and a comparison of
+// COBS and base64 framing of Control messages: wire bytes and encode time per
+// frame, through the same FrameStream pipeline the firmware uses.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "base64_stream.h"
+#include "cobs_stream.h"
+#include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "frame_stream.h"
+#include "stream.h"
+#include "test_util.h"
+
+namespace {
+
+class CollectingSink : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    data_.insert(data_.end(), buffer, buffer + count);
+    return count;
+  }
+
+  std::vector<uint8_t>& data() { return data_; }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+// Records every write but reports some of them as failed, so that the bytes
+// an encoder claims to have accepted can be checked against what it emitted.
+class FailingSink : public util::Stream<uint8_t> {
+ public:
+  explicit FailingSink(test::Random* random) : random_(random) {}
+
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    data_.insert(data_.end(), buffer, buffer + count);
+    return failing_ && random_->Uniform(3) == 0 ? 0 : count;
+  }
+
+  void set_failing(bool failing) { failing_ = failing; }
+  std::vector<uint8_t>& data() { return data_; }
+
+ private:
+  test::Random* random_;
+  bool failing_ = true;
+  std::vector<uint8_t> data_;
+};
+
+// Counts the bytes written without keeping them.
+class CountingSink : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* /*buffer*/, int count) final {
+    bytes_ += count;
+    return count;
+  }
+
+  uint64_t bytes() const { return bytes_; }
+
+ private:
+  uint64_t bytes_ = 0;
+};
+
+// Reference decoder for one frame, including its zero delimiter. Returns false
+// if the frame is malformed.
+bool CobsDecode(const std::vector<uint8_t>& frame, std::vector<uint8_t>* out) {
+  out->clear();
+  if (frame.empty() || frame.back() != 0) {
+    return false;
+  }
+  size_t end = frame.size() - 1;
+  size_t i = 0;
+  while (i < end) {
+    int code = frame[i++];
+    if (code == 0 || i + code - 1 > end) {
+      return false;
+    }
+    for (int j = 1; j < code; ++j) {
+      if (frame[i] == 0) {
+        return false;
+      }
+      out->push_back(frame[i++]);
+    }
+    // A full block carries no implicit zero, and neither does the last one.
+    if (code != 0xff && i < end) {
+      out->push_back(0);
+    }
+  }
+  return true;
+}
+
+// Encodes `data` as one frame, written in chunks of `chunk` bytes.
+std::vector<uint8_t> Encode(const std::vector<uint8_t>& data, size_t chunk) {
+  util::CobsEncodeStream encoder;
+  CollectingSink sink;
+  encoder.RegisterDownstream(&sink);
+  for (size_t position = 0; position < data.size(); position += chunk) {
+    int length = data.size() - position < chunk ? data.size() - position
+                                                : chunk;
+    CHECK(encoder.WriteBuffer(data.data() + position, length) == length);
+  }
+  CHECK(encoder.Flush());
+  return sink.data();
+}
+
+// Checks the framing invariants and the round trip for `data`, written whole
+// and split at random.
+void CheckRoundTrip(const std::vector<uint8_t>& data, test::Random* random) {
+  std::vector<uint8_t> frame = Encode(data, data.empty() ? 1 : data.size());
+  CHECK(static_cast<int>(frame.size()) <= util::CobsEncodedSize(data.size()));
+  for (size_t i = 0; i + 1 < frame.size(); ++i) {
+    CHECK(frame[i] != 0);
+  }
+  std::vector<uint8_t> decoded;
+  CHECK(CobsDecode(frame, &decoded));
+  CHECK(decoded == data);
+  CHECK(Encode(data, 1) == frame);
+  CHECK(Encode(data, 1 + random->Uniform(300)) == frame);
+}
+
+void TestKnownVectors() {
+  struct Vector {
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+  };
+  std::vector<uint8_t> run_254;
+  for (int i = 1; i <= 254; ++i) {
+    run_254.push_back(i);
+  }
+
+  std::vector<Vector> vectors = {
+      {{}, {0x01, 0x00}},
+      {{0x00}, {0x01, 0x01, 0x00}},
+      {{0x00, 0x00}, {0x01, 0x01, 0x01, 0x00}},
+      {{0x00, 0x11, 0x00}, {0x01, 0x02, 0x11, 0x01, 0x00}},
+      {{0x11, 0x22, 0x00, 0x33}, {0x03, 0x11, 0x22, 0x02, 0x33, 0x00}},
+      {{0x11, 0x22, 0x33, 0x44}, {0x05, 0x11, 0x22, 0x33, 0x44, 0x00}},
+      {{0x11, 0x00, 0x00, 0x00}, {0x02, 0x11, 0x01, 0x01, 0x01, 0x00}},
+  };
+
+  // 01..fe: exactly one full block, with no trailing empty block.
+  Vector full{run_254, {0xff}};
+  full.out.insert(full.out.end(), run_254.begin(), run_254.end());
+  full.out.push_back(0x00);
+  vectors.push_back(full);
+
+  // 00 01..fe: an empty block, then a full one.
+  Vector leading_zero{{0x00}, {0x01, 0xff}};
+  leading_zero.in.insert(leading_zero.in.end(), run_254.begin(), run_254.end());
+  leading_zero.out.insert(leading_zero.out.end(), run_254.begin(),
+                          run_254.end());
+  leading_zero.out.push_back(0x00);
+  vectors.push_back(leading_zero);
+
+  // 01..fe ff: a full block, then the 255th byte in a block of its own.
+  Vector overflow{run_254, {0xff}};
+  overflow.in.push_back(0xff);
+  overflow.out.insert(overflow.out.end(), run_254.begin(), run_254.end());
+  overflow.out.insert(overflow.out.end(), {0x02, 0xff, 0x00});
+  vectors.push_back(overflow);
+
+  // 01..fe 00: a zero straight after a full block starts an empty block.
+  Vector trailing_zero{run_254, {0xff}};
+  trailing_zero.in.push_back(0x00);
+  trailing_zero.out.insert(trailing_zero.out.end(), run_254.begin(),
+                           run_254.end());
+  trailing_zero.out.insert(trailing_zero.out.end(), {0x01, 0x01, 0x00});
+  vectors.push_back(trailing_zero);
+
+  for (const Vector& vector : vectors) {
+    CHECK(Encode(vector.in, vector.in.empty() ? 1 : vector.in.size()) ==
+          vector.out);
+    CHECK(Encode(vector.in, 1) == vector.out);
+  }
+}
+
+void TestEdgeCases() {
+  test::Random random(43);
+  std::vector<uint8_t> data;
+
+  // Runs of non-zero bytes around multiples of the 254-byte block.
+  for (int length : {253, 254, 255, 507, 508, 509, 762}) {
+    data.assign(length, 0);
+    for (uint8_t& byte : data) {
+      byte = 1 + random.Uniform(255);
+    }
+    CheckRoundTrip(data, &random);
+    data.push_back(0);
+    CheckRoundTrip(data, &random);
+  }
+
+  // All zeros: one code byte each, plus the final empty block.
+  for (int length = 1; length <= 600; ++length) {
+    data.assign(length, 0);
+    std::vector<uint8_t> frame = Encode(data, length);
+    CHECK(static_cast<int>(frame.size()) == length + 2);
+    CheckRoundTrip(data, &random);
+  }
+
+  // The encoder starts a fresh frame after each Flush, including one that
+  // ended on a full block.
+  util::CobsEncodeStream encoder;
+  CollectingSink sink;
+  encoder.RegisterDownstream(&sink);
+  std::vector<uint8_t> first(254, 0x5a);
+  std::vector<uint8_t> second = {0x00, 0x7e};
+  CHECK(encoder.WriteBuffer(first.data(), first.size()) == 254);
+  CHECK(encoder.Flush());
+  CHECK(encoder.WriteBuffer(second.data(), second.size()) == 2);
+  CHECK(encoder.Flush());
+  std::vector<uint8_t> expected = Encode(first, first.size());
+  std::vector<uint8_t> second_frame = Encode(second, second.size());
+  expected.insert(expected.end(), second_frame.begin(), second_frame.end());
+  CHECK(sink.data() == expected);
+}
+
+void TestRandom() {
+  test::Random random(47);
+  std::vector<uint8_t> data;
+  for (int trial = 0; trial < 5000; ++trial) {
+    data.resize(random.Uniform(1200));
+    // From all zeros to a zero every few hundred bytes.
+    uint32_t zero_in = 1 + random.Uniform(300);
+    for (uint8_t& byte : data) {
+      byte = random.Uniform(zero_in) == 0 ? 0 : 1 + random.Uniform(255);
+    }
+    CheckRoundTrip(data, &random);
+  }
+}
+
+// Writes in random chunks to a sink that fails now and then, retrying each
+// write from the count the encoder returned. Every input byte must be encoded
+// exactly once.
+void TestRetryAfterFailure() {
+  test::Random random(59);
+  std::vector<uint8_t> data;
+  for (int trial = 0; trial < 2000; ++trial) {
+    data.resize(random.Uniform(1200));
+    uint32_t zero_in = 1 + random.Uniform(300);
+    for (uint8_t& byte : data) {
+      byte = random.Uniform(zero_in) == 0 ? 0 : 1 + random.Uniform(255);
+    }
+    std::vector<uint8_t> expected =
+        Encode(data, data.empty() ? 1 : data.size());
+
+    util::CobsEncodeStream encoder;
+    FailingSink sink(&random);
+    encoder.RegisterDownstream(&sink);
+    for (size_t position = 0; position < data.size();) {
+      size_t left = data.size() - position;
+      int length = 1 + random.Uniform(left < 300 ? left : 300);
+      int accepted = encoder.WriteBuffer(data.data() + position, length);
+      CHECK(accepted >= 0 && accepted <= length);
+      position += accepted;
+    }
+    sink.set_failing(false);
+    CHECK(encoder.Flush());
+    CHECK(sink.data() == expected);
+  }
+}
+
+// Jog traffic: mostly value-only frames, some with a key, the estimated
+// motion or an axis and multiplier change.
+Control JogControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = true;
+  control.value = static_cast<int32_t>(random->Uniform(20000)) - 10000;
+  switch (random->Uniform(8)) {
+    case 0:
+      control.has_key_pressed = true;
+      control.key_pressed = 1 << random->Uniform(16);
+      break;
+    case 1:
+      control.has_velocity = true;
+      control.velocity = static_cast<int32_t>(random->Uniform(4000)) - 2000;
+      control.has_acceleration = true;
+      control.acceleration =
+          static_cast<int32_t>(random->Uniform(40000)) - 20000;
+      break;
+    case 2:
+      control.has_axis = true;
+      control.axis = static_cast<Control_Axis>(random->Uniform(
+          _Control_Axis_MAX + 1));
+      control.has_multiplier = true;
+      control.multiplier = static_cast<Control_Multiplier>(random->Uniform(
+          _Control_Multiplier_MAX + 1));
+      break;
+  }
+  return control;
+}
+
+struct FramingCost {
+  double bytes_per_frame;
+  double ns_per_frame;
+};
+
+// Frames every message the way WriteControl does: encode into a frame buffer
+// and send it downstream in one write.
+template <typename Encoder, typename Frame>
+FramingCost MeasureFraming(const std::vector<std::vector<uint8_t>>& messages,
+                           Encoder* encoder, Frame* frame, int repetitions) {
+  CountingSink sink;
+  frame->RegisterDownstream(&sink);
+  encoder->RegisterDownstream(frame);
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    for (const std::vector<uint8_t>& message : messages) {
+      frame->Begin();
+      encoder->WriteBuffer(message.data(), message.size());
+      encoder->Flush();
+      CHECK(frame->End());
+    }
+  }
+  double frames = static_cast<double>(messages.size()) * repetitions;
+  return {sink.bytes() / frames,
+          static_cast<double>(test::NowNs() - start) / frames};
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(53);
+  std::vector<std::vector<uint8_t>> messages;
+  for (int i = 0; i < 1000; ++i) {
+    Control control = JogControl(&random);
+    uint8_t buffer[Control_size];
+    size_t size = 0;
+    CHECK(Control_encode_direct(&control, buffer, &size));
+    messages.emplace_back(buffer, buffer + size);
+  }
+
+  util::Base64EncodeStream base64;
+  util::FrameStream<1 + util::Base64EncodedSize(Control_size) + 3>
+      base64_frame{"^", "$\r\n"};
+  util::CobsEncodeStream cobs;
+  util::FrameStream<util::CobsEncodedSize(Control_size)> cobs_frame{"", ""};
+  FramingCost base64_cost =
+      MeasureFraming(messages, &base64, &base64_frame, repetitions);
+  FramingCost cobs_cost =
+      MeasureFraming(messages, &cobs, &cobs_frame, repetitions);
+  printf("jog frames: base64 %5.2f bytes %6.1f ns, COBS %5.2f bytes %6.1f "
+         "ns\n",
+         base64_cost.bytes_per_frame, base64_cost.ns_per_frame,
+         cobs_cost.bytes_per_frame, cobs_cost.ns_per_frame);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestKnownVectors();
+  TestEdgeCases();
+  TestRandom();
+  TestRetryAfterFailure();
+  Benchmark(test::FullRun(argc, argv) ? 2000 : 100);
+  return 0;
+}
@@ -0,0 +1,25 @@
+# Runs each binary in the comma-separated BINARIES and fails unless they all
+# succeed and print the same "digest:" line, for tests that are built once per
+# configuration and must give identical results in all of them.
+#
+#   cmake -DBINARIES=a,b -P compare_digests.cmake
+
+string(REPLACE "," ";" binaries "${BINARIES}")
+set(expected "")
+foreach(binary IN LISTS binaries)
+  execute_process(COMMAND ${binary} OUTPUT_VARIABLE output
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${binary} failed: ${result}\n${output}")
+  endif()
+  string(REGEX MATCH "digest: [0-9a-f]+" digest "${output}")
+  if(digest STREQUAL "")
+    message(FATAL_ERROR "${binary} printed no digest")
+  endif()
+  message(STATUS "${binary}: ${digest}")
+  if(expected STREQUAL "")
+    set(expected "${digest}")
+  elseif(NOT digest STREQUAL expected)
+    message(FATAL_ERROR "${binary}: ${digest}, expected ${expected}")
+  endif()
+endforeach()
@@ -0,0 +1,272 @@
+// Replays a synthetic jog trace through the changed-fields frame mode the way
+// SelectFields does, and merges the frames on the host side with
+// MergeControl: the merged state must match the controller's after every
+// frame, and again after the next snapshot when frames are dropped. Also
+// reports wire bytes and encode time per frame against the whole-Control
+// snapshot mode.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "control_state.h"
+#include "test_util.h"
+
+namespace {
+
+using jog_controller::ControlIsEmpty;
+using jog_controller::DiffControl;
+using jog_controller::MergeControl;
+
+// Loop iterations between snapshots, as kSnapshotIntervalMs is to the loop
+// period.
+constexpr int kSnapshotInterval = 100;
+
+// The `control` of each loop iteration: the encoder value every time, and
+// switch and key changes now and then.
+std::vector<Control> MakeTrace(int iterations, test::Random* random) {
+  std::vector<Control> trace;
+  int32_t value = 0;
+  for (int i = 0; i < iterations; ++i) {
+    Control control = Control_init_default;
+    // Bursts of turning between pauses.
+    if ((i / 150) % 3 != 2) {
+      value += static_cast<int32_t>(random->Uniform(9)) - 3;
+    }
+    control.has_value = true;
+    control.value = value;
+
+    switch (random->Uniform(60)) {
+      case 0:
+        control.has_axis = true;
+        control.axis =
+            static_cast<Control_Axis>(random->Uniform(_Control_Axis_MAX + 1));
+        break;
+      case 1:
+        control.has_multiplier = true;
+        control.multiplier = static_cast<Control_Multiplier>(
+            random->Uniform(_Control_Multiplier_MAX + 1));
+        break;
+      case 2:
+        control.has_feedhold = true;
+        control.feedhold = random->Uniform(2);
+        break;
+      case 3:
+        control.has_estop = true;
+        control.estop = random->Uniform(2);
+        break;
+      case 4:
+        control.has_key_pressed = true;
+        control.key_pressed = 1 << random->Uniform(16);
+        break;
+      case 5:
+        control.has_key_released = true;
+        control.key_released = 1 << random->Uniform(16);
+        break;
+      case 6:
+        control.has_velocity = true;
+        control.velocity = static_cast<int32_t>(random->Uniform(4000)) - 2000;
+        control.has_acceleration = true;
+        control.acceleration =
+            static_cast<int32_t>(random->Uniform(40000)) - 20000;
+        break;
+    }
+    trace.push_back(control);
+  }
+  return trace;
+}
+
+// True if the stateful fields of `a` and `b` agree.
+bool SameState(const Control& a, const Control& b) {
+#define SAME_FIELD(name) \
+  (a.has_##name == b.has_##name && (!a.has_##name || a.name == b.name))
+  return SAME_FIELD(value) && SAME_FIELD(axis) && SAME_FIELD(multiplier) &&
+         SAME_FIELD(feedhold) && SAME_FIELD(estop) && SAME_FIELD(velocity) &&
+         SAME_FIELD(acceleration);
+#undef SAME_FIELD
+}
+
+size_t EncodedSize(const Control& control) {
+  uint8_t buffer[Control_size];
+  size_t size = 0;
+  CHECK(Control_encode_direct(&control, buffer, &size));
+  return size;
+}
+
+// Selects the changed-fields frame for `control` as SelectFields does.
+// Returns false if there is nothing to send.
+bool SelectChanged(const Control& control, const Control& current_state,
+                   bool snapshot, Control* sent_state, Control* wire) {
+  *wire = Control_init_default;
+  DiffControl(*sent_state, current_state, snapshot, wire);
+  wire->has_key_pressed = control.has_key_pressed;
+  wire->key_pressed = control.key_pressed;
+  wire->has_key_released = control.has_key_released;
+  wire->key_released = control.key_released;
+  if (ControlIsEmpty(*wire)) {
+    return false;
+  }
+  *sent_state = current_state;
+  return true;
+}
+
+// Replays `trace`, dropping frames before they reach the host with
+// probability 1 / `drop_in` (never if 0), and checks the host's merged state.
+void Replay(const std::vector<Control>& trace, uint32_t drop_in,
+            test::Random* random) {
+  Control current_state = Control_init_default;
+  Control sent_state = Control_init_default;
+  Control host_state = Control_init_default;
+  bool host_in_sync = true;
+  int frames = 0;
+  int resyncs = 0;
+  for (size_t i = 0; i < trace.size(); ++i) {
+    const Control& control = trace[i];
+    MergeControl(control, &current_state);
+    bool snapshot = i % kSnapshotInterval == 0;
+
+    Control wire;
+    if (!SelectChanged(control, current_state, snapshot, &sent_state,
+                       &wire)) {
+      CHECK(!snapshot);
+      continue;
+    }
+    ++frames;
+    if (drop_in != 0 && random->Uniform(drop_in) == 0) {
+      host_in_sync = false;
+      continue;
+    }
+
+    MergeControl(wire, &host_state);
+    // Key events are delivered with the frame of the iteration they
+    // happened in, whether or not the state changed.
+    CHECK(host_state.has_key_pressed == control.has_key_pressed);
+    CHECK(!control.has_key_pressed ||
+          host_state.key_pressed == control.key_pressed);
+    CHECK(host_state.has_key_released == control.has_key_released);
+    CHECK(!control.has_key_released ||
+          host_state.key_released == control.key_released);
+
+    if (snapshot && !host_in_sync) {
+      host_in_sync = true;
+      ++resyncs;
+    }
+    if (host_in_sync) {
+      CHECK(SameState(host_state, current_state));
+    }
+  }
+  CHECK(frames > 0);
+  CHECK(drop_in == 0 || resyncs > 0);
+}
+
+void TestMerge() {
+  // `position` resets the accumulated position and `value_delta` adds to it;
+  // event fields last for one update only.
+  Control state = Control_init_default;
+  Control update = Control_init_default;
+  update.has_position = true;
+  update.position = 1000;
+  update.has_key_pressed = true;
+  update.key_pressed = 4;
+  update.events_count = 1;
+  update.events[0].index = 3;
+  MergeControl(update, &state);
+  CHECK(state.has_position && state.position == 1000);
+  CHECK(state.has_key_pressed && state.key_pressed == 4);
+  CHECK(state.events_count == 1 && state.events[0].index == 3);
+
+  update = Control_init_default;
+  update.has_value_delta = true;
+  update.value_delta = -30;
+  MergeControl(update, &state);
+  MergeControl(update, &state);
+  CHECK(state.position == 940);
+  CHECK(!state.has_key_pressed);
+  CHECK(state.events_count == 0);
+
+  // A snapshot repeats every present stateful field; a diff only the changed
+  // ones.
+  Control reference = Control_init_default;
+  reference.has_value = true;
+  reference.value = 5;
+  reference.has_axis = true;
+  reference.axis = Control_Axis_AXIS_Z;
+  Control current = reference;
+  current.value = 6;
+  Control delta = Control_init_default;
+  DiffControl(reference, current, false, &delta);
+  CHECK(delta.has_value && delta.value == 6 && !delta.has_axis);
+  delta = Control_init_default;
+  DiffControl(reference, current, true, &delta);
+  CHECK(delta.has_value && delta.has_axis && delta.axis == Control_Axis_AXIS_Z);
+  delta = Control_init_default;
+  DiffControl(reference, reference, false, &delta);
+  CHECK(ControlIsEmpty(delta));
+}
+
+// Compares the two field modes on `trace`: wire bytes per frame and the time
+// to select and encode each frame.
+void Benchmark(const std::vector<Control>& trace, int repetitions) {
+  size_t snapshot_bytes = 0;
+  int snapshot_frames = 0;
+  size_t changed_bytes = 0;
+  int changed_frames = 0;
+
+  uint64_t start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    Control last_control = Control_init_default;
+    for (const Control& control : trace) {
+      if (memcmp(&control, &last_control, sizeof(Control)) == 0) {
+        continue;
+      }
+      last_control = control;
+      snapshot_bytes += EncodedSize(control);
+      ++snapshot_frames;
+    }
+  }
+  double snapshot_ns = (test::NowNs() - start) /
+                       static_cast<double>(snapshot_frames);
+
+  start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    Control current_state = Control_init_default;
+    Control sent_state = Control_init_default;
+    for (size_t i = 0; i < trace.size(); ++i) {
+      MergeControl(trace[i], &current_state);
+      Control wire;
+      if (SelectChanged(trace[i], current_state, i % kSnapshotInterval == 0,
+                        &sent_state, &wire)) {
+        changed_bytes += EncodedSize(wire);
+        ++changed_frames;
+      }
+    }
+  }
+  double changed_ns = (test::NowNs() - start) /
+                      static_cast<double>(changed_frames);
+
+  printf("%zu-iteration trace: snapshot %d frames, %.2f bytes, %.0f ns; "
+         "changed %d frames, %.2f bytes, %.0f ns\n",
+         trace.size(), snapshot_frames / repetitions,
+         static_cast<double>(snapshot_bytes) / snapshot_frames, snapshot_ns,
+         changed_frames / repetitions,
+         static_cast<double>(changed_bytes) / changed_frames, changed_ns);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestMerge();
+
+  test::Random random(71);
+  std::vector<Control> trace = MakeTrace(20000, &random);
+  Replay(trace, 0, &random);
+  Replay(trace, 20, &random);
+  Replay(trace, 3, &random);
+
+  Benchmark(trace, test::FullRun(argc, argv) ? 200 : 10);
+  return 0;
+}
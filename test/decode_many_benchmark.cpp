@@ -0,0 +1,146 @@
+// Compares pb_decode_many with a pb_decode_delimited loop on batches of
+// delimited Control messages: results must be identical, and messages/sec is
+// reported for batches of 1, 16 and 1024 messages.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "control_message.pb.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+namespace {
+
+Control RandomControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = random->Uniform(2);
+  control.value = static_cast<int32_t>(random->Next());
+  control.has_axis = random->Uniform(2);
+  control.axis = static_cast<Control_Axis>(random->Uniform(_Control_Axis_MAX));
+  control.has_key_pressed = random->Uniform(4) == 0;
+  control.key_pressed = random->Uniform(1 << 16);
+  control.has_velocity = random->Uniform(2);
+  control.velocity = static_cast<int32_t>(random->Next()) >> 8;
+  control.events_count = random->Uniform(3);
+  for (pb_size_t i = 0; i < control.events_count; ++i) {
+    control.events[i].time_us = static_cast<uint32_t>(random->Next());
+    control.events[i].source = InputEvent_Source_SOURCE_KEYPAD;
+    control.events[i].index = random->Uniform(16);
+    control.events[i].pressed = random->Uniform(2);
+  }
+  return control;
+}
+
+std::vector<uint8_t> EncodeBatch(int count, test::Random* random) {
+  std::vector<uint8_t> buffer(count * (Control_size + 2));
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer.data(), buffer.size());
+  for (int i = 0; i < count; ++i) {
+    Control control = RandomControl(random);
+    CHECK(pb_encode_delimited(&stream, Control_fields, &control));
+  }
+  buffer.resize(stream.bytes_written);
+  return buffer;
+}
+
+// Decodes with a pb_decode_delimited loop, the way callers did before.
+size_t DecodeLoop(const std::vector<uint8_t>& buffer, Control* controls,
+                  size_t max_count, bool* ok) {
+  pb_istream_t stream = pb_istream_from_buffer(buffer.data(), buffer.size());
+  size_t count = 0;
+  *ok = true;
+  while (stream.bytes_left > 0 && count < max_count) {
+    if (!pb_decode_delimited(&stream, Control_fields, &controls[count])) {
+      *ok = false;
+      break;
+    }
+    ++count;
+  }
+  return count;
+}
+
+size_t DecodeMany(const std::vector<uint8_t>& buffer, Control* controls,
+                  size_t max_count, bool* ok) {
+  pb_istream_t stream = pb_istream_from_buffer(buffer.data(), buffer.size());
+  size_t count = 0;
+  *ok = pb_decode_many(&stream, Control_fields, controls, sizeof(Control),
+                       max_count, &count);
+  return count;
+}
+
+// Compares by encoding, since array elements past a count and padding are
+// unspecified after decoding.
+bool SameControl(const Control& a, const Control& b) {
+  uint8_t a_bytes[Control_size];
+  uint8_t b_bytes[Control_size];
+  pb_ostream_t a_stream = pb_ostream_from_buffer(a_bytes, sizeof(a_bytes));
+  pb_ostream_t b_stream = pb_ostream_from_buffer(b_bytes, sizeof(b_bytes));
+  CHECK(pb_encode(&a_stream, Control_fields, &a));
+  CHECK(pb_encode(&b_stream, Control_fields, &b));
+  return a_stream.bytes_written == b_stream.bytes_written &&
+         memcmp(a_bytes, b_bytes, a_stream.bytes_written) == 0;
+}
+
+void TestEquivalence() {
+  test::Random random(29);
+  std::vector<Control> loop(64);
+  std::vector<Control> many(64);
+  for (int trial = 0; trial < 5000; ++trial) {
+    std::vector<uint8_t> buffer = EncodeBatch(random.Uniform(64), &random);
+    // Truncate or corrupt some batches.
+    if (!buffer.empty() && random.Uniform(3) == 0) {
+      if (random.Uniform(2) == 0) {
+        buffer.resize(random.Uniform(buffer.size()));
+      } else {
+        buffer[random.Uniform(buffer.size())] =
+            static_cast<uint8_t>(random.Next());
+      }
+    }
+
+    bool loop_ok = false;
+    bool many_ok = false;
+    size_t loop_count = DecodeLoop(buffer, loop.data(), loop.size(), &loop_ok);
+    size_t many_count = DecodeMany(buffer, many.data(), many.size(), &many_ok);
+    CHECK(loop_ok == many_ok);
+    CHECK(loop_count == many_count);
+    for (size_t i = 0; i < loop_count; ++i) {
+      CHECK(SameControl(loop[i], many[i]));
+    }
+  }
+}
+
+template <typename Decode>
+double MessagesPerSecond(Decode decode, const std::vector<uint8_t>& buffer,
+                         int batch, int repetitions) {
+  std::vector<Control> controls(batch);
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    bool ok = false;
+    CHECK(decode(buffer, controls.data(), batch, &ok) ==
+          static_cast<size_t>(batch));
+    CHECK(ok);
+  }
+  return static_cast<double>(batch) * repetitions * 1e9 /
+         static_cast<double>(test::NowNs() - start);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestEquivalence();
+
+  const int messages = test::FullRun(argc, argv) ? 20000000 : 500000;
+  test::Random random(31);
+  for (int batch : {1, 16, 1024}) {
+    std::vector<uint8_t> buffer = EncodeBatch(batch, &random);
+    int repetitions = messages / batch;
+    double loop = MessagesPerSecond(DecodeLoop, buffer, batch, repetitions);
+    double many = MessagesPerSecond(DecodeMany, buffer, batch, repetitions);
+    printf("batch %4d: loop %5.2f Mmsg/s, pb_decode_many %5.2f Mmsg/s\n",
+           batch, loop / 1e6, many / 1e6);
+  }
+  return 0;
+}
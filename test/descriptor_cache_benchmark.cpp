@@ -0,0 +1,291 @@
+// Decodes a flat message (Control) and a hand-bound nested message (Path:
+// optional and repeated submessages, a packed array and a string) and reports
+// the decode time. Built once per nanopb configuration: every build checks
+// that valid messages decode to exactly what was encoded, and prints a digest
+// of its results on valid, truncated and corrupted input, which
+// compare_digests.cmake requires to be identical across builds.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+// A nested message bound by hand, the way the generator would.
+struct Point {
+  int32_t x;
+  int32_t y;
+};
+
+struct Path {
+  bool has_name;
+  char name[16];
+  bool has_origin;
+  Point origin;
+  pb_size_t points_count;
+  Point points[8];
+  pb_size_t speeds_count;
+  uint32_t speeds[8];
+  bool has_closed;
+  bool closed;
+};
+
+#define Point_FIELDLIST(X, a)          \
+  X(a, STATIC, REQUIRED, SINT32, x, 1) \
+  X(a, STATIC, REQUIRED, SINT32, y, 2)
+#define Point_CALLBACK NULL
+#define Point_DEFAULT NULL
+
+#define Path_FIELDLIST(X, a)                   \
+  X(a, STATIC, OPTIONAL, STRING, name, 1)      \
+  X(a, STATIC, OPTIONAL, MESSAGE, origin, 2)   \
+  X(a, STATIC, REPEATED, MESSAGE, points, 3)   \
+  X(a, STATIC, REPEATED, UINT32, speeds, 4)    \
+  X(a, STATIC, OPTIONAL, BOOL, closed, 5)
+#define Path_CALLBACK NULL
+#define Path_DEFAULT NULL
+#define Path_origin_MSGTYPE Point
+#define Path_points_MSGTYPE Point
+
+extern const pb_msgdesc_t Point_msg;
+extern const pb_msgdesc_t Path_msg;
+#define Point_fields &Point_msg
+#define Path_fields &Path_msg
+
+PB_BIND(Point, Point, AUTO)
+PB_BIND(Path, Path, AUTO)
+
+namespace {
+
+constexpr size_t kPathMaxSize = 256;
+
+int32_t RandomInt(test::Random* random) {
+  switch (random->Uniform(3)) {
+    case 0:
+      return static_cast<int32_t>(random->Uniform(200)) - 100;
+    case 1:
+      return static_cast<int32_t>(random->Uniform(200000)) - 100000;
+    default:
+      return static_cast<int32_t>(random->Next());
+  }
+}
+
+Path RandomPath(test::Random* random) {
+  Path path = {};
+  path.has_name = random->Uniform(2);
+  int length = random->Uniform(sizeof(path.name));
+  for (int i = 0; i < length; ++i) {
+    path.name[i] = static_cast<char>('a' + random->Uniform(26));
+  }
+  path.has_origin = random->Uniform(2);
+  path.origin.x = RandomInt(random);
+  path.origin.y = RandomInt(random);
+  path.points_count = random->Uniform(pb_arraysize(Path, points) + 1);
+  for (pb_size_t i = 0; i < path.points_count; ++i) {
+    path.points[i].x = RandomInt(random);
+    path.points[i].y = RandomInt(random);
+  }
+  path.speeds_count = random->Uniform(pb_arraysize(Path, speeds) + 1);
+  for (pb_size_t i = 0; i < path.speeds_count; ++i) {
+    path.speeds[i] = static_cast<uint32_t>(RandomInt(random));
+  }
+  path.has_closed = random->Uniform(2);
+  path.closed = random->Uniform(2);
+  return path;
+}
+
+bool SamePoint(const Point& a, const Point& b) {
+  return a.x == b.x && a.y == b.y;
+}
+
+// Compares the fields that are present; absent fields decode to defaults.
+bool SamePath(const Path& a, const Path& b) {
+  if (a.has_name != b.has_name ||
+      (a.has_name && strcmp(a.name, b.name) != 0) ||
+      a.has_origin != b.has_origin ||
+      (a.has_origin && !SamePoint(a.origin, b.origin)) ||
+      a.points_count != b.points_count || a.speeds_count != b.speeds_count ||
+      a.has_closed != b.has_closed || (a.has_closed && a.closed != b.closed)) {
+    return false;
+  }
+  for (pb_size_t i = 0; i < a.points_count; ++i) {
+    if (!SamePoint(a.points[i], b.points[i])) {
+      return false;
+    }
+  }
+  return memcmp(a.speeds, b.speeds, a.speeds_count * sizeof(a.speeds[0])) ==
+         0;
+}
+
+Control RandomControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = true;
+  control.value = RandomInt(random);
+  control.has_axis = random->Uniform(2);
+  control.axis =
+      static_cast<Control_Axis>(random->Uniform(_Control_Axis_MAX + 1));
+  control.has_multiplier = random->Uniform(2);
+  control.multiplier = static_cast<Control_Multiplier>(
+      random->Uniform(_Control_Multiplier_MAX + 1));
+  control.has_key_pressed = random->Uniform(2);
+  control.key_pressed = RandomInt(random);
+  control.has_feedhold = random->Uniform(2);
+  control.feedhold = random->Uniform(2);
+  control.has_position = random->Uniform(2);
+  control.position =
+      RandomInt(random) * static_cast<int64_t>(RandomInt(random));
+  control.has_velocity = random->Uniform(2);
+  control.velocity = RandomInt(random);
+  return control;
+}
+
+// Canonical bytes of a Control, from the encoder that does not use the field
+// descriptors.
+std::vector<uint8_t> DirectBytes(const Control& control) {
+  uint8_t buffer[Control_size];
+  size_t size = 0;
+  CHECK(Control_encode_direct(&control, buffer, &size));
+  return std::vector<uint8_t>(buffer, buffer + size);
+}
+
+template <typename Message>
+std::vector<uint8_t> Encode(const pb_msgdesc_t* fields,
+                            const Message& message) {
+  uint8_t buffer[kPathMaxSize];
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  CHECK(pb_encode(&stream, fields, &message));
+  return std::vector<uint8_t>(buffer, buffer + stream.bytes_written);
+}
+
+// FNV-1a, to summarize a build's results in one line.
+class Digest {
+ public:
+  void Add(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 0x100000001b3;
+    }
+  }
+  void Add(const std::vector<uint8_t>& bytes) {
+    Add(bytes.data(), bytes.size());
+  }
+
+  uint64_t value() const { return hash_; }
+
+ private:
+  uint64_t hash_ = 0xcbf29ce484222325;
+};
+
+// Truncates `bytes`, or overwrites one of them.
+void Damage(std::vector<uint8_t>* bytes, test::Random* random) {
+  if (bytes->empty()) {
+    return;
+  }
+  if (random->Uniform(2) == 0) {
+    bytes->resize(random->Uniform(bytes->size()));
+  } else {
+    (*bytes)[random->Uniform(bytes->size())] =
+        static_cast<uint8_t>(random->Next());
+  }
+}
+
+// Decodes `input` and adds the outcome to `digest`: the error message on
+// failure, or the message re-encoded on success.
+template <typename Message, typename Canonical>
+bool DecodeInto(const pb_msgdesc_t* fields, const std::vector<uint8_t>& input,
+                Canonical canonical, Message* message, Digest* digest) {
+  pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+  bool ok = pb_decode(&stream, fields, message);
+  digest->Add(&ok, sizeof(ok));
+  if (ok) {
+    digest->Add(canonical(*message));
+  } else {
+    const char* error = PB_GET_ERROR(&stream);
+    digest->Add(error, strlen(error));
+  }
+  return ok;
+}
+
+void TestDecoding(Digest* digest) {
+  test::Random random(73);
+  auto control_bytes = [](const Control& control) {
+    return DirectBytes(control);
+  };
+  auto path_bytes = [](const Path& path) { return Encode(Path_fields, path); };
+
+  for (int trial = 0; trial < 20000; ++trial) {
+    Control control = RandomControl(&random);
+    std::vector<uint8_t> input = DirectBytes(control);
+    bool damaged = random.Uniform(3) == 0;
+    if (damaged) {
+      Damage(&input, &random);
+    }
+    Control decoded = Control_init_zero;
+    bool ok = DecodeInto(Control_fields, input, control_bytes, &decoded,
+                         digest);
+    CHECK(damaged || (ok && DirectBytes(decoded) == DirectBytes(control)));
+
+    Path path = RandomPath(&random);
+    input = Encode(Path_fields, path);
+    damaged = random.Uniform(3) == 0;
+    if (damaged) {
+      Damage(&input, &random);
+    }
+    Path decoded_path = {};
+    ok = DecodeInto(Path_fields, input, path_bytes, &decoded_path, digest);
+    CHECK(damaged || (ok && SamePath(decoded_path, path)));
+  }
+}
+
+// Returns the decode time per message over `inputs`.
+template <typename Message>
+double DecodeNs(const pb_msgdesc_t* fields,
+                const std::vector<std::vector<uint8_t>>& inputs,
+                int repetitions) {
+  Message message;
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    for (const std::vector<uint8_t>& input : inputs) {
+      pb_istream_t stream =
+          pb_istream_from_buffer(input.data(), input.size());
+      CHECK(pb_decode(&stream, fields, &message));
+      test::DoNotOptimize(message);
+    }
+  }
+  return static_cast<double>(test::NowNs() - start) /
+         (static_cast<double>(inputs.size()) * repetitions);
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(79);
+  std::vector<std::vector<uint8_t>> controls;
+  std::vector<std::vector<uint8_t>> paths;
+  for (int i = 0; i < 1000; ++i) {
+    controls.push_back(DirectBytes(RandomControl(&random)));
+    paths.push_back(Encode(Path_fields, RandomPath(&random)));
+  }
+  printf("flat Control %6.1f ns, nested Path %6.1f ns\n",
+         DecodeNs<Control>(Control_fields, controls, repetitions),
+         DecodeNs<Path>(Path_fields, paths, repetitions));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+#ifdef PB_ENABLE_DESCRIPTOR_CACHE
+  printf("descriptor cache: on\n");
+#else
+  printf("descriptor cache: off\n");
+#endif
+  Digest digest;
+  TestDecoding(&digest);
+  printf("digest: %016llx\n", static_cast<unsigned long long>(digest.value()));
+  Benchmark(test::FullRun(argc, argv) ? 2000 : 100);
+  return 0;
+}
@@ -0,0 +1,228 @@
+// Checks that Control_encode_direct produces exactly the bytes pb_encode does,
+// and fails in the same cases, on random messages covering every field, and
+// times both on jog-like traffic.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <limits>
+#include <vector>
+
+#include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+namespace {
+
+// Random value of `T`, biased towards the varint length boundaries and the
+// extremes.
+template <typename T>
+T RandomValue(test::Random* random) {
+  switch (random->Uniform(6)) {
+    case 0:
+      return 0;
+    case 1:
+      return std::numeric_limits<T>::min();
+    case 2:
+      return std::numeric_limits<T>::max();
+    case 3:
+      return static_cast<T>(random->Uniform(300)) - 150;
+    case 4:
+      // Around a 7-bit group boundary, either sign.
+      return static_cast<T>((static_cast<uint64_t>(1)
+                             << (7 * (1 + random->Uniform(9)))) -
+                            random->Uniform(3));
+    default:
+      return static_cast<T>(random->Next());
+  }
+}
+
+// Sets every optional field at random, and `events_count` to anything from 0
+// to one past the array size.
+Control RandomControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = random->Uniform(2);
+  control.value = RandomValue<int32_t>(random);
+  control.has_axis = random->Uniform(2);
+  control.axis =
+      static_cast<Control_Axis>(random->Uniform(_Control_Axis_MAX + 1));
+  control.has_multiplier = random->Uniform(2);
+  control.multiplier = static_cast<Control_Multiplier>(
+      random->Uniform(_Control_Multiplier_MAX + 1));
+  control.has_key_pressed = random->Uniform(2);
+  control.key_pressed = RandomValue<int32_t>(random);
+  control.has_key_released = random->Uniform(2);
+  control.key_released = RandomValue<int32_t>(random);
+  control.has_feedhold = random->Uniform(2);
+  control.feedhold = random->Uniform(2);
+  control.has_estop = random->Uniform(2);
+  control.estop = random->Uniform(2);
+  control.has_value_delta = random->Uniform(2);
+  control.value_delta = RandomValue<int32_t>(random);
+  control.has_position = random->Uniform(2);
+  control.position = RandomValue<int64_t>(random);
+  control.events_count = random->Uniform(pb_arraysize(Control, events) + 2);
+  for (InputEvent& event : control.events) {
+    event.time_us = RandomValue<uint32_t>(random);
+    event.source = static_cast<InputEvent_Source>(
+        random->Uniform(_InputEvent_Source_MAX + 1));
+    event.index = RandomValue<uint32_t>(random);
+    event.pressed = random->Uniform(2);
+  }
+  control.has_velocity = random->Uniform(2);
+  control.velocity = RandomValue<int32_t>(random);
+  control.has_acceleration = random->Uniform(2);
+  control.acceleration = RandomValue<int32_t>(random);
+  return control;
+}
+
+// Every field at its longest encoding.
+Control LargestControl() {
+  Control control = Control_init_default;
+  control.has_value = true;
+  control.value = -1;
+  control.has_axis = true;
+  control.axis = _Control_Axis_MAX;
+  control.has_multiplier = true;
+  control.multiplier = _Control_Multiplier_MAX;
+  control.has_key_pressed = true;
+  control.key_pressed = -1;
+  control.has_key_released = true;
+  control.key_released = -1;
+  control.has_feedhold = true;
+  control.feedhold = true;
+  control.has_estop = true;
+  control.estop = true;
+  control.has_value_delta = true;
+  control.value_delta = std::numeric_limits<int32_t>::min();
+  control.has_position = true;
+  control.position = std::numeric_limits<int64_t>::min();
+  control.events_count = pb_arraysize(Control, events);
+  for (InputEvent& event : control.events) {
+    event.time_us = std::numeric_limits<uint32_t>::max();
+    event.source = _InputEvent_Source_MAX;
+    event.index = std::numeric_limits<uint32_t>::max();
+    event.pressed = true;
+  }
+  control.has_velocity = true;
+  control.velocity = std::numeric_limits<int32_t>::min();
+  control.has_acceleration = true;
+  control.acceleration = std::numeric_limits<int32_t>::min();
+  return control;
+}
+
+// Encodes `control` both ways and checks that the results agree. Returns
+// whether encoding succeeded, and the encoded size in `size`.
+bool CheckSame(const Control& control, size_t* size) {
+  uint8_t expected[Control_size];
+  pb_ostream_t stream = pb_ostream_from_buffer(expected, sizeof(expected));
+  bool expected_ok = pb_encode(&stream, Control_fields, &control);
+
+  // Guard bytes past Control_size catch a write beyond the documented bound.
+  uint8_t direct[Control_size + 16];
+  memset(direct, 0xa5, sizeof(direct));
+  bool direct_ok = Control_encode_direct(&control, direct, size);
+
+  CHECK(direct_ok == expected_ok);
+  for (size_t i = Control_size; i < sizeof(direct); ++i) {
+    CHECK(direct[i] == 0xa5);
+  }
+  if (!direct_ok) {
+    return false;
+  }
+  CHECK(*size == stream.bytes_written);
+  CHECK(*size <= Control_size);
+  CHECK(memcmp(direct, expected, *size) == 0);
+  return true;
+}
+
+void TestEquivalence(int trials) {
+  test::Random random(61);
+  int counts[pb_arraysize(Control, events) + 2] = {};
+  int failures = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    Control control = RandomControl(&random);
+    ++counts[control.events_count];
+    size_t size = 0;
+    if (!CheckSame(control, &size)) {
+      CHECK(control.events_count > pb_arraysize(Control, events));
+      ++failures;
+    }
+  }
+  // Every count was covered, and only the overflowing one failed.
+  for (int count : counts) {
+    CHECK(count > 0);
+  }
+  CHECK(failures == counts[pb_arraysize(Control, events) + 1]);
+
+  size_t size = 0;
+  CHECK(CheckSame(Control_init_default, &size) && size == 0);
+  CHECK(CheckSame(LargestControl(), &size) && size == Control_size);
+}
+
+// Jog traffic: mostly value-only frames, some with a key or the estimated
+// motion.
+Control JogControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = true;
+  control.value = static_cast<int32_t>(random->Uniform(20000)) - 10000;
+  switch (random->Uniform(8)) {
+    case 0:
+      control.has_key_pressed = true;
+      control.key_pressed = 1 << random->Uniform(16);
+      break;
+    case 1:
+      control.has_velocity = true;
+      control.velocity = static_cast<int32_t>(random->Uniform(4000)) - 2000;
+      control.has_acceleration = true;
+      control.acceleration =
+          static_cast<int32_t>(random->Uniform(40000)) - 20000;
+      break;
+  }
+  return control;
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(67);
+  std::vector<Control> controls;
+  for (int i = 0; i < 1000; ++i) {
+    controls.push_back(JogControl(&random));
+  }
+  controls.push_back(LargestControl());
+
+  uint8_t buffer[Control_size];
+  double messages = static_cast<double>(controls.size()) * repetitions;
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    for (const Control& control : controls) {
+      pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+      CHECK(pb_encode(&stream, Control_fields, &control));
+      test::DoNotOptimize(stream.bytes_written);
+    }
+  }
+  double pb_encode_ns = (test::NowNs() - start) / messages;
+
+  start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    for (const Control& control : controls) {
+      size_t size = 0;
+      CHECK(Control_encode_direct(&control, buffer, &size));
+      test::DoNotOptimize(size);
+    }
+  }
+  double direct_ns = (test::NowNs() - start) / messages;
+
+  printf("jog messages: pb_encode %6.1f ns, direct %6.1f ns, %.1fx\n",
+         pb_encode_ns, direct_ns, pb_encode_ns / direct_ns);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const bool full = test::FullRun(argc, argv);
+  TestEquivalence(full ? 2000000 : 100000);
+  Benchmark(full ? 5000 : 200);
+  return 0;
+}
@@ -0,0 +1,594 @@
+// Feeds messages to pb_decode_incremental in random-sized pieces and checks
+// that it agrees with pb_decode_ex on the same bytes: whether decoding
+// succeeds, what it decodes to and how much input it uses, for plain,
+// PB_DECODE_DELIMITED and PB_DECODE_NULLTERMINATED input. The inputs have
+// nested submessages, unknown fields at both levels and damage, and are cut
+// at every byte, which also covers pb_decode_incremental_finish in the middle
+// of a field. Values longer than PB_INCREMENTAL_FIELD_SIZE must fail cleanly
+// when split. Also times decoding in pieces against pb_decode.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+// A message bound by hand whose string, bytes and packed values can be longer
+// than PB_INCREMENTAL_FIELD_SIZE.
+typedef PB_BYTES_ARRAY_T(120) Inner_data_t;
+
+struct Inner {
+  bool has_data;
+  Inner_data_t data;
+  bool has_crc;
+  uint32_t crc;
+};
+
+struct Blob {
+  bool has_name;
+  char name[48];
+  bool has_inner;
+  Inner inner;
+  pb_size_t values_count;
+  uint32_t values[16];
+  bool has_stamp;
+  uint64_t stamp;
+};
+
+#define Inner_FIELDLIST(X, a)               \
+  X(a, STATIC, OPTIONAL, BYTES, data, 1)    \
+  X(a, STATIC, OPTIONAL, FIXED32, crc, 2)
+#define Inner_CALLBACK NULL
+#define Inner_DEFAULT NULL
+
+#define Blob_FIELDLIST(X, a)                  \
+  X(a, STATIC, OPTIONAL, STRING, name, 1)     \
+  X(a, STATIC, OPTIONAL, MESSAGE, inner, 2)   \
+  X(a, STATIC, REPEATED, UINT32, values, 3)   \
+  X(a, STATIC, OPTIONAL, FIXED64, stamp, 4)
+#define Blob_CALLBACK NULL
+#define Blob_DEFAULT NULL
+#define Blob_inner_MSGTYPE Inner
+
+extern const pb_msgdesc_t Inner_msg;
+extern const pb_msgdesc_t Blob_msg;
+#define Inner_fields &Inner_msg
+#define Blob_fields &Blob_msg
+
+PB_BIND(Inner, Inner, 2)
+PB_BIND(Blob, Blob, 2)
+
+namespace {
+
+constexpr size_t kBlobMaxSize = 512;
+
+const unsigned int kModes[] = {0, PB_DECODE_DELIMITED,
+                               PB_DECODE_NULLTERMINATED};
+
+const char kTooLarge[] = "field too large for incremental buffer";
+
+template <typename T>
+T RandomValue(test::Random* random) {
+  switch (random->Uniform(4)) {
+    case 0:
+      return 0;
+    case 1:
+      return std::numeric_limits<T>::max();
+    case 2:
+      return static_cast<T>(random->Uniform(300));
+    default:
+      return static_cast<T>(random->Next());
+  }
+}
+
+template <typename Message>
+std::vector<uint8_t> Encode(const pb_msgdesc_t* fields,
+                            const Message& message) {
+  uint8_t buffer[kBlobMaxSize];
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  CHECK(pb_encode(&stream, fields, &message));
+  return std::vector<uint8_t>(buffer, buffer + stream.bytes_written);
+}
+
+void AppendVarint(uint64_t value, std::vector<uint8_t>* bytes) {
+  uint8_t buffer[10];
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  CHECK(pb_encode_varint(&stream, value));
+  bytes->insert(bytes->end(), buffer, buffer + stream.bytes_written);
+}
+
+// A field no message here defines, of any wire type. Length-delimited ones
+// are up to 200 bytes long: skipped fields are streamed, not buffered.
+std::vector<uint8_t> UnknownField(test::Random* random) {
+  std::vector<uint8_t> bytes;
+  uint32_t tag = 13 + random->Uniform(100);
+  switch (random->Uniform(4)) {
+    case 0:
+      AppendVarint(tag << 3 | PB_WT_VARINT, &bytes);
+      AppendVarint(RandomValue<uint64_t>(random), &bytes);
+      break;
+    case 1:
+      AppendVarint(tag << 3 | PB_WT_64BIT, &bytes);
+      bytes.resize(bytes.size() + 8);
+      break;
+    case 2:
+      AppendVarint(tag << 3 | PB_WT_32BIT, &bytes);
+      bytes.resize(bytes.size() + 4);
+      break;
+    default: {
+      size_t length = random->Uniform(201);
+      AppendVarint(tag << 3 | PB_WT_STRING, &bytes);
+      AppendVarint(length, &bytes);
+      bytes.resize(bytes.size() + length);
+      break;
+    }
+  }
+  return bytes;
+}
+
+// Inserts up to three unknown fields between the fields in `chunks` and joins
+// them.
+std::vector<uint8_t> JoinWithUnknown(std::vector<std::vector<uint8_t>> chunks,
+                                     test::Random* random) {
+  int unknown = random->Uniform(4);
+  for (int i = 0; i < unknown; ++i) {
+    chunks.insert(chunks.begin() + random->Uniform(chunks.size() + 1),
+                  UnknownField(random));
+  }
+  std::vector<uint8_t> bytes;
+  for (const std::vector<uint8_t>& chunk : chunks) {
+    bytes.insert(bytes.end(), chunk.begin(), chunk.end());
+  }
+  return bytes;
+}
+
+// `events_count` is up to one past the array size, which must fail to
+// decode.
+Control RandomControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = random->Uniform(2);
+  control.value = RandomValue<int32_t>(random);
+  control.has_axis = random->Uniform(2);
+  control.axis =
+      static_cast<Control_Axis>(random->Uniform(_Control_Axis_MAX + 1));
+  control.has_key_pressed = random->Uniform(2);
+  control.key_pressed = RandomValue<int32_t>(random);
+  control.has_estop = random->Uniform(2);
+  control.estop = random->Uniform(2);
+  control.has_position = random->Uniform(2);
+  control.position = RandomValue<int64_t>(random);
+  control.events_count = random->Uniform(pb_arraysize(Control, events) + 2);
+  for (InputEvent& event : control.events) {
+    event.time_us = RandomValue<uint32_t>(random);
+    event.source = static_cast<InputEvent_Source>(
+        random->Uniform(_InputEvent_Source_MAX + 1));
+    event.index = random->Uniform(16);
+    event.pressed = random->Uniform(2);
+  }
+  control.has_velocity = random->Uniform(2);
+  control.velocity = RandomValue<int32_t>(random);
+  return control;
+}
+
+std::vector<uint8_t> DirectBytes(const Control& control) {
+  uint8_t buffer[Control_size];
+  size_t size = 0;
+  CHECK(Control_encode_direct(&control, buffer, &size));
+  return std::vector<uint8_t>(buffer, buffer + size);
+}
+
+// Encodes `control` field by field with unknown fields in between, including
+// inside the events.
+std::vector<uint8_t> ControlBytes(const Control& control,
+                                  test::Random* random) {
+  std::vector<std::vector<uint8_t>> chunks;
+#define OPTIONAL_CHUNK(name)                  \
+  {                                           \
+    Control single = Control_init_default;    \
+    single.has_##name = control.has_##name;   \
+    single.name = control.name;               \
+    chunks.push_back(DirectBytes(single));    \
+  }
+  // Control's only repeated field is `events`.
+#define REPEATED_CHUNK(name)                                          \
+  for (pb_size_t i = 0; i < control.name##_count; ++i) {              \
+    std::vector<uint8_t> event = Encode(InputEvent_fields,            \
+                                        control.name[i]);             \
+    event = JoinWithUnknown({event}, random);                         \
+    std::vector<uint8_t> chunk;                                       \
+    AppendVarint(Control_events_tag << 3 | PB_WT_STRING, &chunk);     \
+    AppendVarint(event.size(), &chunk);                               \
+    chunk.insert(chunk.end(), event.begin(), event.end());            \
+    chunks.push_back(chunk);                                          \
+  }
+#define FIELD_CHUNK(structname, atype, htype, ltype, name, tag) \
+  htype##_CHUNK(name)
+  Control_FIELDLIST(FIELD_CHUNK, unused)
+#undef FIELD_CHUNK
+#undef REPEATED_CHUNK
+#undef OPTIONAL_CHUNK
+  return JoinWithUnknown(chunks, random);
+}
+
+Blob RandomBlob(test::Random* random) {
+  Blob blob = {};
+  blob.has_name = random->Uniform(2);
+  int length = random->Uniform(sizeof(blob.name));
+  for (int i = 0; i < length; ++i) {
+    blob.name[i] = static_cast<char>('a' + random->Uniform(26));
+  }
+  blob.has_inner = random->Uniform(2);
+  blob.inner.has_data = random->Uniform(2);
+  blob.inner.data.size = random->Uniform(sizeof(blob.inner.data.bytes) + 1);
+  random->Fill(blob.inner.data.bytes, blob.inner.data.size);
+  blob.inner.has_crc = random->Uniform(2);
+  blob.inner.crc = RandomValue<uint32_t>(random);
+  blob.values_count = random->Uniform(pb_arraysize(Blob, values) + 1);
+  for (pb_size_t i = 0; i < blob.values_count; ++i) {
+    blob.values[i] = RandomValue<uint32_t>(random);
+  }
+  blob.has_stamp = random->Uniform(2);
+  blob.stamp = RandomValue<uint64_t>(random);
+  return blob;
+}
+
+// True if some value of `blob` that is decoded from one piece, length prefix
+// included, is longer than PB_INCREMENTAL_FIELD_SIZE.
+bool HasLargeValue(const Blob& blob) {
+  size_t packed = 0;
+  for (pb_size_t i = 0; i < blob.values_count; ++i) {
+    pb_ostream_t sizing = PB_OSTREAM_SIZING;
+    CHECK(pb_encode_varint(&sizing, blob.values[i]));
+    packed += sizing.bytes_written;
+  }
+  return (blob.has_inner && blob.inner.has_data &&
+          1 + blob.inner.data.size > PB_INCREMENTAL_FIELD_SIZE) ||
+         (blob.values_count > 0 && 1 + packed > PB_INCREMENTAL_FIELD_SIZE);
+}
+
+// Adds the framing of `mode` to `message`, and for the self-delimiting modes
+// a few bytes of whatever comes next.
+std::vector<uint8_t> Frame(const std::vector<uint8_t>& message,
+                           unsigned int mode, test::Random* random) {
+  std::vector<uint8_t> bytes;
+  if (mode == PB_DECODE_DELIMITED) {
+    AppendVarint(message.size(), &bytes);
+  }
+  bytes.insert(bytes.end(), message.begin(), message.end());
+  if (mode == PB_DECODE_NULLTERMINATED) {
+    bytes.push_back(0);
+  }
+  if (mode != 0) {
+    size_t next = bytes.size();
+    bytes.resize(next + random->Uniform(5));
+    random->Fill(bytes.data() + next, bytes.size() - next);
+  }
+  return bytes;
+}
+
+// Truncates `bytes`, overwrites one of them or inserts one.
+void Damage(std::vector<uint8_t>* bytes, test::Random* random) {
+  uint8_t byte = static_cast<uint8_t>(random->Next());
+  switch (random->Uniform(3)) {
+    case 0:
+      bytes->resize(random->Uniform(bytes->size() + 1));
+      break;
+    case 1:
+      if (!bytes->empty()) {
+        (*bytes)[random->Uniform(bytes->size())] = byte;
+      }
+      break;
+    default:
+      bytes->insert(bytes->begin() + random->Uniform(bytes->size() + 1), byte);
+      break;
+  }
+}
+
+// Piece sizes adding up to `size`: all at once, a byte at a time, or random,
+// with some empty pieces.
+std::vector<size_t> RandomFeeds(size_t size, test::Random* random) {
+  std::vector<size_t> feeds;
+  uint32_t pattern = random->Uniform(4);
+  for (size_t total = 0; total < size;) {
+    size_t feed = size - total;
+    if (pattern == 1) {
+      feed = 1;
+    } else if (pattern > 1) {
+      feed = std::min<size_t>(feed, random->Uniform(pattern == 2 ? 4 : 40));
+    }
+    feeds.push_back(feed);
+    total += feed;
+  }
+  return feeds;
+}
+
+struct Outcome {
+  bool ok;
+  size_t consumed;
+  std::string error;
+  std::vector<uint8_t> canonical;
+};
+
+template <typename Message>
+using Canonical = std::vector<uint8_t> (*)(const Message&);
+
+template <typename Message>
+Outcome Reference(const pb_msgdesc_t* fields, unsigned int mode,
+                  const std::vector<uint8_t>& input,
+                  Canonical<Message> canonical) {
+  Message message;
+  memset(&message, 0x5a, sizeof(message));
+  pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+  Outcome outcome;
+  outcome.ok = pb_decode_ex(&stream, fields, &message, mode);
+  outcome.consumed = input.size() - stream.bytes_left;
+  outcome.error = PB_GET_ERROR(&stream);
+  if (outcome.ok) {
+    outcome.canonical = canonical(message);
+  }
+  return outcome;
+}
+
+// Decodes `input` fed in pieces of `feeds` bytes, each in a buffer of its
+// own that is overwritten once the decoder has returned.
+template <typename Message>
+Outcome Incremental(const pb_msgdesc_t* fields, unsigned int mode,
+                    const std::vector<uint8_t>& input,
+                    const std::vector<size_t>& feeds,
+                    Canonical<Message> canonical) {
+  Message message;
+  memset(&message, 0x5a, sizeof(message));
+  pb_decode_ctx_t ctx;
+  pb_decode_incremental_init(&ctx, fields, &message, mode);
+
+  pb_decode_status_t status = PB_DECODE_NEED_MORE;
+  size_t position = 0;
+  for (size_t feed : feeds) {
+    std::vector<uint8_t> piece(input.begin() + position,
+                               input.begin() + position + feed);
+    size_t consumed = feed + 1;
+    status = pb_decode_incremental(&ctx, piece.data(), piece.size(),
+                                   &consumed);
+    memset(piece.data(), 0xa5, piece.size());
+    position += consumed;
+    if (status != PB_DECODE_NEED_MORE) {
+      break;
+    }
+    CHECK(consumed == feed);
+  }
+  if (status == PB_DECODE_NEED_MORE) {
+    status = pb_decode_incremental_finish(&ctx);
+    CHECK(status != PB_DECODE_NEED_MORE);
+  }
+
+  Outcome outcome;
+  outcome.ok = status == PB_DECODE_COMPLETE;
+  outcome.consumed = position;
+  outcome.error = PB_GET_ERROR(&ctx);
+  if (outcome.ok) {
+    outcome.canonical = canonical(message);
+  }
+
+  // The outcome is final: more input is not used, and finishing changes
+  // nothing.
+  uint8_t more[4] = {0x08, 0x01, 0x10, 0x02};
+  size_t consumed = 1;
+  CHECK(pb_decode_incremental(&ctx, more, sizeof(more), &consumed) == status);
+  CHECK(consumed == 0);
+  CHECK(pb_decode_incremental_finish(&ctx) == status);
+  CHECK(outcome.error == PB_GET_ERROR(&ctx));
+  return outcome;
+}
+
+std::vector<uint8_t> ControlCanonical(const Control& control) {
+  return DirectBytes(control);
+}
+
+std::vector<uint8_t> BlobCanonical(const Blob& blob) {
+  return Encode(Blob_fields, blob);
+}
+
+bool SameOutcome(const Outcome& a, const Outcome& b) {
+  return a.ok == b.ok &&
+         (!a.ok || (a.consumed == b.consumed && a.canonical == b.canonical));
+}
+
+void CheckControl(unsigned int mode, const std::vector<uint8_t>& input,
+                  const std::vector<size_t>& feeds, bool* ok) {
+  Outcome expected =
+      Reference<Control>(Control_fields, mode, input, ControlCanonical);
+  Outcome actual = Incremental<Control>(Control_fields, mode, input, feeds,
+                                        ControlCanonical);
+  CHECK(SameOutcome(expected, actual));
+  *ok = actual.ok;
+}
+
+void TestControl(int trials) {
+  test::Random random(97);
+  int decoded = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    for (unsigned int mode : kModes) {
+      Control control = RandomControl(&random);
+      std::vector<uint8_t> input =
+          Frame(ControlBytes(control, &random), mode, &random);
+      bool damaged = random.Uniform(3) == 0;
+      if (damaged) {
+        Damage(&input, &random);
+      }
+      bool ok = false;
+      CheckControl(mode, input, RandomFeeds(input.size(), &random), &ok);
+      CHECK(damaged ||
+            ok == (control.events_count <= pb_arraysize(Control, events)));
+      decoded += ok;
+    }
+  }
+  CHECK(decoded > trials);
+}
+
+// Splits one message at every byte, and cuts it at every byte, which ends
+// the input inside every tag, length and value.
+void TestEveryCut() {
+  test::Random random(101);
+  Control control = RandomControl(&random);
+  control.has_value = true;
+  control.has_position = true;
+  control.position = std::numeric_limits<int64_t>::min();
+  control.events_count = 3;
+  for (unsigned int mode : kModes) {
+    std::vector<uint8_t> input =
+        Frame(ControlBytes(control, &random), mode, &random);
+    int cuts_ok = 0;
+    for (size_t i = 0; i <= input.size(); ++i) {
+      bool ok = false;
+      CheckControl(mode, input, {i, 0, input.size() - i}, &ok);
+      CHECK(ok);
+      std::vector<uint8_t> cut(input.begin(), input.begin() + i);
+      CheckControl(mode, cut, RandomFeeds(cut.size(), &random), &ok);
+      cuts_ok += ok;
+    }
+    // Plain input may end after any field, so at least after the empty
+    // prefix and the five fields set above; delimited input only after the
+    // whole message.
+    CHECK(mode != 0 || cuts_ok >= 6);
+    CHECK(mode != PB_DECODE_DELIMITED || cuts_ok > 0);
+  }
+}
+
+void TestBlob(int trials) {
+  test::Random random(103);
+  int too_large = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    for (unsigned int mode : kModes) {
+      Blob blob = RandomBlob(&random);
+      std::vector<uint8_t> input =
+          Frame(JoinWithUnknown({Encode(Blob_fields, blob)}, &random), mode,
+                &random);
+      bool damaged = random.Uniform(3) == 0;
+      if (damaged) {
+        Damage(&input, &random);
+      }
+      Outcome expected =
+          Reference<Blob>(Blob_fields, mode, input, BlobCanonical);
+      Outcome actual = Incremental<Blob>(Blob_fields, mode, input,
+                                         RandomFeeds(input.size(), &random),
+                                         BlobCanonical);
+      if (expected.ok && !actual.ok && actual.error == kTooLarge) {
+        // Only a value that does not fit may fail, and only when split.
+        CHECK(HasLargeValue(blob));
+        ++too_large;
+      } else {
+        CHECK(damaged || actual.ok);
+        CHECK(SameOutcome(expected, actual));
+      }
+    }
+  }
+  CHECK(too_large > 0);
+}
+
+// Values, length prefix included, up to PB_INCREMENTAL_FIELD_SIZE long and one
+// byte over, fed a byte at a time and all at once.
+void TestFieldSizeLimit() {
+  for (size_t size = PB_INCREMENTAL_FIELD_SIZE - 2;
+       size <= PB_INCREMENTAL_FIELD_SIZE; ++size) {
+    Blob blob = {};
+    blob.has_inner = true;
+    blob.inner.has_data = true;
+    blob.inner.data.size = size - 1;
+    memset(blob.inner.data.bytes, 0x33, blob.inner.data.size);
+    blob.has_stamp = true;
+    std::vector<uint8_t> input = Encode(Blob_fields, blob);
+
+    Outcome whole = Incremental<Blob>(Blob_fields, 0, input, {input.size()},
+                                      BlobCanonical);
+    CHECK(whole.ok && whole.canonical == input);
+
+    Outcome bytewise = Incremental<Blob>(
+        Blob_fields, 0, input, std::vector<size_t>(input.size(), 1),
+        BlobCanonical);
+    CHECK(bytewise.ok && bytewise.canonical == input);
+  }
+
+  Blob blob = {};
+  blob.has_inner = true;
+  blob.inner.has_data = true;
+  blob.inner.data.size = PB_INCREMENTAL_FIELD_SIZE;
+  std::vector<uint8_t> input = Encode(Blob_fields, blob);
+  Outcome bytewise = Incremental<Blob>(
+      Blob_fields, 0, input, std::vector<size_t>(input.size(), 1),
+      BlobCanonical);
+  CHECK(!bytewise.ok && bytewise.error == kTooLarge);
+}
+
+// Returns the decode time per message, in pieces of `feed` bytes.
+double IncrementalNs(const std::vector<std::vector<uint8_t>>& inputs,
+                     size_t feed, int repetitions) {
+  Control control;
+  uint64_t start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    for (const std::vector<uint8_t>& input : inputs) {
+      pb_decode_ctx_t ctx;
+      pb_decode_incremental_init(&ctx, Control_fields, &control, 0);
+      for (size_t i = 0; i < input.size(); i += feed) {
+        size_t consumed = 0;
+        CHECK(pb_decode_incremental(&ctx, input.data() + i,
+                                    std::min(feed, input.size() - i),
+                                    &consumed) == PB_DECODE_NEED_MORE);
+      }
+      CHECK(pb_decode_incremental_finish(&ctx) == PB_DECODE_COMPLETE);
+      test::DoNotOptimize(control);
+    }
+  }
+  return static_cast<double>(test::NowNs() - start) /
+         (static_cast<double>(inputs.size()) * repetitions);
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(107);
+  std::vector<std::vector<uint8_t>> inputs;
+  while (inputs.size() < 1000) {
+    Control control = RandomControl(&random);
+    if (control.events_count <= pb_arraysize(Control, events)) {
+      inputs.push_back(DirectBytes(control));
+    }
+  }
+
+  Control control;
+  uint64_t start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    for (const std::vector<uint8_t>& input : inputs) {
+      pb_istream_t stream =
+          pb_istream_from_buffer(input.data(), input.size());
+      CHECK(pb_decode(&stream, Control_fields, &control));
+      test::DoNotOptimize(control);
+    }
+  }
+  double decode_ns = static_cast<double>(test::NowNs() - start) /
+                     (static_cast<double>(inputs.size()) * repetitions);
+
+  printf("Control decode: pb_decode %6.1f ns; incremental whole %6.1f ns, "
+         "16-byte feeds %6.1f ns, 1-byte feeds %6.1f ns\n",
+         decode_ns, IncrementalNs(inputs, Control_size, repetitions),
+         IncrementalNs(inputs, 16, repetitions),
+         IncrementalNs(inputs, 1, repetitions));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const bool full = test::FullRun(argc, argv);
+  TestFieldSizeLimit();
+  TestEveryCut();
+  TestControl(full ? 200000 : 10000);
+  TestBlob(full ? 200000 : 10000);
+  Benchmark(full ? 1000 : 50);
+  return 0;
+}
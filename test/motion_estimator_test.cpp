@@ -0,0 +1,156 @@
+// Replays encoder count traces into util::MotionEstimator.
+//
+// With no arguments, synthetic 1 kHz traces of typical handwheel motion are
+// replayed and the estimates checked against the true motion. With a file
+// argument, a recorded trace (one count per line, sampled at 1 kHz) is
+// replayed and the estimates are printed as CSV.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "motion_estimator.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr uint32_t kSampleRateHz = 1000;
+
+// True velocity in counts per second over a trace.
+using Profile = double (*)(double t);
+
+// A trace quantized like the encoder: whole counts of the integrated
+// position.
+std::vector<int64_t> MakeTrace(Profile profile, double seconds) {
+  std::vector<int64_t> counts;
+  double position = 0;
+  for (int i = 0; i < seconds * kSampleRateHz; ++i) {
+    position += profile(static_cast<double>(i) / kSampleRateHz) / kSampleRateHz;
+    counts.push_back(static_cast<int64_t>(floor(position)));
+  }
+  return counts;
+}
+
+struct Replay {
+  // Largest velocity error over the checked window, in counts per second.
+  double max_velocity_error = 0;
+  int32_t final_velocity = 0;
+  int32_t final_acceleration = 0;
+};
+
+// Replays `profile` for `seconds` and checks the velocity against it from
+// `check_from` to `check_to` seconds.
+Replay Run(Profile profile, double seconds, double check_from,
+           double check_to) {
+  util::MotionEstimator estimator(kSampleRateHz);
+  std::vector<int64_t> counts = MakeTrace(profile, seconds);
+  Replay replay;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    estimator.Update(counts[i]);
+    double t = static_cast<double>(i) / kSampleRateHz;
+    if (t >= check_from && t < check_to) {
+      double error = fabs(estimator.velocity() - profile(t));
+      if (error > replay.max_velocity_error) {
+        replay.max_velocity_error = error;
+      }
+    }
+  }
+  replay.final_velocity = estimator.velocity();
+  replay.final_acceleration = estimator.acceleration();
+  return replay;
+}
+
+void TestSyntheticTraces() {
+  // At rest nothing is reported.
+  Replay rest = Run([](double) { return 0.0; }, 1, 0, 1);
+  CHECK(rest.max_velocity_error == 0);
+  CHECK(rest.final_acceleration == 0);
+
+  // Steady turning, within 10% once settled. At 50 counts/s a count only
+  // arrives every 20 samples, inside the filter's response time, so the
+  // estimate ripples by a few counts/s around the true velocity.
+  Replay slow = Run([](double) { return 50.0; }, 2, 0.5, 2);
+  CHECK(slow.max_velocity_error <= 10);
+  Replay fast = Run([](double) { return 2000.0; }, 2, 0.5, 2);
+  CHECK(fast.max_velocity_error <= 200);
+
+  // Reversal, settled on the new direction.
+  Replay reversal =
+      Run([](double t) { return t < 1 ? 500.0 : -500.0; }, 2, 1.5, 2);
+  CHECK(reversal.max_velocity_error <= 50);
+
+  // Constant acceleration is tracked without lag.
+  Replay ramp = Run([](double t) { return 1000.0 * t; }, 2, 0.5, 2);
+  CHECK(ramp.max_velocity_error <= 50);
+  CHECK(abs(ramp.final_acceleration - 1000) <= 200);
+
+  // Spinning, then stopping: settles to exactly zero.
+  Replay stop = Run([](double t) { return t < 1 ? 3000.0 : 0.0; }, 3, 2, 3);
+  CHECK(stop.final_velocity == 0);
+  CHECK(stop.final_acceleration == 0);
+
+  // Reset forgets the motion, and a jump in the count across it is not seen
+  // as velocity.
+  util::MotionEstimator estimator(kSampleRateHz);
+  for (int64_t i = 0; i < 100; ++i) {
+    estimator.Update(i * 5);
+  }
+  CHECK(estimator.velocity() > 0);
+  estimator.Reset();
+  estimator.Update(1000000);
+  CHECK(estimator.velocity() == 0);
+  CHECK(estimator.acceleration() == 0);
+
+  printf("max velocity error (counts/s): 50/s %.0f, 2000/s %.0f, reversal "
+         "%.0f, ramp %.0f\n",
+         slow.max_velocity_error, fast.max_velocity_error,
+         reversal.max_velocity_error, ramp.max_velocity_error);
+  printf("ramp acceleration %d counts/s^2 for 1000\n", ramp.final_acceleration);
+}
+
+void Benchmark(int samples) {
+  util::MotionEstimator estimator(kSampleRateHz);
+  test::Random random(37);
+  int64_t count = 0;
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < samples; ++i) {
+    count += static_cast<int64_t>(random.Uniform(9)) - 4;
+    estimator.Update(count);
+    test::DoNotOptimize(estimator.velocity());
+  }
+  printf("Update + velocity: %.1f ns/sample\n",
+         static_cast<double>(test::NowNs() - start) / samples);
+}
+
+int ReplayFile(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+  util::MotionEstimator estimator(kSampleRateHz);
+  long long count = 0;
+  printf("sample,count,velocity,acceleration\n");
+  for (int sample = 0; fscanf(file, "%lld", &count) == 1; ++sample) {
+    estimator.Update(count);
+    printf("%d,%lld,%d,%d\n", sample, count, estimator.velocity(),
+           estimator.acceleration());
+  }
+  fclose(file);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--full") != 0) {
+    return ReplayFile(argv[1]);
+  }
+  TestSyntheticTraces();
+  Benchmark(test::FullRun(argc, argv) ? 100000000 : 1000000);
+  return 0;
+}
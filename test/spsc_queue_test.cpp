@@ -0,0 +1,109 @@
+// Stress test and throughput benchmark for util::SpscQueue: a producer and a
+// consumer thread pass Control-sized entries through a small queue, checking
+// order, contents and overflow accounting.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <thread>
+
+#include "control_message.pb.h"
+#include "spsc_queue.h"
+#include "test_util.h"
+
+namespace {
+
+struct Entry {
+  uint32_t sequence;
+  Control control;
+};
+
+// Fills every checked field from `sequence`, so that a torn or stale slot is
+// detected.
+Entry MakeEntry(uint32_t sequence) {
+  Entry entry;
+  entry.sequence = sequence;
+  entry.control = Control_init_default;
+  entry.control.has_value = true;
+  entry.control.value = static_cast<int32_t>(sequence * 2654435761u);
+  entry.control.has_position = true;
+  entry.control.position = static_cast<int64_t>(sequence) * 3;
+  entry.control.events_count = sequence % 9;
+  entry.control.events[7].time_us = ~sequence;
+  return entry;
+}
+
+bool IsValid(const Entry& entry, uint32_t sequence) {
+  Entry expected = MakeEntry(sequence);
+  return entry.sequence == sequence &&
+         entry.control.value == expected.control.value &&
+         entry.control.position == expected.control.position &&
+         entry.control.events_count == expected.control.events_count &&
+         entry.control.events[7].time_us == expected.control.events[7].time_us;
+}
+
+void TestSingleThreaded() {
+  util::SpscQueue<Entry, 4> queue;
+  Entry entry;
+  CHECK(!queue.Pop(&entry));
+  for (uint32_t i = 0; i < 4; ++i) {
+    CHECK(queue.Push(MakeEntry(i)));
+  }
+  CHECK(queue.Size() == 4);
+  CHECK(!queue.Push(MakeEntry(4)));
+  CHECK(queue.overflows() == 1);
+  CHECK(queue.Pop(&entry) && IsValid(entry, 0));
+  CHECK(queue.Push(MakeEntry(4)));
+  queue.Clear();
+  CHECK(queue.Size() == 0);
+  CHECK(!queue.Pop(&entry));
+  CHECK(queue.Push(MakeEntry(5)));
+  CHECK(queue.Pop(&entry) && IsValid(entry, 5));
+}
+
+// Pushes `count` entries from one thread and pops them on another. A full
+// queue is retried, yielding so that this also runs on a single CPU.
+void StressTest(uint32_t count) {
+  static util::SpscQueue<Entry, 16> queue;
+  uint32_t rejected = 0;
+
+  uint64_t start = test::NowNs();
+  std::thread producer([&] {
+    for (uint32_t sequence = 0; sequence < count;) {
+      if (queue.Push(MakeEntry(sequence))) {
+        ++sequence;
+      } else {
+        ++rejected;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  Entry entry;
+  while (expected < count) {
+    if (queue.Pop(&entry)) {
+      CHECK(IsValid(entry, expected));
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  uint64_t elapsed = test::NowNs() - start;
+
+  CHECK(!queue.Pop(&entry));
+  CHECK(queue.overflows() == rejected);
+  printf("%u %zu-byte entries through a 16-slot queue: %.2f Mmsg/s, %u "
+         "overflows\n",
+         count, sizeof(Entry), count * 1e3 / static_cast<double>(elapsed),
+         rejected);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestSingleThreaded();
+  StressTest(test::FullRun(argc, argv) ? 20000000 : 1000000);
+  return 0;
+}
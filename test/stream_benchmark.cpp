@@ -0,0 +1,138 @@
+// Measures how many downstream calls and how much time a base64 frame costs
+// on its way through the util::Stream chain used by WriteControl, comparing
+// whole-run writes with per-token forwarding.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "base64_stream.h"
+#include "frame_stream.h"
+#include "stream.h"
+#include "test_util.h"
+
+namespace {
+
+// Typical encoded Control size.
+constexpr int kMessageSize = 32;
+constexpr int kFrameSize = 64;
+
+// Final stage standing in for the WiFi client; records what reaches it.
+class CountingSink : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    ++calls_;
+    for (int i = 0; i < count && size_ < static_cast<int>(sizeof(data_));
+         ++i) {
+      data_[size_++] = buffer[i];
+    }
+    return count;
+  }
+
+  void Clear() { size_ = 0; }
+
+  uint64_t calls() const { return calls_; }
+  const uint8_t* data() const { return data_; }
+  int size() const { return size_; }
+
+ private:
+  uint64_t calls_ = 0;
+  uint8_t data_[256];
+  int size_ = 0;
+};
+
+// Forwards every token with its own downstream call, as each stage did when
+// WriteBuffer was built on a per-token virtual Write.
+class PerTokenStage : public util::Stream<uint8_t> {
+ public:
+  int WriteBuffer(const uint8_t* buffer, int count) final {
+    for (int i = 0; i < count; ++i) {
+      if (!stream()->Write(buffer[i])) {
+        return i;
+      }
+    }
+    return count;
+  }
+};
+
+struct Result {
+  double calls_per_frame;
+  double ns_per_byte;
+};
+
+// Per-token path: every message byte is a separate write and every encoded
+// character reaches the sink in its own call.
+Result RunPerToken(const uint8_t* message, int frames) {
+  util::Base64EncodeStream encoder;
+  PerTokenStage relay;
+  CountingSink sink;
+  encoder.RegisterDownstream(&relay);
+  relay.RegisterDownstream(&sink);
+
+  uint64_t start = test::NowNs();
+  for (int frame = 0; frame < frames; ++frame) {
+    sink.Clear();
+    relay.Write('^');
+    for (int i = 0; i < kMessageSize; ++i) {
+      encoder.Write(message[i]);
+    }
+    encoder.Flush();
+    relay.Write('$');
+  }
+  uint64_t elapsed = test::NowNs() - start;
+
+  CHECK(sink.size() == util::Base64EncodedSize(kMessageSize) + 2);
+  return {static_cast<double>(sink.calls()) / frames,
+          static_cast<double>(elapsed) / (frames * kMessageSize)};
+}
+
+// Bulk path, as in WriteControl: the message is written in one call and the
+// frame stage sends the whole frame downstream once.
+Result RunBulk(const uint8_t* message, int frames, CountingSink* sink) {
+  util::Base64EncodeStream encoder;
+  util::FrameStream<kFrameSize> framer{"^", "$"};
+  encoder.RegisterDownstream(&framer);
+  framer.RegisterDownstream(sink);
+
+  uint64_t start = test::NowNs();
+  for (int frame = 0; frame < frames; ++frame) {
+    sink->Clear();
+    framer.Begin();
+    encoder.WriteBuffer(message, kMessageSize);
+    encoder.Flush();
+    framer.End();
+  }
+  uint64_t elapsed = test::NowNs() - start;
+
+  return {static_cast<double>(sink->calls()) / frames,
+          static_cast<double>(elapsed) / (frames * kMessageSize)};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int frames = test::FullRun(argc, argv) ? 2000000 : 100000;
+
+  uint8_t message[kMessageSize];
+  test::Random random(1);
+  random.Fill(message, sizeof(message));
+
+  Result per_token = RunPerToken(message, frames);
+  CountingSink sink;
+  Result bulk = RunBulk(message, frames, &sink);
+
+  // Both paths must put the same frame on the wire.
+  uint8_t expected[kFrameSize];
+  expected[0] = '^';
+  int encoded = util::Base64Encode(message, kMessageSize, expected + 1);
+  expected[encoded + 1] = '$';
+  CHECK(sink.size() == encoded + 2);
+  CHECK(memcmp(sink.data(), expected, encoded + 2) == 0);
+  CHECK(bulk.calls_per_frame == 1);
+
+  printf("%d-byte messages, %d frames\n", kMessageSize, frames);
+  printf("per-token: %6.1f calls/frame, %6.2f ns/byte\n",
+         per_token.calls_per_frame, per_token.ns_per_byte);
+  printf("bulk:      %6.1f calls/frame, %6.2f ns/byte\n", bulk.calls_per_frame,
+         bulk.ns_per_byte);
+  return 0;
+}
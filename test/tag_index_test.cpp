@@ -0,0 +1,331 @@
+// Checks pb_field_iter_find against the field lists themselves, for every tag
+// up to past the largest, from every starting field, and decodes Control
+// messages with shuffled field order and unknown tags. Built once per nanopb
+// configuration: without the cache, with it, with the tag index, and with the
+// index limited by PB_TAG_INDEX_MAX_TAG so that Control falls back to
+// scanning. Each build prints a digest of its decoding results, which
+// compare_digests.cmake requires to be identical, and times both.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "control_message.pb.h"
+#include "control_message_direct.h"
+#include "pb_common.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+// Messages with high tags, bound by hand with the descriptor width the
+// generator would pick for them: Sparse is at or above the default
+// PB_TAG_INDEX_MAX_TAG and never gets an index, Dense just fits below it.
+struct Sparse {
+  int32_t low;
+  int32_t middle;
+  int32_t high;
+  int32_t highest;
+};
+
+struct Dense {
+  int32_t low;
+  int32_t middle;
+  int32_t high;
+};
+
+#define Sparse_FIELDLIST(X, a)                 \
+  X(a, STATIC, REQUIRED, INT32, low, 1)        \
+  X(a, STATIC, REQUIRED, INT32, middle, 200)   \
+  X(a, STATIC, REQUIRED, INT32, high, 300)     \
+  X(a, STATIC, REQUIRED, INT32, highest, 5000)
+#define Sparse_CALLBACK NULL
+#define Sparse_DEFAULT NULL
+
+#define Dense_FIELDLIST(X, a)               \
+  X(a, STATIC, REQUIRED, INT32, low, 2)      \
+  X(a, STATIC, REQUIRED, INT32, middle, 100) \
+  X(a, STATIC, REQUIRED, INT32, high, 255)
+#define Dense_CALLBACK NULL
+#define Dense_DEFAULT NULL
+
+extern const pb_msgdesc_t Sparse_msg;
+extern const pb_msgdesc_t Dense_msg;
+
+PB_BIND(Sparse, Sparse, 4)
+PB_BIND(Dense, Dense, 2)
+
+namespace {
+
+struct ExpectedField {
+  uint32_t tag;
+  size_t offset;
+};
+
+// The fields of each message in descriptor order, straight from its field
+// list.
+#define EXPECTED_FIELD(structname, atype, htype, ltype, name, tag) \
+  {tag, offsetof(structname, name)},
+const ExpectedField kControlFields[] = {
+    Control_FIELDLIST(EXPECTED_FIELD, Control)};
+const ExpectedField kInputEventFields[] = {
+    InputEvent_FIELDLIST(EXPECTED_FIELD, InputEvent)};
+const ExpectedField kSparseFields[] = {
+    Sparse_FIELDLIST(EXPECTED_FIELD, Sparse)};
+const ExpectedField kDenseFields[] = {Dense_FIELDLIST(EXPECTED_FIELD, Dense)};
+#undef EXPECTED_FIELD
+
+// Looks up every tag up to `max_tag`, plus some far beyond it, from an
+// iterator positioned at each field in turn.
+template <size_t kFieldCount>
+void CheckFind(const pb_msgdesc_t* fields,
+               const ExpectedField (&expected)[kFieldCount], uint32_t max_tag,
+               void* message) {
+  std::vector<uint32_t> tags;
+  for (uint32_t tag = 0; tag <= max_tag; ++tag) {
+    tags.push_back(tag);
+  }
+  for (uint32_t tag : {PB_TAG_INDEX_MAX_TAG - 1, PB_TAG_INDEX_MAX_TAG,
+                       PB_TAG_INDEX_MAX_TAG + 1, 65535, 65536, 1 << 29}) {
+    tags.push_back(tag);
+  }
+
+  for (size_t start = 0; start < kFieldCount; ++start) {
+    for (uint32_t tag : tags) {
+      pb_field_iter_t iter;
+      CHECK(pb_field_iter_begin(&iter, fields, message));
+      for (size_t i = 0; i < start; ++i) {
+        CHECK(pb_field_iter_next(&iter));
+      }
+
+      const ExpectedField* field = nullptr;
+      size_t index = 0;
+      for (size_t i = 0; i < kFieldCount; ++i) {
+        if (expected[i].tag == tag) {
+          field = &expected[i];
+          index = i;
+        }
+      }
+
+      bool found = pb_field_iter_find(&iter, tag);
+      CHECK(found == (field != nullptr));
+      if (found) {
+        CHECK(iter.tag == tag);
+        CHECK(iter.index == index);
+        CHECK(iter.pData == static_cast<char*>(message) + field->offset);
+      }
+    }
+  }
+}
+
+void TestFind() {
+  Control control;
+  InputEvent event;
+  Sparse sparse;
+  Dense dense;
+  CheckFind(Control_fields, kControlFields, 300, &control);
+  CheckFind(InputEvent_fields, kInputEventFields, 300, &event);
+  CheckFind(&Sparse_msg, kSparseFields, 6000, &sparse);
+  CheckFind(&Dense_msg, kDenseFields, 300, &dense);
+}
+
+int32_t RandomInt(test::Random* random) {
+  return random->Uniform(2) == 0
+             ? static_cast<int32_t>(random->Uniform(2000)) - 1000
+             : static_cast<int32_t>(random->Next());
+}
+
+Control RandomControl(test::Random* random) {
+  Control control = Control_init_default;
+  control.has_value = true;
+  control.value = RandomInt(random);
+  control.has_axis = random->Uniform(2);
+  control.axis =
+      static_cast<Control_Axis>(random->Uniform(_Control_Axis_MAX + 1));
+  control.has_multiplier = random->Uniform(2);
+  control.multiplier = static_cast<Control_Multiplier>(
+      random->Uniform(_Control_Multiplier_MAX + 1));
+  control.has_key_pressed = random->Uniform(2);
+  control.key_pressed = RandomInt(random);
+  control.has_key_released = random->Uniform(2);
+  control.key_released = RandomInt(random);
+  control.has_feedhold = random->Uniform(2);
+  control.feedhold = random->Uniform(2);
+  control.has_estop = random->Uniform(2);
+  control.estop = random->Uniform(2);
+  control.has_value_delta = random->Uniform(2);
+  control.value_delta = RandomInt(random);
+  control.has_position = random->Uniform(2);
+  control.position = RandomInt(random);
+  control.events_count = random->Uniform(4);
+  for (pb_size_t i = 0; i < control.events_count; ++i) {
+    control.events[i].time_us = static_cast<uint32_t>(random->Next());
+    control.events[i].index = random->Uniform(16);
+    control.events[i].pressed = random->Uniform(2);
+  }
+  control.has_velocity = random->Uniform(2);
+  control.velocity = RandomInt(random);
+  control.has_acceleration = random->Uniform(2);
+  control.acceleration = RandomInt(random);
+  return control;
+}
+
+std::vector<uint8_t> DirectBytes(const Control& control) {
+  uint8_t buffer[Control_size];
+  size_t size = 0;
+  CHECK(Control_encode_direct(&control, buffer, &size));
+  return std::vector<uint8_t>(buffer, buffer + size);
+}
+
+// A varint field with a tag Control does not define.
+std::vector<uint8_t> UnknownField(uint32_t tag, uint64_t value) {
+  uint8_t buffer[16];
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  CHECK(pb_encode_tag(&stream, PB_WT_VARINT, tag));
+  CHECK(pb_encode_varint(&stream, value));
+  return std::vector<uint8_t>(buffer, buffer + stream.bytes_written);
+}
+
+// Encodes `control` one field at a time, shuffles the fields, keeping the
+// elements of the repeated field together and in order, and mixes in unknown
+// fields, some with tags above PB_TAG_INDEX_MAX_TAG.
+std::vector<uint8_t> ShuffledBytes(const Control& control,
+                                   test::Random* random) {
+  std::vector<std::vector<uint8_t>> chunks;
+#define ONLY_OPTIONAL(name)                \
+  single.has_##name = control.has_##name; \
+  single.name = control.name;
+#define ONLY_REPEATED(name)                         \
+  single.name##_count = control.name##_count;       \
+  memcpy(single.name, control.name, sizeof(single.name));
+#define SPLIT_FIELD(structname, atype, htype, ltype, name, tag) \
+  {                                                             \
+    Control single = Control_init_default;                      \
+    ONLY_##htype(name) chunks.push_back(DirectBytes(single));   \
+  }
+  Control_FIELDLIST(SPLIT_FIELD, unused)
+#undef SPLIT_FIELD
+#undef ONLY_REPEATED
+#undef ONLY_OPTIONAL
+
+  const uint32_t kUnknownTags[] = {13, 20, 200, 255, 256, 300, 4000};
+  int unknown = random->Uniform(4);
+  for (int i = 0; i < unknown; ++i) {
+    chunks.push_back(UnknownField(
+        kUnknownTags[random->Uniform(sizeof(kUnknownTags) /
+                                     sizeof(kUnknownTags[0]))],
+        random->Next() >> random->Uniform(64)));
+  }
+
+  for (size_t i = chunks.size(); i > 1; --i) {
+    std::swap(chunks[i - 1], chunks[random->Uniform(i)]);
+  }
+  std::vector<uint8_t> bytes;
+  for (const std::vector<uint8_t>& chunk : chunks) {
+    bytes.insert(bytes.end(), chunk.begin(), chunk.end());
+  }
+  return bytes;
+}
+
+// FNV-1a, to summarize a build's results in one line.
+class Digest {
+ public:
+  void Add(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 0x100000001b3;
+    }
+  }
+
+  uint64_t value() const { return hash_; }
+
+ private:
+  uint64_t hash_ = 0xcbf29ce484222325;
+};
+
+void TestShuffledDecode(Digest* digest) {
+  test::Random random(83);
+  for (int trial = 0; trial < 20000; ++trial) {
+    Control control = RandomControl(&random);
+    std::vector<uint8_t> input = ShuffledBytes(control, &random);
+    bool damaged = !input.empty() && random.Uniform(4) == 0;
+    if (damaged) {
+      input[random.Uniform(input.size())] =
+          static_cast<uint8_t>(random.Next());
+    }
+
+    Control decoded = Control_init_zero;
+    pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+    bool ok = pb_decode(&stream, Control_fields, &decoded);
+    digest->Add(&ok, sizeof(ok));
+    if (ok) {
+      std::vector<uint8_t> bytes = DirectBytes(decoded);
+      digest->Add(bytes.data(), bytes.size());
+    } else {
+      const char* error = PB_GET_ERROR(&stream);
+      digest->Add(error, strlen(error));
+    }
+    CHECK(damaged || (ok && DirectBytes(decoded) == DirectBytes(control)));
+  }
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(89);
+  std::vector<std::vector<uint8_t>> inputs;
+  for (int i = 0; i < 1000; ++i) {
+    inputs.push_back(ShuffledBytes(RandomControl(&random), &random));
+  }
+  Control control;
+  uint64_t start = test::NowNs();
+  for (int r = 0; r < repetitions; ++r) {
+    for (const std::vector<uint8_t>& input : inputs) {
+      pb_istream_t stream =
+          pb_istream_from_buffer(input.data(), input.size());
+      CHECK(pb_decode(&stream, Control_fields, &control));
+      test::DoNotOptimize(control);
+    }
+  }
+  double decode_ns = static_cast<double>(test::NowNs() - start) /
+                     (static_cast<double>(inputs.size()) * repetitions);
+
+  // Lookups in random order, as out-of-order input causes.
+  std::vector<uint32_t> tags;
+  for (int i = 0; i < 1024; ++i) {
+    tags.push_back(1 + random.Uniform(13));
+  }
+  pb_field_iter_t iter;
+  CHECK(pb_field_iter_begin(&iter, Control_fields, &control));
+  start = test::NowNs();
+  for (int r = 0; r < repetitions * 10; ++r) {
+    for (uint32_t tag : tags) {
+      test::DoNotOptimize(pb_field_iter_find(&iter, tag));
+    }
+  }
+  double find_ns = static_cast<double>(test::NowNs() - start) /
+                   (static_cast<double>(tags.size()) * repetitions * 10);
+
+  printf("shuffled Control decode %6.1f ns, random pb_field_iter_find "
+         "%5.1f ns\n",
+         decode_ns, find_ns);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+#if defined(PB_ENABLE_TAG_INDEX)
+  printf("tag index below %d, descriptor cache: on\n", PB_TAG_INDEX_MAX_TAG);
+#elif defined(PB_ENABLE_DESCRIPTOR_CACHE)
+  printf("tag index: off, descriptor cache: on\n");
+#else
+  printf("tag index: off, descriptor cache: off\n");
+#endif
+  TestFind();
+  Digest digest;
+  TestShuffledDecode(&digest);
+  printf("digest: %016llx\n", static_cast<unsigned long long>(digest.value()));
+  Benchmark(test::FullRun(argc, argv) ? 2000 : 100);
+  return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef TEST_TEST_UTIL_H_
+#define TEST_TEST_UTIL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+namespace test {
+
+// Aborts the test with the failing condition and location if `condition` is
+// false.
+#define CHECK(condition)                                                \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                              \
+      abort();                                                          \
+    }                                                                   \
+  } while (0)
+
+// Returns true if the benchmark was asked for a full-length run with --full.
+inline bool FullRun(int argc, char** argv) {
+  return argc > 1 && strcmp(argv[1], "--full") == 0;
+}
+
+// Monotonic time in nanoseconds.
+inline uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Small deterministic generator, so that failures reproduce.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed | 1) {}
+
+  uint64_t Next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_;
+  }
+
+  // Uniform in [0, bound).
+  uint32_t Uniform(uint32_t bound) { return Next() % bound; }
+
+  void Fill(uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      buffer[i] = static_cast<uint8_t>(Next());
+    }
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Keeps the compiler from discarding a computed value.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}  // namespace test
+
+#endif  // TEST_TEST_UTIL_H_
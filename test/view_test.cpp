@@ -0,0 +1,465 @@
+// Decodes messages with BYTES_VIEW and STRING_VIEW fields, also inside a
+// submessage, and checks that the views point into the input buffer at the
+// right bytes, agree with decoding the same input into copying BYTES and
+// STRING fields, and are never set to point outside the input when a length
+// is too long for it. With pb_decode_incremental, a view must hold the right
+// bytes when the call that completed it returns, whether the value arrived in
+// one feed or was split across several. Also times view and copying decodes
+// of large bytes fields.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "test_util.h"
+
+// The same messages bound by hand twice, with views and with copies.
+struct Packet {
+  bool has_name;
+  pb_view_t name;
+  bool has_payload;
+  pb_view_t payload;
+  bool has_seq;
+  uint32_t seq;
+  pb_size_t chunks_count;
+  pb_view_t chunks[4];
+};
+
+struct Envelope {
+  bool has_packet;
+  Packet packet;
+  bool has_trailer;
+  pb_view_t trailer;
+};
+
+typedef PB_BYTES_ARRAY_T(256) PacketCopy_payload_t;
+typedef PB_BYTES_ARRAY_T(32) PacketCopy_chunks_t;
+typedef PB_BYTES_ARRAY_T(32) EnvelopeCopy_trailer_t;
+
+struct PacketCopy {
+  bool has_name;
+  char name[48];
+  bool has_payload;
+  PacketCopy_payload_t payload;
+  bool has_seq;
+  uint32_t seq;
+  pb_size_t chunks_count;
+  PacketCopy_chunks_t chunks[4];
+};
+
+struct EnvelopeCopy {
+  bool has_packet;
+  PacketCopy packet;
+  bool has_trailer;
+  EnvelopeCopy_trailer_t trailer;
+};
+
+#define Packet_FIELDLIST(X, a)                      \
+  X(a, STATIC, OPTIONAL, STRING_VIEW, name, 1)      \
+  X(a, STATIC, OPTIONAL, BYTES_VIEW, payload, 2)    \
+  X(a, STATIC, OPTIONAL, UINT32, seq, 3)            \
+  X(a, STATIC, REPEATED, BYTES_VIEW, chunks, 4)
+#define Packet_CALLBACK NULL
+#define Packet_DEFAULT NULL
+
+#define Envelope_FIELDLIST(X, a)                    \
+  X(a, STATIC, OPTIONAL, MESSAGE, packet, 1)        \
+  X(a, STATIC, OPTIONAL, BYTES_VIEW, trailer, 2)
+#define Envelope_CALLBACK NULL
+#define Envelope_DEFAULT NULL
+#define Envelope_packet_MSGTYPE Packet
+
+#define PacketCopy_FIELDLIST(X, a)                  \
+  X(a, STATIC, OPTIONAL, STRING, name, 1)           \
+  X(a, STATIC, OPTIONAL, BYTES, payload, 2)         \
+  X(a, STATIC, OPTIONAL, UINT32, seq, 3)            \
+  X(a, STATIC, REPEATED, BYTES, chunks, 4)
+#define PacketCopy_CALLBACK NULL
+#define PacketCopy_DEFAULT NULL
+
+#define EnvelopeCopy_FIELDLIST(X, a)                \
+  X(a, STATIC, OPTIONAL, MESSAGE, packet, 1)        \
+  X(a, STATIC, OPTIONAL, BYTES, trailer, 2)
+#define EnvelopeCopy_CALLBACK NULL
+#define EnvelopeCopy_DEFAULT NULL
+#define EnvelopeCopy_packet_MSGTYPE PacketCopy
+
+// One large bytes field, for the benchmark.
+typedef PB_BYTES_ARRAY_T(16384) BlobCopy_data_t;
+
+struct BlobView {
+  bool has_data;
+  pb_view_t data;
+};
+
+struct BlobCopy {
+  bool has_data;
+  BlobCopy_data_t data;
+};
+
+#define BlobView_FIELDLIST(X, a) X(a, STATIC, OPTIONAL, BYTES_VIEW, data, 1)
+#define BlobView_CALLBACK NULL
+#define BlobView_DEFAULT NULL
+
+#define BlobCopy_FIELDLIST(X, a) X(a, STATIC, OPTIONAL, BYTES, data, 1)
+#define BlobCopy_CALLBACK NULL
+#define BlobCopy_DEFAULT NULL
+
+extern const pb_msgdesc_t Packet_msg;
+extern const pb_msgdesc_t Envelope_msg;
+extern const pb_msgdesc_t PacketCopy_msg;
+extern const pb_msgdesc_t EnvelopeCopy_msg;
+extern const pb_msgdesc_t BlobView_msg;
+extern const pb_msgdesc_t BlobCopy_msg;
+#define Packet_fields &Packet_msg
+#define Envelope_fields &Envelope_msg
+#define PacketCopy_fields &PacketCopy_msg
+#define EnvelopeCopy_fields &EnvelopeCopy_msg
+#define BlobView_fields &BlobView_msg
+#define BlobCopy_fields &BlobCopy_msg
+
+PB_BIND(Packet, Packet, 2)
+PB_BIND(Envelope, Envelope, 2)
+PB_BIND(PacketCopy, PacketCopy, 2)
+PB_BIND(EnvelopeCopy, EnvelopeCopy, 2)
+PB_BIND(BlobView, BlobView, 2)
+PB_BIND(BlobCopy, BlobCopy, 4)
+
+namespace {
+
+const char kTooLarge[] = "field too large for incremental buffer";
+
+// The storage behind the views of an encoded Envelope.
+struct EnvelopeSource {
+  std::string name;
+  std::vector<uint8_t> payload;
+  std::vector<std::vector<uint8_t>> chunks;
+  std::vector<uint8_t> trailer;
+  Envelope envelope;
+};
+
+pb_view_t ViewOf(const void* data, size_t size) {
+  pb_view_t view;
+  view.bytes = static_cast<const pb_byte_t*>(data);
+  view.size = size;
+  return view;
+}
+
+// Values up to `max_value` bytes long; the copying types hold 32 to 256.
+void RandomEnvelope(size_t max_value, test::Random* random,
+                    EnvelopeSource* source) {
+  Envelope& envelope = source->envelope;
+  envelope = Envelope();
+  Packet& packet = envelope.packet;
+  envelope.has_packet = random->Uniform(4) != 0;
+
+  source->name.assign(random->Uniform(std::min<size_t>(max_value, 47) + 1),
+                      'a');
+  for (char& c : source->name) {
+    c = static_cast<char>('a' + random->Uniform(26));
+  }
+  packet.has_name = random->Uniform(2);
+  packet.name = ViewOf(source->name.data(), source->name.size());
+
+  source->payload.resize(random->Uniform(max_value + 1));
+  random->Fill(source->payload.data(), source->payload.size());
+  packet.has_payload = random->Uniform(2);
+  packet.payload = ViewOf(source->payload.data(), source->payload.size());
+
+  packet.has_seq = random->Uniform(2);
+  packet.seq = static_cast<uint32_t>(random->Next());
+
+  packet.chunks_count = random->Uniform(pb_arraysize(Packet, chunks) + 1);
+  source->chunks.resize(packet.chunks_count);
+  for (pb_size_t i = 0; i < packet.chunks_count; ++i) {
+    source->chunks[i].resize(random->Uniform(std::min<size_t>(max_value, 32)));
+    random->Fill(source->chunks[i].data(), source->chunks[i].size());
+    packet.chunks[i] =
+        ViewOf(source->chunks[i].data(), source->chunks[i].size());
+  }
+
+  source->trailer.resize(random->Uniform(std::min<size_t>(max_value, 32)));
+  random->Fill(source->trailer.data(), source->trailer.size());
+  envelope.has_trailer = random->Uniform(2);
+  envelope.trailer = ViewOf(source->trailer.data(), source->trailer.size());
+}
+
+template <typename Message>
+std::vector<uint8_t> Encode(const pb_msgdesc_t* fields,
+                            const Message& message) {
+  static uint8_t buffer[20000];
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  CHECK(pb_encode(&stream, fields, &message));
+  return std::vector<uint8_t>(buffer, buffer + stream.bytes_written);
+}
+
+bool SameBytes(const pb_view_t& view, const void* bytes, size_t size) {
+  return view.size == size &&
+         (size == 0 || memcmp(view.bytes, bytes, size) == 0);
+}
+
+// True if `view` lies within [begin, begin + size).
+bool Inside(const pb_view_t& view, const void* begin, size_t size) {
+  uintptr_t start = reinterpret_cast<uintptr_t>(begin);
+  uintptr_t address = reinterpret_cast<uintptr_t>(view.bytes);
+  return address >= start && address <= start + size &&
+         view.size <= start + size - address;
+}
+
+// Calls `check` with every view of `envelope` that is present.
+template <typename Check>
+void ForEachView(const Envelope& envelope, Check check) {
+  const Packet& packet = envelope.packet;
+  if (envelope.has_packet) {
+    if (packet.has_name) check(packet.name);
+    if (packet.has_payload) check(packet.payload);
+    for (pb_size_t i = 0; i < packet.chunks_count; ++i) check(packet.chunks[i]);
+  }
+  if (envelope.has_trailer) check(envelope.trailer);
+}
+
+bool SameAsCopy(const Envelope& view, const EnvelopeCopy& copy) {
+  const Packet& a = view.packet;
+  const PacketCopy& b = copy.packet;
+  if (view.has_packet != copy.has_packet ||
+      view.has_trailer != copy.has_trailer ||
+      (view.has_trailer &&
+       !SameBytes(view.trailer, copy.trailer.bytes, copy.trailer.size))) {
+    return false;
+  }
+  if (!view.has_packet) {
+    return true;
+  }
+  if (a.has_name != b.has_name ||
+      (a.has_name && (a.name.size >= sizeof(b.name) ||
+                      !SameBytes(a.name, b.name, a.name.size))) ||
+      a.has_payload != b.has_payload ||
+      (a.has_payload &&
+       !SameBytes(a.payload, b.payload.bytes, b.payload.size)) ||
+      a.has_seq != b.has_seq || (a.has_seq && a.seq != b.seq) ||
+      a.chunks_count != b.chunks_count) {
+    return false;
+  }
+  for (pb_size_t i = 0; i < a.chunks_count; ++i) {
+    if (!SameBytes(a.chunks[i], b.chunks[i].bytes, b.chunks[i].size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Overwrites one byte with a large length prefix or a random value, or
+// truncates.
+void Damage(std::vector<uint8_t>* bytes, test::Random* random) {
+  if (bytes->empty()) {
+    return;
+  }
+  size_t at = random->Uniform(bytes->size());
+  switch (random->Uniform(3)) {
+    case 0:
+      bytes->resize(at);
+      break;
+    case 1:
+      (*bytes)[at] = static_cast<uint8_t>(random->Next());
+      break;
+    default:
+      // A length, if it is one, one past the end or much longer.
+      (*bytes)[at] = random->Uniform(2) == 0
+                         ? static_cast<uint8_t>(bytes->size() - at)
+                         : 0x7f;
+      break;
+  }
+}
+
+void TestDecode(int trials) {
+  test::Random random(131);
+  int over_capacity = 0;
+  int damaged_ok = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    EnvelopeSource source;
+    RandomEnvelope(300, &random, &source);
+    std::vector<uint8_t> input = Encode(Envelope_fields, source.envelope);
+    bool damaged = random.Uniform(2) == 0;
+    if (damaged) {
+      Damage(&input, &random);
+    }
+
+    // Views the decoder did not get to stay empty.
+    Envelope view = {};
+    pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+    bool ok = pb_decode(&stream, Envelope_fields, &view);
+    ForEachView(view, [&](const pb_view_t& v) {
+      CHECK(Inside(v, input.data(), input.size()) ||
+            (!ok && v.bytes == nullptr && v.size == 0));
+    });
+
+    static EnvelopeCopy copy;
+    stream = pb_istream_from_buffer(input.data(), input.size());
+    bool copy_ok = pb_decode(&stream, EnvelopeCopy_fields, &copy);
+    const char* copy_error = PB_GET_ERROR(&stream);
+    if (!copy_ok && (strcmp(copy_error, "bytes overflow") == 0 ||
+                     strcmp(copy_error, "string overflow") == 0)) {
+      // Too long for the copying types, not for views.
+      ++over_capacity;
+      continue;
+    }
+    CHECK(ok == copy_ok);
+    CHECK(!ok || SameAsCopy(view, copy));
+    if (!damaged) {
+      CHECK(ok && Encode(Envelope_fields, view) == input);
+    } else {
+      damaged_ok += ok;
+    }
+  }
+  CHECK(over_capacity > 0 && damaged_ok > 0);
+}
+
+// Lengths past the end of the input, and past 32 bits, fail without
+// touching the view.
+void TestTooLong() {
+  const uint8_t kPastEnd[] = {0x0a, 0x05, 'a', 'b', 'c', 'd'};
+  const uint8_t kHuge[] = {0x0a, 0xff, 0xff, 0xff, 0xff, 0x0f, 'a'};
+  const uint8_t kOverflow[] = {0x0a, 0xff, 0xff, 0xff, 0xff, 0x1f, 'a'};
+  struct {
+    const uint8_t* input;
+    size_t size;
+  } cases[] = {{kPastEnd, sizeof(kPastEnd)},
+               {kHuge, sizeof(kHuge)},
+               {kOverflow, sizeof(kOverflow)}};
+  for (const auto& c : cases) {
+    BlobView blob = {};
+    pb_istream_t stream = pb_istream_from_buffer(c.input, c.size);
+    CHECK(!pb_decode_ex(&stream, BlobView_fields, &blob, PB_DECODE_NOINIT));
+    CHECK(blob.data.bytes == nullptr && blob.data.size == 0);
+  }
+
+  // Views need the input in memory.
+  const uint8_t kValid[] = {0x0a, 0x02, 'a', 'b'};
+  pb_istream_t stream = pb_istream_from_buffer(kValid, sizeof(kValid));
+  pb_istream_t callback = {
+      [](pb_istream_t* s, pb_byte_t* buf, size_t count) {
+        pb_istream_t* inner = static_cast<pb_istream_t*>(s->state);
+        return pb_read(inner, buf, count);
+      },
+      &stream, sizeof(kValid)};
+  BlobView blob;
+  CHECK(!pb_decode(&callback, BlobView_fields, &blob));
+  CHECK(strcmp(PB_GET_ERROR(&callback), "view requires buffer stream") == 0);
+}
+
+// Feeds an Envelope in pieces and checks each view right after the call
+// that completed it: it must hold the source bytes and point into that
+// call's piece, or into the context if the value was split.
+void TestIncremental(int trials) {
+  test::Random random(137);
+  int split_views = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    EnvelopeSource source;
+    RandomEnvelope(PB_INCREMENTAL_FIELD_SIZE - 2, &random, &source);
+    const Envelope& expected = source.envelope;
+    std::vector<uint8_t> input = Encode(Envelope_fields, expected);
+
+    Envelope view = {};
+    pb_decode_ctx_t ctx;
+    pb_decode_incremental_init(&ctx, Envelope_fields, &view, 0);
+    Envelope seen = {};
+    for (size_t position = 0; position < input.size();) {
+      size_t feed = std::min<size_t>(input.size() - position,
+                                     random.Uniform(2) == 0
+                                         ? random.Uniform(4)
+                                         : random.Uniform(40));
+      std::vector<uint8_t> piece(input.begin() + position,
+                                 input.begin() + position + feed);
+      size_t consumed = 0;
+      CHECK(pb_decode_incremental(&ctx, piece.data(), piece.size(),
+                                  &consumed) == PB_DECODE_NEED_MORE);
+      position += feed;
+
+      auto check = [&](bool was_present, bool present, const pb_view_t& got,
+                       const pb_view_t& want) {
+        if (was_present || !present) {
+          return;
+        }
+        CHECK(SameBytes(got, want.bytes, want.size));
+        bool in_piece = Inside(got, piece.data(), piece.size());
+        CHECK(in_piece || Inside(got, &ctx, sizeof(ctx)));
+        split_views += !in_piece && got.size > 0;
+      };
+      const Packet& p = view.packet;
+      const Packet& e = expected.packet;
+      check(seen.packet.has_name, p.has_name, p.name, e.name);
+      check(seen.packet.has_payload, p.has_payload, p.payload, e.payload);
+      for (pb_size_t i = seen.packet.chunks_count; i < p.chunks_count; ++i) {
+        check(false, true, p.chunks[i], e.chunks[i]);
+      }
+      check(seen.has_trailer, view.has_trailer, view.trailer,
+            expected.trailer);
+      seen = view;
+      memset(piece.data(), 0xa5, piece.size());
+    }
+    CHECK(pb_decode_incremental_finish(&ctx) == PB_DECODE_COMPLETE);
+  }
+  CHECK(split_views > 0);
+
+  // A view value longer than the context holds decodes in one piece only.
+  std::vector<uint8_t> data(PB_INCREMENTAL_FIELD_SIZE, 0x42);
+  BlobView blob = {true, ViewOf(data.data(), data.size())};
+  std::vector<uint8_t> input = Encode(BlobView_fields, blob);
+  pb_decode_ctx_t ctx;
+  pb_decode_incremental_init(&ctx, BlobView_fields, &blob, 0);
+  size_t consumed = 0;
+  CHECK(pb_decode_incremental(&ctx, input.data(), input.size() - 1,
+                              &consumed) == PB_DECODE_NEED_MORE);
+  CHECK(pb_decode_incremental(&ctx, input.data() + input.size() - 1, 1,
+                              &consumed) == PB_DECODE_ERROR);
+  CHECK(strcmp(PB_GET_ERROR(&ctx), kTooLarge) == 0);
+  pb_decode_incremental_init(&ctx, BlobView_fields, &blob, 0);
+  CHECK(pb_decode_incremental(&ctx, input.data(), input.size(), &consumed) ==
+        PB_DECODE_NEED_MORE);
+  CHECK(pb_decode_incremental_finish(&ctx) == PB_DECODE_COMPLETE);
+  CHECK(blob.data.bytes == input.data() + 2 &&
+        blob.data.size == data.size());
+}
+
+template <typename Message>
+double DecodeNs(const pb_msgdesc_t* fields, const std::vector<uint8_t>& input,
+                int repetitions) {
+  static Message message;
+  uint64_t start = test::NowNs();
+  for (int i = 0; i < repetitions; ++i) {
+    pb_istream_t stream = pb_istream_from_buffer(input.data(), input.size());
+    CHECK(pb_decode(&stream, fields, &message));
+    test::DoNotOptimize(message);
+  }
+  return static_cast<double>(test::NowNs() - start) / repetitions;
+}
+
+void Benchmark(int repetitions) {
+  test::Random random(139);
+  for (size_t size : {64, 1024, 16384}) {
+    std::vector<uint8_t> data(size);
+    random.Fill(data.data(), data.size());
+    BlobView blob = {true, ViewOf(data.data(), data.size())};
+    std::vector<uint8_t> input = Encode(BlobView_fields, blob);
+    printf("%5zu-byte field: copy %7.1f ns, view %5.1f ns\n", size,
+           DecodeNs<BlobCopy>(BlobCopy_fields, input, repetitions),
+           DecodeNs<BlobView>(BlobView_fields, input, repetitions));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const bool full = test::FullRun(argc, argv);
+  TestTooLong();
+  TestDecode(full ? 200000 : 20000);
+  TestIncremental(full ? 200000 : 20000);
+  Benchmark(full ? 200000 : 10000);
+  return 0;
+}